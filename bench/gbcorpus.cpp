@@ -0,0 +1,333 @@
+/*
+ * gbcorpus.cpp: Synthetic GenBank corpus generator
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stdio.h> // snprintf
+#include <string>
+#include <random>
+#include <algorithm> // min
+#include "gbcorpus.h"
+
+static const char *words[] = {
+	"protein", "hypothetical", "ribosomal", "subunit", "transporter", "ATP-binding",
+	"membrane", "putative", "regulator", "transcriptional", "kinase", "domain",
+	"family", "complete", "genome", "chromosome", "strain", "sequence", "of", "the"};
+
+static const char *featureKeys[] = {"gene", "CDS", "tRNA", "rRNA", "misc_feature", "repeat_region"};
+
+/**
+ * Random generator for corpus content. Seeded identically for every
+ * run, so corpora are reproducible.
+ */
+struct corpusRandom
+{
+	std::mt19937_64 engine;
+	corpusRandom() : engine(20190101) {}
+	size_t uniform(size_t n) { return engine() % n; }
+};
+
+/**
+ * Append a line.
+ * @param[out] gb The GenBank text.
+ * @param[in] line The line.
+ * @param[in] eol The line ending.
+ */
+static void putLine(std::string *gb, const std::string &line, const char *eol)
+{
+	gb->append(line);
+	gb->append(eol);
+}
+
+/**
+ * Append a text as lines wrapped at column 79.
+ * @param[out] gb The GenBank text.
+ * @param[in] head Content of the first line before the text, padded to indent.
+ * @param[in] text The text.
+ * @param[in] indent Indentation of the continuation lines.
+ * @param[in] eol The line ending.
+ */
+static void putWrapped(std::string *gb, const std::string &head, const std::string &text, size_t indent, const char *eol)
+{
+	std::string line(head);
+	line.resize(indent, ' ');
+	size_t pos = 0;
+
+	while (pos < text.length())
+	{
+		size_t room = 79 - line.length();
+		size_t n = std::min(room, text.length() - pos);
+
+		// Break at a space if the text does not fit
+		if (pos + n < text.length())
+		{
+			size_t space = text.rfind(' ', pos + n);
+			if (space != std::string::npos && space > pos)
+			{
+				n = space - pos;
+			}
+		}
+
+		line.append(text, pos, n);
+		putLine(gb, line, eol);
+		pos += n;
+		while (pos < text.length() && text[pos] == ' ')
+		{
+			pos++;
+		}
+		line.assign(indent, ' ');
+	}
+}
+
+static std::string makeWords(corpusRandom *rnd, size_t n)
+{
+	std::string text;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i)
+		{
+			text.append(" ");
+		}
+		text.append(words[rnd->uniform(sizeof(words) / sizeof(words[0]))]);
+	}
+	return text;
+}
+
+static std::string makeProtein(corpusRandom *rnd, size_t n)
+{
+	static const char aminoAcids[] = "ACDEFGHIKLMNPQRSTVWY";
+	std::string seq(n, 'M');
+	for (size_t i = 1; i < n; i++)
+	{
+		seq[i] = aminoAcids[rnd->uniform(20)];
+	}
+	return seq;
+}
+
+/**
+ * Append the header of a record, from LOCUS to the last REFERENCE.
+ */
+static void putHeader(std::string *gb, corpusRandom *rnd, size_t index, size_t length, const char *eol)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "LOCUS       SYN%08zu %13zu bp    DNA     linear   BCT 15-OCT-2018", index, length);
+	putLine(gb, buf, eol);
+	putWrapped(gb, "DEFINITION", "Synthetic bacterium " + makeWords(rnd, 4 + rnd->uniform(20)) + ".", 12, eol);
+
+	snprintf(buf, sizeof(buf), "ACCESSION   SY%06zu", index);
+	putLine(gb, buf, eol);
+	snprintf(buf, sizeof(buf), "VERSION     SY%06zu.1", index);
+	putLine(gb, buf, eol);
+	putLine(gb, "KEYWORDS    .", eol);
+	putLine(gb, "SOURCE      Synthetic bacterium", eol);
+	putLine(gb, "  ORGANISM  Synthetic bacterium", eol);
+	putWrapped(gb, "", "Bacteria; Proteobacteria; Gammaproteobacteria; Enterobacterales; Enterobacteriaceae; Synthetic.", 12, eol);
+
+	for (size_t r = 1; r <= 2; r++)
+	{
+		snprintf(buf, sizeof(buf), "REFERENCE   %zu  (bases 1 to %zu)", r, length);
+		putLine(gb, buf, eol);
+		putWrapped(gb, "  AUTHORS", "Doe,J., Roe,R., Smith,A.B., Jones,C. and Brown,D.", 12, eol);
+		putWrapped(gb, "  TITLE", makeWords(rnd, 10 + rnd->uniform(10)), 12, eol);
+		putLine(gb, "  JOURNAL   Unpublished", eol);
+		snprintf(buf, sizeof(buf), "   PUBMED   %zu", 10000000 + rnd->uniform(20000000));
+		putLine(gb, buf, eol);
+	}
+}
+
+/**
+ * Append a feature table with nfeatures genes and CDS features.
+ */
+static void putFeatures(std::string *gb, corpusRandom *rnd, size_t length, size_t nfeatures, size_t proteinLength, const char *eol)
+{
+	char buf[128];
+
+	putLine(gb, "FEATURES             Location/Qualifiers", eol);
+	snprintf(buf, sizeof(buf), "     source          1..%zu", length);
+	putLine(gb, buf, eol);
+	putLine(gb, "                     /organism=\"Synthetic bacterium\"", eol);
+	putLine(gb, "                     /mol_type=\"genomic DNA\"", eol);
+
+	size_t span = length / (nfeatures + 1) + 1;
+
+	for (size_t i = 0; i < nfeatures; i++)
+	{
+		size_t start = i * span + 1;
+		size_t end = start + span / 2;
+		const char *key = i % 2 ? "CDS" : featureKeys[rnd->uniform(sizeof(featureKeys) / sizeof(featureKeys[0]))];
+
+		if (rnd->uniform(3))
+		{
+			snprintf(buf, sizeof(buf), "     %-16s%zu..%zu", key, start, end);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "     %-16scomplement(%zu..%zu)", key, start, end);
+		}
+		putLine(gb, buf, eol);
+
+		snprintf(buf, sizeof(buf), "/locus_tag=\"SYN_%06zu\"", i);
+		putWrapped(gb, "", buf, 21, eol);
+
+		if (key[0] == 'C')
+		{
+			putWrapped(gb, "", "/codon_start=1", 21, eol);
+			putWrapped(gb, "", "/product=\"" + makeWords(rnd, 3 + rnd->uniform(8)) + "\"", 21, eol);
+			putWrapped(gb, "", "/translation=\"" + makeProtein(rnd, proteinLength / 2 + rnd->uniform(proteinLength)) + "\"", 21, eol);
+		}
+		else
+		{
+			putWrapped(gb, "", "/note=\"" + makeWords(rnd, 2 + rnd->uniform(30)) + "\"", 21, eol);
+		}
+	}
+}
+
+/**
+ * Append an ORIGIN block with a random sequence.
+ */
+static void putSequence(std::string *gb, corpusRandom *rnd, size_t length, const char *eol)
+{
+	static const char bases[] = "acgt";
+	char buf[24];
+
+	putLine(gb, "ORIGIN      ", eol);
+
+	std::string line;
+	for (size_t i = 0; i < length; i += 60)
+	{
+		snprintf(buf, sizeof(buf), "%9zu", i + 1);
+		line.assign(buf);
+
+		for (size_t j = i; j < std::min(i + 60, length); j++)
+		{
+			if ((j - i) % 10 == 0)
+			{
+				line.push_back(' ');
+			}
+			line.push_back(bases[rnd->uniform(4)]);
+		}
+
+		putLine(gb, line, eol);
+	}
+}
+
+/**
+ * Append a CONTIG line joining n pieces.
+ */
+static void putContig(std::string *gb, size_t n, const char *eol)
+{
+	std::string text("join(");
+	char buf[64];
+
+	for (size_t i = 0; i < n; i++)
+	{
+		snprintf(buf, sizeof(buf), "%sSC%06zu.1:1..%zu,gap(100)", i ? "," : "", i, 1000 + i * 37);
+		text.append(buf);
+	}
+	text.append(")");
+
+	putWrapped(gb, "CONTIG", text, 12, eol);
+}
+
+/**
+ * Name of a corpus shape.
+ * @param[in] shape The shape.
+ * @return The name.
+ */
+const char *corpusName(corpusShape shape)
+{
+	switch (shape)
+	{
+	case SMALL_RECORDS:
+		return "small-records";
+	case FEATURE_TABLE:
+		return "feature-table";
+	case LONG_SEQUENCE:
+		return "long-sequence";
+	case CONTIG_ONLY:
+		return "contig-only";
+	case CRLF_RECORDS:
+		return "crlf-records";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Generate a synthetic GenBank corpus.
+ * @param[in] shape The corpus shape.
+ * @param[in] scale Size factor. 1 gives corpora of tens of MB.
+ * @param[out] gb The GenBank text.
+ * @param[out] nrecords Number of records.
+ */
+void makeCorpus(corpusShape shape, double scale, std::string *gb, size_t *nrecords)
+{
+	corpusRandom rnd;
+	gb->clear();
+
+	auto scaled = [scale](size_t n) { return std::max((size_t)1, (size_t)(n * scale)); };
+
+	switch (shape)
+	{
+	case SMALL_RECORDS:
+	case CRLF_RECORDS:
+	{
+		const char *eol = shape == CRLF_RECORDS ? "\r\n" : "\n";
+		*nrecords = scaled(20000);
+
+		for (size_t i = 0; i < *nrecords; i++)
+		{
+			size_t length = 200 + rnd.uniform(1500);
+			putHeader(gb, &rnd, i, length, eol);
+			putFeatures(gb, &rnd, length, 1 + rnd.uniform(4), 60, eol);
+			putSequence(gb, &rnd, length, eol);
+			putLine(gb, "//", eol);
+		}
+		break;
+	}
+	case FEATURE_TABLE:
+	{
+		size_t length = scaled(5000000);
+		*nrecords = 1;
+
+		putHeader(gb, &rnd, 0, length, "\n");
+		putFeatures(gb, &rnd, length, scaled(100000), 300, "\n");
+		putSequence(gb, &rnd, length, "\n");
+		putLine(gb, "//", "\n");
+		break;
+	}
+	case LONG_SEQUENCE:
+	{
+		size_t length = scaled(12000000);
+		*nrecords = 1;
+
+		putHeader(gb, &rnd, 0, length, "\n");
+		putFeatures(gb, &rnd, length, 10, 300, "\n");
+		putSequence(gb, &rnd, length, "\n");
+		putLine(gb, "//", "\n");
+		break;
+	}
+	case CONTIG_ONLY:
+	{
+		*nrecords = scaled(5000);
+
+		for (size_t i = 0; i < *nrecords; i++)
+		{
+			size_t length = 100000 + rnd.uniform(1000000);
+			putHeader(gb, &rnd, i, length, "\n");
+			putFeatures(gb, &rnd, length, 1, 60, "\n");
+			putContig(gb, 5 + rnd.uniform(50), "\n");
+			putLine(gb, "//", "\n");
+		}
+		break;
+	}
+	default:
+		*nrecords = 0;
+		break;
+	}
+}
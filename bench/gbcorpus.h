@@ -0,0 +1,28 @@
+/*
+ * gbcorpus.h: Synthetic GenBank corpus generator
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#pragma once
+
+#include <string>
+
+/*
+ * Corpus shapes. Each one stresses a different part of the converters.
+ */
+enum corpusShape
+{
+	SMALL_RECORDS, // Many small records
+	FEATURE_TABLE, // One record with a huge feature table and long qualifiers
+	LONG_SEQUENCE, // One record with a chromosome-scale sequence
+	CONTIG_ONLY,   // Records with a CONTIG line instead of a sequence
+	CRLF_RECORDS,  // Small records with \r\n line endings
+	NSHAPES
+};
+
+const char *corpusName(corpusShape shape);
+void makeCorpus(corpusShape shape, double scale, std::string *gb, size_t *nrecords);
@@ -0,0 +1,182 @@
+/*
+ * gbjson_bench.cpp: Conversion throughput benchmark
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <iostream>
+#include <fstream> // ofstream
+#include <string>
+#include <memory> // make_unique
+#include <chrono>
+#include <cstdlib> // strtod, strtol
+#include <stdio.h> // printf
+#include "gbjson.h"
+#include "gbcorpus.h"
+#include "optionparser/optionparser.h"
+
+enum optionIndex
+{
+	UNKNOWN,
+	HELP,
+	SCALE,
+	REPEAT,
+	THREADS,
+	WRITE
+};
+
+struct Arg : public option::Arg
+{
+	static option::ArgStatus Number(const option::Option &option, bool msg)
+	{
+		char *endptr = 0;
+		if (option.arg != 0 && strtod(option.arg, &endptr) > 0 && endptr != option.arg && *endptr == 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a positive number" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+
+	static option::ArgStatus Required(const option::Option &option, bool msg)
+	{
+		if (option.arg != 0 && option.arg[0] != 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires an argument" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+};
+
+const option::Descriptor usage[] =
+	{
+		{UNKNOWN, 0, "", "", option::Arg::None, "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+												"~~ gbjson conversion benchmark\n\n"
+												"USAGE: gbjson_bench [options]\n\n"
+												"Throughput is measured on the input of each converter.\n\n"
+												"Options:"},
+		{HELP, 0, "h", "help", option::Arg::None, "  -h  --help        Print help."},
+		{SCALE, 0, "s", "scale", Arg::Number, "  -s  --scale=X     Corpus size factor. Default 1."},
+		{REPEAT, 0, "r", "repeat", Arg::Number, "  -r  --repeat=N    Report the best of N runs. Default 3."},
+		{THREADS, 0, "t", "threads", Arg::Number, "  -t  --threads=N   Threads for gb2json. Default 1."},
+		{WRITE, 0, "w", "write", Arg::Required, "  -w  --write=DIR   Write the corpus to DIR instead of benchmarking.\n"},
+		{0, 0, 0, 0, 0, 0}};
+
+/**
+ * Time the best of several runs of a function.
+ * @param[in] repeat Number of runs.
+ * @param[in] fn The function.
+ * @return The best time in seconds.
+ */
+template <typename Function>
+static double bestTime(int repeat, Function fn)
+{
+	double best = 0;
+
+	for (int i = 0; i < repeat; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (i == 0 || elapsed.count() < best)
+		{
+			best = elapsed.count();
+		}
+	}
+
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	// Parse command line options
+	argc -= (argc > 0);
+	argv += (argc > 0); // skip program name argv[0]
+	option::Stats stats(usage, argc, argv);
+	auto options = std::make_unique<option::Option[]>(stats.options_max);
+	auto buffer = std::make_unique<option::Option[]>(stats.buffer_max);
+	option::Parser parse(usage, argc, argv, options.get(), buffer.get());
+
+	if (parse.error() || parse.nonOptionsCount() > 0)
+	{
+		option::printUsage(std::cout, usage);
+		return 1;
+	}
+
+	if (options[HELP])
+	{
+		option::printUsage(std::cout, usage);
+		return 0;
+	}
+
+	double scale = options[SCALE] ? strtod(options[SCALE].arg, 0) : 1;
+	int repeat = options[REPEAT] ? atoi(options[REPEAT].arg) : 3;
+
+	gboptions opts;
+	if (options[THREADS])
+	{
+		opts.threads = atoi(options[THREADS].arg);
+	}
+
+	if (!options[WRITE])
+	{
+		printf("%-14s %9s %9s %9s | %12s %12s | %12s %12s\n",
+			   "corpus", "records", "GB MB", "JSON MB", "gb2json MB/s", "records/s", "json2gb MB/s", "records/s");
+	}
+
+	for (int shape = 0; shape < NSHAPES; shape++)
+	{
+		std::string gb, json, gbOut;
+		size_t nrecords;
+		gberror err;
+
+		makeCorpus((corpusShape)shape, scale, &gb, &nrecords);
+
+		// Write the corpus
+		if (options[WRITE])
+		{
+			std::string filename(options[WRITE].arg);
+			filename.append("/").append(corpusName((corpusShape)shape)).append(".gb");
+
+			std::ofstream output(filename, std::ios::binary);
+			output << gb;
+			if (output.fail())
+			{
+				std::cout << "Failed writing to " << filename << std::endl;
+				return 1;
+			}
+			std::cout << filename << std::endl;
+			continue;
+		}
+
+		double gbTime = bestTime(repeat, [&]() { gb2json(&gb, &json, &err, &opts); });
+		double jsonTime = bestTime(repeat, [&]() { json2gb(&json, &gbOut, &err); });
+
+		if (err.flag)
+		{
+			std::cout << corpusName((corpusShape)shape) << ": " << err.msg << std::endl;
+			return 1;
+		}
+
+		const double MB = 1e6;
+		printf("%-14s %9zu %9.1f %9.1f | %12.1f %12.0f | %12.1f %12.0f\n",
+			   corpusName((corpusShape)shape), nrecords, gb.size() / MB, json.size() / MB,
+			   gb.size() / MB / gbTime, nrecords / gbTime,
+			   json.size() / MB / jsonTime, nrecords / jsonTime);
+	}
+
+	return 0;
+}
@@ -8,9 +8,15 @@
  */
 
 #include <iostream>
-#include <fstream> // ofstream
 #include <string>
 #include <memory> // make_unique
+#include <cstdlib> // strtol
+#include <cstring> // strcmp
+#include <algorithm> // min
+#include <chrono>
+#include <vector>
+#include <string_view>
+#include <filesystem> // exists
 #include "gbjson.h"
 #include "optionparser/optionparser.h"
 
@@ -19,18 +25,152 @@ enum optionIndex
 	UNKNOWN,
 	HELP,
 	FORCE,
+	COMPACT,
+	STREAM,
+	PIPELINE,
+	THREADS,
+	STATS,
+	OUTDIR,
+	LIST,
+	INDEX,
+	RECORDS,
+	RECORDSFILE,
+	DIVISIONS,
+	NODIVISIONS,
+	MOLECULES,
+	MINLENGTH,
+	MAXLENGTH,
+	NOSEQUENCE,
+	KEYWORDS,
+	NOKEYWORDS,
+	FEATURES,
+	NOFEATURES,
+	QUALIFIERS,
+	NOQUALIFIERS,
+	SEQUENCES,
+	PACK,
+	LOCATIONS,
+	NDJSON,
+	SPLIT,
+	VERIFY,
+	INCREMENTAL,
+	PREVINDEX,
 	VERSION
 };
 
+struct Arg : public option::Arg
+{
+	static option::ArgStatus Numeric(const option::Option &option, bool msg)
+	{
+		char *endptr = 0;
+		if (option.arg != 0 && strtol(option.arg, &endptr, 10) >= 0 && endptr != option.arg && *endptr == 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a non-negative number" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+
+	static option::ArgStatus Required(const option::Option &option, bool msg)
+	{
+		if (option.arg != 0 && *option.arg != 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires an argument" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+};
+
+// Seconds since a time point
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Append the items of comma separated lists given to an option
+static void splitLists(option::Option *opt, std::vector<std::string> *items)
+{
+	for (; opt; opt = opt->next())
+	{
+		std::string_view list(opt->arg);
+		while (!list.empty())
+		{
+			size_t comma = std::min(list.find(','), list.size());
+			if (comma > 0)
+			{
+				items->emplace_back(list.substr(0, comma));
+			}
+			list.remove_prefix(std::min(comma + 1, list.size()));
+		}
+	}
+}
+
 const option::Descriptor usage[] =
 	{
 		{UNKNOWN, 0, "", "", option::Arg::None, "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
 												"~~ GenBank to JSON converter\n\n"
 												"USAGE: gb2json [options] in.gb out.json\n"
-												"       gb2json [options] in.gb\n\n"
+												"       gb2json [options] in.gb\n"
+												"       gb2json [options] --outdir=DIR in.gb|dir ...\n"
+												"       gb2json --index in.gb [in.gb.gbi]\n"
+												"       gb2json --verify-roundtrip in.gb\n"
+												"       gb2json --incremental=old.json --previous-index=old.gb.gbi in.gb out.json\n\n"
 												"Options:"},
 		{HELP, 0, "h", "help", option::Arg::None, "  -h  --help      Print help."},
 		{FORCE, 0, "f", "force", option::Arg::None, "  -f  --force     Input and output filenames can be the same."},
+		{COMPACT, 0, "c", "compact", option::Arg::None, "  -c  --compact   Write JSON without indentation."},
+		{STREAM, 0, "s", "stream", option::Arg::None, "  -s  --stream    Convert record by record with bounded memory."},
+		{PIPELINE, 0, "p", "pipeline", option::Arg::None, "  -p  --pipeline  Stream with reading and writing on separate threads."},
+		{THREADS, 0, "t", "threads", Arg::Numeric, "  -t  --threads=N Convert records on N threads. 0 uses all cores."},
+		{STATS, 0, "", "stats", option::Arg::Optional, "      --stats     Print phase times and counts to stderr.\n"
+													   "      --stats=json  Print them as JSON."},
+		{OUTDIR, 0, "o", "outdir", Arg::Required, "  -o  --outdir=DIR Convert all inputs into DIR. Directories are expanded\n"
+												  "                  to their files. Files are converted on --threads threads."},
+		{LIST, 0, "l", "list", Arg::Required, "  -l  --list=FILE  Read more inputs from FILE, one per line. Needs --outdir."},
+		{INDEX, 0, "i", "index", option::Arg::None, "  -i  --index     Write a record index of in.gb to in.gb.gbi, or to the\n"
+													"                  second filename."},
+		{RECORDS, 0, "r", "records", Arg::Required, "  -r  --records=ID,... Convert only these records, named by LOCUS,\n"
+													"                  accession or accession.version. in.gb.gbi is used if present."},
+		{RECORDSFILE, 0, "", "records-file", Arg::Required, "      --records-file=FILE  Read more record names from FILE, one per line.\n"
+															"                  With --stream, records are selected during the scan."},
+		{DIVISIONS, 0, "", "divisions", Arg::Required, "      --divisions=D,...  Convert only records of these divisions, e.g. BCT."},
+		{NODIVISIONS, 0, "", "no-divisions", Arg::Required, "      --no-divisions=D,...  Drop records of these divisions."},
+		{MOLECULES, 0, "", "molecules", Arg::Required, "      --molecules=M,...  Convert only records of these molecule types,\n"
+													   "                  e.g. DNA,mRNA."},
+		{MINLENGTH, 0, "", "min-length", Arg::Numeric, "      --min-length=N  Convert only records of at least N bp or aa."},
+		{MAXLENGTH, 0, "", "max-length", Arg::Numeric, "      --max-length=N  Convert only records of at most N bp or aa."},
+		{NOSEQUENCE, 0, "", "no-sequence", option::Arg::None, "      --no-sequence  Drop ORIGIN and the sequence."},
+		{KEYWORDS, 0, "", "keywords", Arg::Required, "      --keywords=K,...  Convert only these top level keywords.\n"
+													 "                  LOCUS is always kept."},
+		{NOKEYWORDS, 0, "", "no-keywords", Arg::Required, "      --no-keywords=K,...  Drop these top level keywords, e.g. FEATURES."},
+		{FEATURES, 0, "", "features", Arg::Required, "      --features=K,...  Convert only features with these keys, e.g. CDS,rRNA."},
+		{NOFEATURES, 0, "", "no-features", Arg::Required, "      --no-features=K,...  Drop features with these keys."},
+		{QUALIFIERS, 0, "", "qualifiers", Arg::Required, "      --qualifiers=Q,...  Convert only these qualifiers."},
+		{NOQUALIFIERS, 0, "", "no-qualifiers", Arg::Required, "      --no-qualifiers=Q,...  Drop these qualifiers, e.g. translation."},
+		{SEQUENCES, 0, "", "sequences", Arg::Required, "      --sequences=FILE  Write sequences to FILE and refer to them\n"
+													 "                  by offset, length and CRC-32."},
+		{PACK, 0, "", "pack", option::Arg::None, "      --pack      2-bit pack the bases in the --sequences file."},
+		{LOCATIONS, 0, "", "locations", option::Arg::None, "      --locations Add a ParsedLocation with strand, partial markers and\n"
+														   "                  ranges after each feature location."},
+		{NDJSON, 0, "", "ndjson", option::Arg::None, "      --ndjson    Write JSON Lines, one compact record per line."},
+		{SPLIT, 0, "", "split-features", option::Arg::None, "      --split-features  Parse the feature tables of large records on\n"
+															"                  --threads threads, and their sequences alongside."},
+		{VERIFY, 0, "", "verify-roundtrip", option::Arg::None, "      --verify-roundtrip  Convert each record to JSON and back in memory and\n"
+															   "                  report the records that differ from the original."},
+		{INCREMENTAL, 0, "", "incremental", Arg::Required, "      --incremental=FILE  Copy the records unchanged since the release\n"
+														   "                  converted to FILE from it and convert only the others.\n"
+														   "                  in.gb.gbi is used if present."},
+		{PREVINDEX, 0, "", "previous-index", Arg::Required, "      --previous-index=FILE  Record index of the release converted to\n"
+															"                  the --incremental file."},
 		{VERSION, 0, "v", "version", option::Arg::None, "  -v  --version   Print program version.\n"},
 		{0, 0, 0, 0, 0, 0}};
 
@@ -63,6 +203,120 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	gberror err;
+	gbstats phaseStats;
+	bool statsJson = options[STATS] && options[STATS].arg && strcmp(options[STATS].arg, "json") == 0;
+
+	// Set conversion options
+	gboptions opts;
+	opts.compact = options[COMPACT];
+	opts.parseLocations = options[LOCATIONS];
+	opts.ndjson = options[NDJSON];
+	opts.splitFeatures = options[SPLIT];
+	if (options[THREADS])
+	{
+		opts.threads = atoi(options[THREADS].arg);
+	}
+	if (options[STATS])
+	{
+		opts.stats = &phaseStats;
+	}
+
+	// Select the sections to convert
+	gbprojection projection;
+	splitLists(options[KEYWORDS], &projection.keywords.include);
+	splitLists(options[NOKEYWORDS], &projection.keywords.exclude);
+	splitLists(options[FEATURES], &projection.features.include);
+	splitLists(options[NOFEATURES], &projection.features.exclude);
+	splitLists(options[QUALIFIERS], &projection.qualifiers.include);
+	splitLists(options[NOQUALIFIERS], &projection.qualifiers.exclude);
+	if (options[NOSEQUENCE])
+	{
+		projection.keywords.exclude.push_back("ORIGIN");
+	}
+	if (options[KEYWORDS] || options[NOKEYWORDS] || options[FEATURES] || options[NOFEATURES] ||
+		options[QUALIFIERS] || options[NOQUALIFIERS] || options[NOSEQUENCE])
+	{
+		opts.projection = &projection;
+	}
+
+	// Select the records to convert by their LOCUS lines
+	gbselection selection;
+	splitLists(options[DIVISIONS], &selection.divisions.include);
+	splitLists(options[NODIVISIONS], &selection.divisions.exclude);
+	splitLists(options[MOLECULES], &selection.molecules.include);
+	if (options[MINLENGTH])
+	{
+		selection.minLength = strtoull(options[MINLENGTH].arg, nullptr, 10);
+	}
+	if (options[MAXLENGTH])
+	{
+		selection.maxLength = strtoull(options[MAXLENGTH].arg, nullptr, 10);
+	}
+	bool filter = options[DIVISIONS] || options[NODIVISIONS] || options[MOLECULES] || options[MINLENGTH] || options[MAXLENGTH];
+	if (filter)
+	{
+		opts.selection = &selection;
+	}
+
+	// Convert a batch of files into an output directory
+	if (options[OUTDIR])
+	{
+		if (options[SEQUENCES])
+		{
+			std::cout << "--sequences cannot be used with --outdir." << std::endl;
+			return 1;
+		}
+
+		std::vector<std::string> inputs(parse.nonOptions(), parse.nonOptions() + parse.nonOptionsCount());
+		if (options[LIST])
+		{
+			std::string list(options[LIST].arg);
+			fileList(&list, &inputs, &err);
+		}
+
+		std::vector<gbjob> jobs;
+		std::string outdir(options[OUTDIR].arg);
+		if (!err.flag)
+		{
+			batchJobs(&inputs, &outdir, ".json", &jobs, &err);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		// Convert on all cores unless told otherwise
+		if (!options[THREADS])
+		{
+			opts.threads = 0;
+		}
+
+		gb2jsonBatch(&jobs, &opts);
+
+		int failed = 0;
+		for (auto &job : jobs)
+		{
+			if (job.err.flag)
+			{
+				std::cout << job.input << ": " << job.err.msg << std::endl;
+				failed++;
+			}
+			else
+			{
+				std::cout << job.output << std::endl;
+			}
+		}
+
+		if (options[STATS])
+		{
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return failed ? 1 : 0;
+	}
+
 	// Check number of file arguments
 	int nFiles = parse.nonOptionsCount();
 	if (nFiles == 0 || nFiles > 2)
@@ -80,25 +334,319 @@ int main(int argc, char *argv[])
 		outfile = parse.nonOptions()[1];
 	}
 
-	if (infile == outfile && !options[FORCE])
+	if (options[VERIFY] && (nFiles == 2 || options[RECORDS] || options[RECORDSFILE] || options[SEQUENCES] || options[INDEX] || filter))
+	{
+		std::cout << "--verify-roundtrip takes one input and no --records, --sequences, --index or record filters." << std::endl;
+		return 1;
+	}
+
+	if (options[INCREMENTAL] && (!options[PREVINDEX] || options[RECORDS] || options[RECORDSFILE] || options[SEQUENCES] || options[INDEX] || options[VERIFY] || filter))
+	{
+		std::cout << "--incremental needs --previous-index and no --records, --sequences, --index, --verify-roundtrip or record filters." << std::endl;
+		return 1;
+	}
+
+	if (nFiles == 2 && sameFile(&infile, &outfile) && !options[FORCE])
 	{
 		std::cout << "Input and output filenames must be different." << std::endl;
 		return 1;
 	}
 
+	// Open the sequence sidecar
+	std::unique_ptr<FILE, int (*)(FILE *)> sequences(nullptr, &fclose);
+	if (options[SEQUENCES])
+	{
+		sequences.reset(fopen(options[SEQUENCES].arg, "wb"));
+		if (!sequences)
+		{
+			std::cout << "Failed writing to " << options[SEQUENCES].arg << std::endl;
+			return 1;
+		}
+		opts.sequences = sequences.get();
+		opts.packSequences = options[PACK];
+	}
+	else if (options[PACK])
+	{
+		std::cout << "--pack needs --sequences." << std::endl;
+		return 1;
+	}
+
+	// Index the records by a line scan
+	if (options[INDEX])
+	{
+		std::string indexfile = nFiles == 2 ? outfile : infile + ".gbi";
+		gbindex index;
+
+		auto start = std::chrono::steady_clock::now();
+		indexFile(&infile, &index, &err);
+		phaseStats.scanTime += secondsSince(start);
+
+		if (!err.flag)
+		{
+			start = std::chrono::steady_clock::now();
+			writeIndex(&indexfile, &index, &err);
+			phaseStats.writeTime += secondsSince(start);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		std::cout << indexfile << std::endl;
+		if (options[STATS])
+		{
+			phaseStats.records = index.entries.size();
+			phaseStats.bytesIn = index.size;
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return 0;
+	}
+
+	// Record names to convert
+	std::vector<std::string> keys;
+	splitLists(options[RECORDS], &keys);
+	if (options[RECORDSFILE])
+	{
+		std::string list(options[RECORDSFILE].arg);
+		fileList(&list, &keys, &err);
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+	}
+	bool select = options[RECORDS] || options[RECORDSFILE];
+
+	// Stream the conversion
+	if ((options[STREAM] || options[PIPELINE]) && !options[VERIFY] && !options[INCREMENTAL])
+	{
+		opts.pipeline = options[PIPELINE];
+
+		// Named records are selected during the scan instead of by seeking
+		if (select)
+		{
+			selection.names.insert(keys.begin(), keys.end());
+			opts.selection = &selection;
+		}
+
+		FILE *input = fopen(infile.c_str(), "rb");
+		if (!input)
+		{
+			std::cout << "Failed to open " << infile << std::endl;
+			return 1;
+		}
+
+		// Compress the output as named. A file replaces the target only
+		// when done, as it may be the input.
+		opts.compression = compressionFromName(&outfile);
+		OutputFile file;
+		if (nFiles == 2 && !file.open(&outfile, opts.compression != GB_PLAIN, &err))
+		{
+			std::cout << err.msg << std::endl;
+			fclose(input);
+			return 1;
+		}
+
+		gb2jsonStream(input, nFiles == 2 ? file.file : stdout, &err, &opts);
+		fclose(input);
+
+		if (nFiles == 2 && !err.flag)
+		{
+			file.commit(&err);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		if (nFiles == 2)
+		{
+			std::cout << outfile << std::endl;
+		}
+		if (options[STATS])
+		{
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return 0;
+	}
+
 	std::string gb, json;
-	gberror err;
+	auto start = std::chrono::steady_clock::now();
 
-	// Read the input file
-	fileToString(&infile, &gb, &err);
-	if (err.flag)
+	if (select)
 	{
-		std::cout << err.msg << std::endl;
-		return 1;
+		// Use the index file if there is one. Otherwise scan the input.
+		std::string indexfile = infile + ".gbi";
+		std::error_code ec;
+		gbindex index;
+
+		if (std::filesystem::exists(indexfile, ec))
+		{
+			readIndex(&indexfile, &index, &err);
+		}
+		else
+		{
+			indexFile(&infile, &index, &err);
+		}
+		phaseStats.scanTime += secondsSince(start);
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		// Convert the selected records
+		gb2jsonSelect(&infile, &index, &keys, &json, &err, &opts);
+	}
+	else if (options[INCREMENTAL])
+	{
+		// Index the new release, unless it has an index file
+		std::string indexfile = infile + ".gbi";
+		std::string previousfile(options[INCREMENTAL].arg);
+		std::string previousIndexfile(options[PREVINDEX].arg);
+		std::error_code ec;
+		gbindex index, previousIndex;
+		MappedFile map, previousMap;
+
+		if (std::filesystem::exists(indexfile, ec))
+		{
+			readIndex(&indexfile, &index, &err);
+		}
+		else
+		{
+			indexFile(&infile, &index, &err);
+		}
+		if (!err.flag)
+		{
+			readIndex(&previousIndexfile, &previousIndex, &err);
+		}
+		phaseStats.scanTime += secondsSince(start);
+
+		// Compressed previous JSON is decompressed while reading
+		std::string previousString;
+		start = std::chrono::steady_clock::now();
+		if (!err.flag)
+		{
+			fileToMap(&infile, &map, &err);
+		}
+		if (!err.flag)
+		{
+			fileToMap(&previousfile, &previousMap, &err);
+			if (err.flag || detectCompression(previousMap.data, previousMap.size) != GB_PLAIN)
+			{
+				err = gberror();
+				previousMap.unmap();
+				fileToString(&previousfile, &previousString, &err);
+			}
+		}
+		const char *previous = previousMap.data ? previousMap.data : previousString.data();
+		size_t previousLen = previousMap.data ? previousMap.size : previousString.size();
+		phaseStats.readTime += secondsSince(start);
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		size_t converted = gb2jsonIncremental(map.data, map.size, &index, previous, previousLen, &previousIndex, &json, &err, &opts);
+		if (!err.flag && nFiles == 2)
+		{
+			std::cout << "Converted " << converted << " of " << index.entries.size() << " records" << std::endl;
+		}
 	}
+	else
+	{
+		// Map the input file. Fall back to reading it if it cannot be mapped.
+		MappedFile map;
+		fileToMap(&infile, &map, &err);
 
-	// Convert the GenBank string to JSON
-	gb2json(&gb, &json, &err);
+		const char *input = map.data;
+		size_t inputLen = map.size;
+
+		// Compressed files are decompressed while reading
+		if (err.flag || detectCompression(map.data, map.size) != GB_PLAIN)
+		{
+			err = gberror();
+			map.unmap();
+			fileToString(&infile, &gb, &err);
+			if (err.flag)
+			{
+				std::cout << err.msg << std::endl;
+				return 1;
+			}
+			input = gb.data();
+			inputLen = gb.size();
+		}
+		phaseStats.readTime += secondsSince(start);
+
+		// Convert every record to JSON and back, and report those that differ
+		if (options[VERIFY])
+		{
+			std::vector<gbmismatch> mismatches;
+			size_t records = verifyRoundtrip(input, inputLen, &mismatches, &opts);
+
+			for (auto &mismatch : mismatches)
+			{
+				std::cout << mismatch.name << " at offset " << mismatch.offset;
+				if (mismatch.line == 0)
+				{
+					std::cout << ": " << mismatch.actual << "\n";
+					continue;
+				}
+				std::cout << ", line " << mismatch.line << "\n"
+						  << "  expected: \"" << mismatch.expected << "\"\n"
+						  << "  actual:   \"" << mismatch.actual << "\"\n";
+			}
+			std::cout << mismatches.size() << " of " << records << " records differ" << std::endl;
+
+			if (options[STATS])
+			{
+				printStats(&phaseStats, stderr, statsJson);
+			}
+			return mismatches.empty() ? 0 : 1;
+		}
+
+		// Convert the GenBank string to JSON written straight to the output.
+		// A file is written under a temporary name and replaces the target
+		// when done, so a failed conversion leaves no output and the input
+		// stays intact if it is the output as well.
+		opts.compression = compressionFromName(&outfile);
+		OutputFile file;
+		if (nFiles == 2 && !file.open(&outfile, opts.compression != GB_PLAIN, &err))
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		gb2json(input, inputLen, nFiles == 2 ? file.file : stdout, &err, &opts);
+
+		if (nFiles == 2 && !err.flag)
+		{
+			file.commit(&err);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		if (nFiles == 2)
+		{
+			std::cout << outfile << std::endl;
+		}
+		if (options[STATS])
+		{
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return 0;
+	}
 
 	// Write ouput
 	if (err.flag)
@@ -108,22 +656,27 @@ int main(int argc, char *argv[])
 	}
 	else
 	{
+		start = std::chrono::steady_clock::now();
 		if (nFiles == 1)
 		{
-			std::cout << json;
+			fwrite(json.data(), 1, json.size(), stdout);
+			fflush(stdout);
 		}
 		else
 		{
-			std::ofstream output(outfile);
-			output << json;
-			if (output.fail())
+			stringToFile(&outfile, &json, &err, compressionFromName(&outfile));
+			if (err.flag)
 			{
-				std::cout << "Failed writing to " << outfile << std::endl;
-				output.close();
+				std::cout << err.msg << std::endl;
 				return 1;
 			}
-			output.close();
 			std::cout << outfile << std::endl;
 		}
+		phaseStats.writeTime += secondsSince(start);
+	}
+
+	if (options[STATS])
+	{
+		printStats(&phaseStats, stderr, statsJson);
 	}
 }
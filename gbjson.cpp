@@ -27,6 +27,99 @@
    *
    * $ json2gb <i>in.json</i>
    *
+   * @subsection Stream Convert record by record
+   * $ gb2json --stream <i>in.gb</i> <i>out.json</i>
+   *
+   * $ json2gb --stream <i>in.json</i> <i>out.gb</i>
+   *
+   * $ gb2json --pipeline <i>in.gb</i> <i>out.json</i>
+   *
+   * @subsection Compressed Compressed files
+   * $ gb2json --stream <i>in.seq.gz</i> <i>out.json.zst</i>
+   *
+   * gzip and zstd input is detected and decompressed. Outputs named .gz or .zst are compressed.
+   *
+   * @subsection Threads Convert on several threads
+   * $ gb2json --threads=8 <i>in.gb</i> <i>out.json</i>
+   *
+   * $ json2gb --threads=8 <i>in.json</i> <i>out.gb</i>
+   *
+   * $ gb2json --threads=8 --split-features <i>chromosome.gb</i> <i>out.json</i>
+   *
+   * With --split-features, the feature tables of large records are parsed on the threads too.
+   *
+   * @subsection Batch Convert many files
+   * $ gb2json --outdir=<i>json/</i> <i>a.gb</i> <i>b.gb</i> <i>dir/</i>
+   *
+   * $ json2gb --list=<i>files.txt</i> --outdir=<i>gb/</i>
+   *
+   * @subsection Select Convert selected records
+   * $ gb2json --index <i>in.gb</i>
+   *
+   * $ gb2json --records=<i>NC_000913.3,U00096</i> <i>in.gb</i> <i>out.json</i>
+   *
+   * The index in.gb.gbi maps record names to byte ranges, so only the selected records are read.
+   *
+   * @subsection Filter Filter records
+   * $ gb2json --divisions=<i>BCT,PLN</i> --molecules=<i>DNA</i> --min-length=<i>1000</i> <i>in.gb</i> <i>out.json</i>
+   *
+   * Records are selected on their LOCUS lines. The others are skipped up to their // lines without parsing.
+   *
+   * @subsection Incremental Convert a new release incrementally
+   * $ gb2json --incremental=<i>old.json</i> --previous-index=<i>old.gb.gbi</i> <i>new.gb</i> <i>new.json</i>
+   *
+   * Records unchanged by accession.version, length and CRC-32 are copied from old.json, and only the others are converted.
+   *
+   * @subsection Project Convert selected sections
+   * $ gb2json --no-sequence <i>in.gb</i> <i>out.json</i>
+   *
+   * $ gb2json --features=<i>CDS,rRNA</i> --no-qualifiers=<i>translation</i> <i>in.gb</i> <i>out.json</i>
+   *
+   * @subsection Sidecar Sequences in a separate file
+   * $ gb2json --sequences=<i>bases.seq</i> <i>in.gb</i> <i>meta.json</i>
+   *
+   * $ json2gb --sequences=<i>bases.seq</i> <i>meta.json</i> <i>out.gb</i>
+   *
+   * SEQUENCE entries then hold the offset, length and CRC-32 of the bases in the sequence file.
+   *
+   * $ gb2json --pack --sequences=<i>bases.2bit</i> <i>in.gb</i> <i>meta.json</i>
+   *
+   * --pack stores 2 bits per base, with other characters listed as runs.
+   *
+   * @subsection Locations Parsed locations
+   * $ gb2json --locations <i>in.gb</i> <i>out.json</i>
+   *
+   * Each feature location is followed by a ParsedLocation with its strand, partial markers and ranges.
+   *
+   * @subsection Compact Compact output
+   * $ gb2json --compact <i>in.gb</i> <i>out.json</i>
+   *
+   * @subsection Lines JSON Lines
+   * $ gb2json --ndjson <i>in.gb</i> <i>out.ndjson</i>
+   *
+   * Each record is written compact on a line of its own. json2gb reads such files as well.
+   *
+   * @subsection Validate Validate JSON
+   * $ json2gb --validate <i>in.json</i> <i>out.gb</i>
+   *
+   * The JSON is checked against the schema of the gbjson layout while it is converted. --schema prints the schema.
+   *
+   * @subsection Verify Verify a round trip
+   * $ gb2json --verify-roundtrip <i>in.gb</i>
+   *
+   * Each record is converted to JSON and back in memory, and the records that differ from the original are reported.
+   *
+   * @subsection Server Conversion server
+   * $ gbjson_server --socket=<i>/run/gbjson.sock</i>
+   *
+   * Framed requests "gb2json LENGTH" or "json2gb LENGTH" with their input are answered with "ok LENGTH" and the result,
+   * or "error LENGTH CODE" and the message. A malformed header is skipped with its payload. Without --socket, requests are read from stdin.
+   *
+   * @subsection Stats Phase times and counts
+   * $ gb2json --stats <i>in.gb</i> <i>out.json</i>
+   *
+   * $ json2gb --stats=json <i>in.json</i> <i>out.gb</i>
+   *
    * @section Building Building from source
    * Use <a href="https://cmake.org/">CMake</a> to build from source.
    *
@@ -44,648 +137,3375 @@
    * @subsection Library Use as a library
    * Using <b>gbjson</b> as a C++ library is straight forward.
    * Include gbjson.h in your source code. The functions <i>gb2json</i> and <i>json2gb</i> are the API.
+   * Both accept a std::string or a character buffer with its length, so input mapped
+   * with <i>fileToMap</i> can be converted without copying it into memory first.
+   *
+   * Both also have overloads returning the converted string. To convert many small records,
+   * keep a Converter, which holds its buffers, writers and JSON handler between calls.
+   *
+   * <i>gb2json</i> can also send its output as events to a handler instead of writing JSON text.
+   * Wrap any RapidJSON SAX handler in a HandlerAdapter, e.g. to build a Document with
+   * Document::Populate.
+   *
+   * For structured access without JSON, <i>gb2record</i> parses one record into a GenBankRecord
+   * with its LOCUS line, keyword tree, features, qualifiers and sequence, held as string views
+   * into the input or into the record's arena.
+   *
+   * For bindings from other languages, gbjson_c.h is a C interface on a reusable opaque
+   * gbjson_context. Output goes into a caller-supplied buffer, with a size query and the
+   * output kept in the context if it does not fit, or through a write callback in blocks.
    */
 
 #include <iostream>
 #include <stdio.h> // fopen, fread
+#include <cstring>  // strlen, memcpy
+#include <cstdint>  // uint64_t
 #include <string>
-#include <sstream>   // stringstream
+#include <string_view>
 #include <algorithm> // find_if, remove
 #include <cctype>	// isspace
 #include <cmath>	 // ceil
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <set>
+#include <unordered_map>
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/reader.h"
+#include "rapidjson/memorystream.h"
+#include "rapidjson/schema.h"
 #include "gbjson.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GBJSON_SIMD
+#define GBJSON_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GBJSON_SIMD
+#define GBJSON_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GBJSON_SIMD
+#define GBJSON_SIMD_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward64
+#endif
+
+#ifdef GBJSON_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef GBJSON_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h> // CreateFileMapping, MapViewOfFile
+#include <io.h>		 // _write
+#include <process.h>	 // _getpid
+#else
+#include <fcntl.h>	// open
+#include <unistd.h>   // close, write, getpid
+#include <sys/mman.h> // mmap, posix_madvise
+#include <sys/stat.h> // fstat
+#endif
+
 #define _CRT_SECURE_NO_WARNINGS // Bypass I/O *_s functions in MSVC
 
 gberror::gberror() : flag(false) {}
 
+gboptions::gboptions() : threads(1), compact(false), stats(nullptr), compression(GB_PLAIN), pipeline(false), projection(nullptr), selection(nullptr), sequences(nullptr), packSequences(false), parseLocations(false), ndjson(false), splitFeatures(false), validate(false) {}
+
+gbselection::gbselection() : minLength(0), maxLength(0) {}
+
 /***************************************************************
- * File handling
+ * Statistics
  ***************************************************************/
 
-static inline void fileSize(FILE *fp, size_t *len)
-{
-	size_t pos = ftell(fp);
+gbstats::gbstats()
+	: readTime(0), scanTime(0), parseTime(0), writeTime(0),
+	  records(0), features(0), qualifiers(0), bases(0), bytesIn(0), bytesOut(0) {}
 
-	fseek(fp, 0, SEEK_END);
-	*len = ftell(fp);
+/**
+ * Add the times and counts of another statistics object.
+ * @param[in] other The other statistics.
+ */
+void gbstats::add(const gbstats *other)
+{
+	readTime += other->readTime;
+	scanTime += other->scanTime;
+	parseTime += other->parseTime;
+	writeTime += other->writeTime;
+	records += other->records;
+	features += other->features;
+	qualifiers += other->qualifiers;
+	bases += other->bases;
+	bytesIn += other->bytesIn;
+	bytesOut += other->bytesOut;
+}
 
-	fseek(fp, pos, SEEK_SET);
+/**
+ * Print statistics as a table or as a JSON object.
+ * @param[in] stats The statistics.
+ * @param[in] out The output file, e.g. stderr.
+ * @param[in] json Print JSON?
+ */
+void printStats(const gbstats *stats, FILE *out, bool json)
+{
+	if (json)
+	{
+		fprintf(out,
+				"{\"readTime\":%.6f,\"scanTime\":%.6f,\"parseTime\":%.6f,\"writeTime\":%.6f,"
+				"\"records\":%zu,\"features\":%zu,\"qualifiers\":%zu,\"bases\":%zu,"
+				"\"bytesIn\":%zu,\"bytesOut\":%zu}\n",
+				stats->readTime, stats->scanTime, stats->parseTime, stats->writeTime,
+				stats->records, stats->features, stats->qualifiers, stats->bases,
+				stats->bytesIn, stats->bytesOut);
+	}
+	else
+	{
+		fprintf(out,
+				"read        %10.3f s\n"
+				"scan        %10.3f s\n"
+				"parse/emit  %10.3f s\n"
+				"write       %10.3f s\n"
+				"records     %10zu\n"
+				"features    %10zu\n"
+				"qualifiers  %10zu\n"
+				"bases       %10zu\n"
+				"bytes in    %10zu\n"
+				"bytes out   %10zu\n",
+				stats->readTime, stats->scanTime, stats->parseTime, stats->writeTime,
+				stats->records, stats->features, stats->qualifiers, stats->bases,
+				stats->bytesIn, stats->bytesOut);
+	}
 }
 
-void fileToString(const std::string *filename, std::string *output, gberror *err)
+/**
+ * Scoped timer adding its lifetime in seconds to a phase time.
+ * Nothing is timed if the phase time is null.
+ */
+class PhaseTimer
 {
-	FILE *input = fopen(filename->c_str(), "r");
+public:
+	PhaseTimer(double *total) : total(total)
+	{
+		if (total)
+		{
+			start = std::chrono::steady_clock::now();
+		}
+	}
 
-	if (!input)
+	~PhaseTimer()
 	{
-		err->flag = true;
-		err->msg = "Failed to open ";
-		err->msg.append(filename->c_str());
-		err->source = "fileToString";
-		return;
+		if (total)
+		{
+			*total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
 	}
 
-	size_t len; // File size
-	fileSize(input, &len);
-	output->resize(len);
+private:
+	double *total;
+	std::chrono::steady_clock::time_point start;
+};
 
-	len = fread(&(*output)[0], 1, len, input);
-	output->resize(len); // Actual number of chars read
+// Phase time of optional statistics
+#define PHASE(stats, phase) ((stats) ? &(stats)->phase : nullptr)
 
-	fclose(input);
-}
 /***************************************************************
- * String handling
+ * Compression
+ * gzip and zstd streams are recognized by their magic numbers.
+ * Compressed input is decoded on a thread of its own, which
+ * hands chunks to the parser through a bounded queue.
  ***************************************************************/
 
-static std::string makeSpaces(int n)
+/**
+ * Detect the compression of a buffer from its magic number.
+ * @param[in] data The start of the buffer.
+ * @param[in] len The buffer length.
+ * @return The compression format.
+ */
+gbcompression detectCompression(const char *data, size_t len)
 {
-	std::string spaces(n, ' ');
-	return spaces;
+	if (len >= 2 && memcmp(data, "\x1f\x8b", 2) == 0)
+	{
+		return GB_GZIP;
+	}
+	else if (len >= 4 && memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0)
+	{
+		return GB_ZSTD;
+	}
+	return GB_PLAIN;
 }
 
-static inline void stringTrimLeft(std::string *str)
+/**
+ * Compression implied by a filename extension, .gz or .zst.
+ * @param[in] filename The filename.
+ * @return The compression format.
+ */
+gbcompression compressionFromName(const std::string *filename)
 {
-	str->erase(str->begin(), std::find_if(str->begin(), str->end(), [](int c) { return !std::isspace(c); }));
+	auto endsWith = [&](const char *ext) {
+		size_t n = strlen(ext);
+		return filename->size() >= n && filename->compare(filename->size() - n, n, ext) == 0;
+	};
+
+	if (endsWith(".gz"))
+	{
+		return GB_GZIP;
+	}
+	else if (endsWith(".zst"))
+	{
+		return GB_ZSTD;
+	}
+	return GB_PLAIN;
 }
 
-static inline void stringTrimRight(std::string *str)
+// Name of a compression format for error messages
+static const char *compressionName(gbcompression format)
 {
-	str->erase(std::find_if(str->rbegin(), str->rend(), [](int c) { return !std::isspace(c); }).base(), str->end());
+	return format == GB_GZIP ? "gzip" : format == GB_ZSTD ? "zstd" : "plain";
 }
 
-static inline void stringTrim(std::string *str)
+/**
+ * Streaming compressor for sink output.
+ */
+class Compressor
 {
-	stringTrimLeft(str);
-	stringTrimRight(str);
+public:
+	Compressor(gbcompression format);
+	~Compressor();
+	Compressor(const Compressor &) = delete;
+	Compressor &operator=(const Compressor &) = delete;
+	bool write(const char *data, size_t len, bool finish, OutputSink *sink);
+	bool good() const { return ok; }
+
+private:
+	gbcompression format;
+	bool ok; ///< Stream initialized and no error?
+	std::string out;
+#ifdef GBJSON_ZLIB
+	z_stream z;
+#endif
+#ifdef GBJSON_ZSTD
+	ZSTD_CStream *zs;
+#endif
+};
+
+Compressor::Compressor(gbcompression format) : format(format), ok(false), out(1 << 17, '\0')
+{
+#ifdef GBJSON_ZLIB
+	if (format == GB_GZIP)
+	{
+		memset(&z, 0, sizeof(z));
+		ok = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK; // 16: gzip header
+	}
+#endif
+#ifdef GBJSON_ZSTD
+	zs = nullptr;
+	if (format == GB_ZSTD)
+	{
+		zs = ZSTD_createCStream();
+		ok = zs && !ZSTD_isError(ZSTD_initCStream(zs, 3));
+	}
+#endif
 }
 
-static inline void removeSpaces(std::string *str)
+Compressor::~Compressor()
 {
-	str->erase(std::remove(str->begin(), str->end(), ' '), str->end());
+#ifdef GBJSON_ZLIB
+	if (format == GB_GZIP && ok)
+	{
+		deflateEnd(&z);
+	}
+#endif
+#ifdef GBJSON_ZSTD
+	ZSTD_freeCStream(zs);
+#endif
 }
 
-/*
- * getline that handles \r, \r\n, and \n line endings for files moved
- * between platforms.
- * @param[in] is Input stream.
- * @param[out] line The line.
+/**
+ * Compress data and write the compressed bytes to a sink.
+ * @param[in] data The data.
+ * @param[in] len The data length.
+ * @param[in] finish End the compressed stream after the data?
+ * @param[in] sink The sink written to.
+ * @return False if compression failed or is not available.
  */
-
-static std::istream &safeGetline(std::istream &is, std::string &line)
+bool Compressor::write(const char *data, size_t len, bool finish, OutputSink *sink)
 {
-	// This was snatched from
-	// https://stackoverflow.com/questions/6089231/getting-std-ifstream-to-handle-lf-cr-and-crlf
+	if (!ok)
+	{
+		return false;
+	}
 
-	// The characters in the stream are read one-by-one using a std::streambuf.
-	// That is faster than reading them one-by-one using the std::istream.
-	// Code that uses streambuf this way must be guarded by a sentry object.
-	// The sentry object performs various tasks,
-	// such as thread synchronization and updating the stream state.
+#ifdef GBJSON_ZLIB
+	if (format == GB_GZIP)
+	{
+		z.next_in = (Bytef *)data;
+		int ret;
 
-	line.clear();
+		do
+		{
+			// zlib counts in 32 bits
+			uInt n = (uInt)std::min(len, (size_t)1 << 30);
+			z.avail_in = n;
 
-	std::istream::sentry se(is, true);
-	std::streambuf *sb = is.rdbuf();
+			do
+			{
+				z.next_out = (Bytef *)&out[0];
+				z.avail_out = (uInt)out.size();
+				ret = deflate(&z, finish && n == len ? Z_FINISH : Z_NO_FLUSH);
+				if (ret == Z_STREAM_ERROR)
+				{
+					ok = false;
+					return false;
+				}
+				sink->writeRaw(out.data(), out.size() - z.avail_out);
+			} while (z.avail_out == 0);
+
+			len -= n;
+		} while (len > 0);
 
-	for (;;)
+		return true;
+	}
+#endif
+#ifdef GBJSON_ZSTD
+	if (format == GB_ZSTD)
 	{
-		int c = sb->sbumpc();
-		switch (c)
+		ZSTD_inBuffer in = {data, len, 0};
+
+		while (in.pos < in.size)
+		{
+			ZSTD_outBuffer o = {&out[0], out.size(), 0};
+			if (ZSTD_isError(ZSTD_compressStream(zs, &o, &in)))
+			{
+				ok = false;
+				return false;
+			}
+			sink->writeRaw(out.data(), o.pos);
+		}
+
+		// Write the end of the frame
+		size_t left = finish;
+		while (left > 0)
 		{
-		case '\n':
-			return is;
-		case '\r':
-			if (sb->sgetc() == '\n')
-				sb->sbumpc();
-			return is;
-		case std::streambuf::traits_type::eof():
-			// Also handle the case when the last line has no line ending
-			if (line.empty())
-				is.setstate(std::ios::eofbit);
-			return is;
-		default:
-			line += (char)c;
+			ZSTD_outBuffer o = {&out[0], out.size(), 0};
+			left = ZSTD_endStream(zs, &o);
+			if (ZSTD_isError(left))
+			{
+				ok = false;
+				return false;
+			}
+			sink->writeRaw(out.data(), o.pos);
 		}
+
+		return true;
 	}
+#endif
+
+	return false;
 }
 
+/***************************************************************
+ * Pipelining
+ * Chunks of input or output pass between threads through
+ * lock-free single-producer single-consumer rings. A fixed set
+ * of chunks circulates, so memory use is bounded.
+ ***************************************************************/
+
 /**
- * Split a string into lines and left pad with whitespace
- * @param[in] input The string.
- * @param[out] block The padded block.
- * @param[in] leader Number of leading whitespaces.
- * @param[in] len Line length.
- * @param[in] offset Offset for the first line.
+ * Lock-free single-producer single-consumer ring of chunk indices.
  */
-static void blockPad(
-	const std::string *input,
-	std::string *block,
-	int leader,
-	int len,
-	int offset)
+class ChunkRing
 {
-	// Sanity check
-	if (len < leader || len <= 0 || offset >= len - leader)
-	{
-		*block = "";
-		return;
-	}
-
-	// Make the streams
-	std::stringstream in(*input);
-	std::stringstream out;
-	std::string line;
-
-	// Consume first input line. This does not get leading whitespace.
-	safeGetline(in, line);
-
-	int writeLen = len - leader;										// Length that contains parts of the string
-	int nfrag = std::ceil(((double)line.length() + offset) / writeLen); // Number of fragments
+public:
+	static const size_t capacity = 8; ///< Number of slots.
 
-	// First part that does not have leading whitespace.
-	out << line.substr(0, writeLen - offset);
-	out << "\n";
+	ChunkRing() : head(0), tail(0) {}
 
-	// Remaining parts
-	for (int i = 0; i < nfrag - 1; i++)
+	/**
+	 * Push an index. Only the producer may call this.
+	 * @param[in] chunk The index.
+	 * @return False if the ring is full.
+	 */
+	bool push(size_t chunk)
 	{
-		out << makeSpaces(leader);
-		out << line.substr(writeLen - offset + i * writeLen, writeLen) << "\n";
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == capacity)
+		{
+			return false;
+		}
+
+		slots[t % capacity] = chunk;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
 	}
 
-	// Consume remaining input lines
-	while (!in.eof())
+	/**
+	 * Pop an index. Only the consumer may call this.
+	 * @param[out] chunk The index.
+	 * @return False if the ring is empty.
+	 */
+	bool pop(size_t *chunk)
 	{
-		safeGetline(in, line);
-		nfrag = std::ceil(((double)line.length()) / writeLen);
-
-		for (int i = 0; i < nfrag; i++)
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
 		{
-			out << makeSpaces(leader);
-			out << line.substr(i * writeLen, writeLen) << "\n";
+			return false;
 		}
-	}
 
-	// Write result
-	*block = out.str();
-}
+		*chunk = slots[h % capacity];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
 
-/***************************************************************
- * GenBank line processing
- ***************************************************************/
+private:
+	size_t slots[capacity];
+	alignas(64) std::atomic<size_t> head; ///< Next slot to pop.
+	alignas(64) std::atomic<size_t> tail; ///< Next slot to push.
+};
 
-static void splitLine(const std::string *line, std::string *front, std::string *back)
+// Wait for another thread, yielding first and sleeping later
+static inline void backoff(int *spins)
 {
-	*front = line->substr(0, 10);
-	*back = line->substr(12, line->size());
+	if (++*spins < 64)
+	{
+		std::this_thread::yield();
+	}
+	else
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
 }
 
-static void splitFeatureLine(const std::string *line, std::string *front, std::string *back)
+/**
+ * Fixed set of chunks passed from a producer thread to a consumer
+ * thread. Filled chunks go through one ring and return empty through
+ * another.
+ */
+class ChunkPipe
 {
-	*front = line->substr(0, 21);
-	*back = line->substr(21, line->size());
-}
-
-static void splitSequenceLine(const std::string *line, std::string *front, std::string *back)
+public:
+	static const size_t npos = (size_t)-1;
+
+	ChunkPipe(size_t chunkSize);
+	size_t acquire();
+	void publish(size_t chunk);
+	void close(const char *error = nullptr);
+	bool next(const char **data, size_t *len);
+	void cancel();
+	const std::string *error() const;
+
+	std::string chunks[ChunkRing::capacity]; ///< The chunks.
+	double producerWait;					 ///< Time the producer waited for empty chunks.
+
+private:
+	ChunkRing empty;			 ///< Consumer to producer
+	ChunkRing full;				 ///< Producer to consumer
+	std::atomic<bool> closed;	///< No more chunks will be published.
+	std::atomic<bool> cancelled; ///< The consumer is gone.
+	size_t current;				 ///< Chunk held by the consumer, or npos.
+	std::string msg;			 ///< Error set by the producer.
+};
+
+ChunkPipe::ChunkPipe(size_t chunkSize) : producerWait(0), closed(false), cancelled(false), current(npos)
 {
-	*front = line->substr(0, 10);
-	*back = line->substr(10, line->size());
-	removeSpaces(back);
+	for (size_t i = 0; i < ChunkRing::capacity; i++)
+	{
+		chunks[i].reserve(chunkSize);
+		empty.push(i);
+	}
 }
 
-static inline bool isInteger(const std::string *n)
+/**
+ * Take an empty chunk, waiting while there is none. Producer only.
+ * @return The chunk index, or npos if the consumer cancelled.
+ */
+size_t ChunkPipe::acquire()
 {
-	return !n->empty() && n->end() == std::find_if(n->begin(), n->end(), [](char c) { return !std::isdigit(c); });
-}
+	size_t chunk;
+	if (empty.pop(&chunk))
+	{
+		return chunk;
+	}
 
-static inline bool isLocus(const std::string *line)
-{
-	return line->length() >= 13 && line->substr(0, 5) == "LOCUS" && !isspace((*line)[12]);
+	PhaseTimer timer(&producerWait);
+	for (int spins = 0; !cancelled.load(std::memory_order_acquire); backoff(&spins))
+	{
+		if (empty.pop(&chunk))
+		{
+			return chunk;
+		}
+	}
+	return npos;
 }
 
-static inline bool isKeyword(const std::string *line)
+/**
+ * Hand a filled chunk to the consumer. Producer only.
+ * @param[in] chunk The chunk index.
+ */
+void ChunkPipe::publish(size_t chunk)
 {
-	return line->length() >= 13 && !isspace((*line)[0]) && isalpha((*line)[0]);
+	full.push(chunk); // Cannot be full, as there are no more chunks than slots
 }
 
-static inline bool isSubkeyword(const std::string *line)
+/**
+ * End the chunks. Producer only.
+ * @param[in] error Error message, or nullptr.
+ */
+void ChunkPipe::close(const char *error)
 {
-	return line->length() >= 3 && (line->substr(0, 2) == "  ") && !isspace((*line)[2]);
+	if (error)
+	{
+		msg = error;
+	}
+	closed.store(true, std::memory_order_release);
 }
 
-static inline bool isSubsubkeyword(const std::string *line)
+/**
+ * Release the previous chunk and take the next one, waiting while there
+ * is none. Consumer only.
+ * @param[out] data The chunk data.
+ * @param[out] len The chunk length.
+ * @return False once the producer closed the pipe and all chunks are taken.
+ */
+bool ChunkPipe::next(const char **data, size_t *len)
 {
-	return line->length() >= 4 && (line->substr(0, 3) == "   ") && !isspace((*line)[3]);
+	if (current != npos)
+	{
+		empty.push(current);
+		current = npos;
+	}
+
+	for (int spins = 0;; backoff(&spins))
+	{
+		bool last = closed.load(std::memory_order_acquire);
+		if (full.pop(&current))
+		{
+			*data = chunks[current].data();
+			*len = chunks[current].size();
+			return true;
+		}
+		if (last)
+		{
+			return false;
+		}
+	}
 }
 
-static inline bool isContinuation(const std::string *line)
+/**
+ * Stop the producer from waiting for empty chunks. Consumer only.
+ */
+void ChunkPipe::cancel()
 {
-	return line->length() >= 11 && line->substr(0, 11) == "           ";
+	cancelled.store(true, std::memory_order_release);
 }
 
-static inline bool isFeatureHeader(const std::string *line)
+/**
+ * The producer's error, once next() returned false.
+ * @return The error message, or nullptr.
+ */
+const std::string *ChunkPipe::error() const
 {
-	return line->length() >= 8 && line->substr(0, 8) == "FEATURES";
+	return msg.empty() ? nullptr : &msg;
 }
 
-static inline bool isFeature(const std::string *line)
+/**
+ * Reader of possibly compressed input. Compressed input is read and
+ * decoded on a thread, which passes the decoded chunks on through a
+ * pipe, so decoding overlaps with parsing. Plain input is read on the
+ * calling thread, or on a reader thread if asked for.
+ */
+class ChunkReader
 {
-	return line->length() >= 6 && (line->substr(0, 5) == "     ") && !isspace((*line)[5]);
-}
+public:
+	ChunkReader(FILE *input, bool threaded = false);
+	~ChunkReader();
+	ChunkReader(const ChunkReader &) = delete;
+	ChunkReader &operator=(const ChunkReader &) = delete;
+	bool next(const char **data, size_t *len);
+	const std::string *error() const;
+	double close();
+
+private:
+	static const size_t chunkSize = 1 << 20;
+
+	void produce(std::string raw);
+	void decode(gbcompression format, std::string *raw, size_t rawLen);
+	bool readRaw(std::string *raw, size_t *rawLen);
+
+	FILE *input;
+	ChunkPipe pipe;
+	std::thread thread;
+	std::string current; ///< Plain chunk read on the calling thread
+	bool pending;		 ///< Plain chunk read but not handed out?
+	bool done;			 ///< Plain input ended?
+	std::string msg;	 ///< Plain input error
+	double busy;		 ///< Time spent reading and decoding
+};
 
-static inline bool isQualifier(const std::string *back)
+/**
+ * Open the reader. The first chunk is read right away to detect the
+ * compression.
+ * @param[in] input The input file.
+ * @param[in] threaded Read plain input on a thread as well?
+ */
+ChunkReader::ChunkReader(FILE *input, bool threaded) : input(input), pipe(chunkSize), pending(false), done(false), busy(0)
 {
-	return (*back)[0] == '/';
+	size_t rawLen;
+	{
+		PhaseTimer timer(&busy);
+		if (!readRaw(&current, &rawLen))
+		{
+			msg = "Failed reading input";
+			done = true;
+			return;
+		}
+	}
+
+	if (threaded || detectCompression(current.data(), rawLen) != GB_PLAIN)
+	{
+		thread = std::thread(&ChunkReader::produce, this, std::move(current));
+		current = std::string();
+	}
+	else
+	{
+		pending = rawLen > 0;
+	}
 }
 
-static inline bool isOrigin(const std::string *line)
+ChunkReader::~ChunkReader()
 {
-	return line->length() >= 6 && line->substr(0, 6) == "ORIGIN";
+	close();
 }
 
-static inline bool isContig(const std::string *line)
+/**
+ * Stop the reader thread, if any.
+ * @return The time spent reading and decoding.
+ */
+double ChunkReader::close()
 {
-	return line->length() >= 6 && line->substr(0, 6) == "CONTIG";
+	if (thread.joinable())
+	{
+		pipe.cancel();
+		thread.join();
+	}
+	return busy;
 }
 
-static bool isSequence(const std::string *line)
+/**
+ * Get the next chunk of decoded input. The chunk stays valid until the
+ * next call.
+ * @param[out] data The chunk.
+ * @param[out] len The chunk length.
+ * @return False at the end of the input or on error.
+ */
+bool ChunkReader::next(const char **data, size_t *len)
 {
-	if (line->length() < 11)
+	if (thread.joinable())
 	{
-		return false;
+		return pipe.next(data, len);
 	}
 
-	std::string n(line->substr(3, 6));
-	stringTrimLeft(&n);
+	// The first chunk was read by the constructor
+	if (!pending && !done)
+	{
+		PhaseTimer timer(&busy);
+		size_t n;
+		if (!readRaw(&current, &n))
+		{
+			msg = "Failed reading input";
+		}
+		pending = n > 0;
+	}
 
-	return isInteger(&n) && std::isspace((*line)[9]) && !std::isspace((*line)[10]);
+	if (!pending)
+	{
+		done = true;
+		return false;
+	}
+
+	pending = false;
+	*data = current.data();
+	*len = current.size();
+	return true;
 }
 
-static inline bool isEnd(const std::string *line)
-{
-	return line->length() >= 2 && line->substr(0, 2) == "//";
+/**
+ * The error after next() returned false.
+ * @return The error message, or nullptr.
+ */
+const std::string *ChunkReader::error() const
+{
+	if (!msg.empty())
+	{
+		return &msg;
+	}
+	return pipe.error();
 }
 
-// Function table for testing keyword level
-bool (*isItemLevel[3])(const std::string *line) = {&isKeyword, &isSubkeyword, &isSubsubkeyword};
-
-/***************************************************************
- * GenBank parsing
- ******************
- * All values are parsed into JSON strings since GenBank
- * is lacking a type system.
- ***************************************************************/
-
 /**
-   * Parse a GenBank LOCUS entry.
-   * @param[in] gbstream The input string stream.
-   * @param[out] line The line buffer.
-   * @param[in] writer The JSON writer object.
-   */
-static void parseLocus(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+ * Read raw input.
+ * @param[out] raw The input buffer, resized to what was read.
+ * @param[out] rawLen Number of bytes read.
+ * @return False on a read error.
+ */
+bool ChunkReader::readRaw(std::string *raw, size_t *rawLen)
 {
-	std::string back(line->substr(12, line->length() - 12));
-	writer->Key("LOCUS");
-	writer->StartArray();
-	writer->String(back.c_str(), back.length(), true);
-	writer->StartArray(); // Dummy array for sub keywords
-	writer->EndArray();   // Dummy array for sub keywords
-	writer->EndArray();
-
-	safeGetline(*gbstream, *line);
+	raw->resize(chunkSize);
+	*rawLen = fread(&(*raw)[0], 1, raw->size(), input);
+	raw->resize(*rawLen);
+	return !ferror(input);
 }
 
 /**
- * Parse a GenBank KEYWORD entry.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
+ * Reader thread.
+ * @param[in] raw The first raw input.
  */
-static void parseKeyword(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer,
-	int level // 0 for Keywords, 1 for Subkeywords, 2 for Subsubkeywords
-)
+void ChunkReader::produce(std::string raw)
 {
-	std::string front, back;
-	splitLine(line, &front, &back);
-
-	// Copy content into buffer and trim whitespace
-	std::string buffer(back);
-	bool whitespace = isspace(back.back());
-	stringTrimRight(&buffer);
-	if (whitespace)
+	double elapsed = 0;
 	{
-		buffer.append(" ");
-	}
-	stringTrim(&front);
+		PhaseTimer timer(&elapsed);
+		size_t rawLen = raw.size();
+		gbcompression format = detectCompression(raw.data(), rawLen);
 
-	writer->Key(front.c_str(), front.length(), true);
-	writer->StartArray(); // Top level array
-
-	// Read the next line
-	safeGetline(*gbstream, *line);
-
-	// Push continuation lines into buffer
-	while (isContinuation(line))
-	{
-		splitLine(line, &front, &back);
-		whitespace = isspace(back.back());
-		stringTrimRight(&back);
-		if (whitespace)
+		if (format != GB_PLAIN)
 		{
-			back.append(" ");
+			decode(format, &raw, rawLen);
 		}
-		buffer.append("\n");
-		buffer.append(back);
-		safeGetline(*gbstream, *line);
-	}
-
-	// Write buffer to JSON
-	writer->String(buffer.c_str(), buffer.length(), true);
-
-	// Parse Sub keywords
-	writer->StartArray();
-	if (level < 2)
-	{ // Genbank allows 3 levels for keywords
-		while (isItemLevel[level + 1](line))
+		else
 		{
-			writer->StartObject();
-			parseKeyword(gbstream, line, writer, level + 1);
-			writer->EndObject();
+			// Read plain input straight into the chunks
+			size_t chunk = pipe.acquire();
+			pipe.chunks[chunk].swap(raw);
+			const char *error = nullptr;
+
+			while (rawLen > 0)
+			{
+				pipe.publish(chunk);
+
+				chunk = pipe.acquire();
+				if (chunk == ChunkPipe::npos)
+				{
+					break;
+				}
+				if (!readRaw(&pipe.chunks[chunk], &rawLen))
+				{
+					error = "Failed reading input";
+					break;
+				}
+			}
+			pipe.close(error);
 		}
 	}
-	writer->EndArray(); // Sub keywords
-	writer->EndArray(); // Top level array
+
+	busy += elapsed - pipe.producerWait;
 }
 
 /**
- * Parse a GenBank qualifier entry.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
+ * Decode compressed input into the pipe.
+ * @param[in] format The compression format.
+ * @param[in,out] raw The first raw input, reused for further input.
+ * @param[in] rawLen Length of the first raw input.
  */
-static void parseQualifier(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+void ChunkReader::decode(gbcompression format, std::string *raw, size_t rawLen)
 {
-	// Push content into a buffer and trim whitespace
-	std::string front, back;
-	splitFeatureLine(line, &front, &back);
+	size_t chunk = pipe.acquire();
+	std::string *out = &pipe.chunks[chunk];
+	out->resize(chunkSize);
+	size_t outLen = 0;
+
+	bool ended = true;		// At a stream boundary?
+	bool needInput = false; // Decoder output drained?
+	std::string error;
+
+	// Pass a full output chunk on and take the next one
+	auto pass = [&]() {
+		if (outLen < out->size())
+		{
+			return true;
+		}
 
-	std::string buffer(back);
-	bool whitespace = isspace(back.back());
-	stringTrimRight(&buffer);
+		pipe.publish(chunk);
+		chunk = pipe.acquire();
+		if (chunk == ChunkPipe::npos)
+		{
+			return false;
+		}
 
-	if (whitespace)
+		out = &pipe.chunks[chunk];
+		out->resize(chunkSize);
+		outLen = 0;
+		return true;
+	};
+
+#ifdef GBJSON_ZLIB
+	if (format == GB_GZIP)
 	{
-		buffer.append(" ");
-	}
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		if (inflateInit2(&z, 15 + 32) != Z_OK) // 32: detect gzip or zlib headers
+		{
+			pipe.close("Failed decompressing gzip");
+			return;
+		}
 
-	buffer.append("\n");
+		z.next_in = (Bytef *)raw->data();
+		z.avail_in = (uInt)rawLen;
 
-	// Read the next line
-	safeGetline(*gbstream, *line);
+		while (error.empty())
+		{
+			if (z.avail_in == 0 && needInput)
+			{
+				if (!readRaw(raw, &rawLen))
+				{
+					error = "Failed reading input";
+					break;
+				}
+				if (rawLen == 0)
+				{
+					break;
+				}
+				z.next_in = (Bytef *)raw->data();
+				z.avail_in = (uInt)rawLen;
+			}
+
+			z.next_out = (Bytef *)&(*out)[outLen];
+			z.avail_out = (uInt)(out->size() - outLen);
+
+			uInt avail = z.avail_in;
+			int ret = inflate(&z, Z_NO_FLUSH);
+			outLen = out->size() - z.avail_out;
+			needInput = z.avail_out > 0;
+
+			if (z.avail_in < avail)
+			{
+				ended = false;
+			}
+
+			if (ret == Z_STREAM_END)
+			{
+				// Concatenated gzip members continue the stream
+				inflateReset(&z);
+				ended = true;
+			}
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				error = "Failed decompressing gzip";
+			}
+
+			if (!pass())
+			{
+				inflateEnd(&z);
+				return;
+			}
+		}
 
-	// Push continuation lines into the buffer
-	if (isContinuation(line))
+		inflateEnd(&z);
+	}
+	else
+#endif
+#ifdef GBJSON_ZSTD
+		if (format == GB_ZSTD)
 	{
-		splitFeatureLine(line, &front, &back);
+		ZSTD_DStream *zs = ZSTD_createDStream();
+		if (!zs || ZSTD_isError(ZSTD_initDStream(zs)))
+		{
+			ZSTD_freeDStream(zs);
+			pipe.close("Failed decompressing zstd");
+			return;
+		}
 
-		while (!isQualifier(&back) && isContinuation(line))
+		ZSTD_inBuffer in = {raw->data(), rawLen, 0};
+
+		while (error.empty())
 		{
-			whitespace = isspace(back.back());
-			stringTrimRight(&back);
-			if (whitespace)
+			if (in.pos == in.size && needInput)
 			{
-				buffer.append(" ");
+				if (!readRaw(raw, &rawLen))
+				{
+					error = "Failed reading input";
+					break;
+				}
+				if (rawLen == 0)
+				{
+					break;
+				}
+				in = {raw->data(), rawLen, 0};
 			}
 
-			buffer.append(back);
-			buffer.append("\n");
-			safeGetline(*gbstream, *line);
+			ZSTD_outBuffer o = {&(*out)[0], out->size(), outLen};
+			size_t pos = in.pos;
+			size_t ret = ZSTD_decompressStream(zs, &o, &in);
+			needInput = o.pos < o.size;
 
-			if (isContinuation(line))
+			if (ZSTD_isError(ret))
 			{
-				splitFeatureLine(line, &front, &back);
+				error = "Failed decompressing zstd";
 			}
-			else
+			else if (in.pos > pos || o.pos > outLen)
 			{
-				break;
+				ended = ret == 0; // Frame complete
+			}
+			outLen = o.pos;
+
+			if (!pass())
+			{
+				ZSTD_freeDStream(zs);
+				return;
 			}
 		}
-	}
 
-	// Drop last newline
-	if (!buffer.empty())
+		ZSTD_freeDStream(zs);
+	}
+	else
+#endif
 	{
-		buffer.pop_back();
+		error = std::string("No ") + compressionName(format) + " support";
 	}
 
-	// Find the qualifier delimiter if it exists
-	size_t equalSignPos = buffer.find('=');
-
-	// Write out the buffer
-	writer->StartObject(); // Qualifier start
-
-	if (equalSignPos == -1 || equalSignPos == buffer.length() - 1)
+	if (error.empty() && !ended)
 	{
-		// No qualifier value
-		writer->Key(buffer.substr(1, buffer.length()).c_str(), buffer.length() - 1, true);
-		writer->Null();
+		error = std::string("Truncated ") + compressionName(format) + " input";
 	}
-	else
+
+	if (outLen > 0)
 	{
-		// Key value pair
-		std::string key(buffer.substr(1, equalSignPos - 1));
-		std::string value(buffer.substr(equalSignPos + 1, buffer.length() - equalSignPos));
-		writer->Key(key.c_str(), key.length(), true);
-		writer->String(value.c_str(), value.length(), true);
+		out->resize(outLen);
+		pipe.publish(chunk);
 	}
 
-	writer->EndObject(); // Qualifier end
+	pipe.close(error.empty() ? nullptr : error.c_str());
 }
 
 /**
- * Parse a GenBank feature entry.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
+ * Writer thread of a sink. Flushed buffers are swapped with empty
+ * chunks of a pipe, then compressed and written out by the thread.
  */
-static void parseFeature(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+class AsyncWriter
 {
-	// Push content into a buffer
-	std::string front, back;
-	splitFeatureLine(line, &front, &back);
+public:
+	AsyncWriter(OutputSink *sink);
+	~AsyncWriter();
+	AsyncWriter(const AsyncWriter &) = delete;
+	AsyncWriter &operator=(const AsyncWriter &) = delete;
+	bool submit(std::string *buffer);
+	bool finish(gbstats *stats);
+
+private:
+	void consume();
+
+	ChunkPipe pipe;
+	OutputSink inner; ///< Sink written by the thread
+	gbstats counts;	  ///< Write time and bytes of the thread
+	std::thread thread;
+};
 
-	std::string buffer(back);
-	stringTrimRight(&buffer);
-	stringTrim(&front);
+/**
+ * Start the writer. It takes over the file, file descriptor, output
+ * callback and compressor of the sink.
+ * @param[in,out] sink The sink.
+ */
+AsyncWriter::AsyncWriter(OutputSink *sink) : pipe(sink->flushSize)
+{
+	inner.file = sink->file;
+	inner.fd = sink->fd;
+	inner.callback = sink->callback;
+	inner.user = sink->user;
+	inner.compressor = sink->compressor;
+	inner.stats = &counts;
+	sink->compressor = nullptr;
+
+	thread = std::thread(&AsyncWriter::consume, this);
+}
 
-	writer->StartObject(); // Feature start
-	writer->Key(front.c_str(), front.length(), true);
+AsyncWriter::~AsyncWriter()
+{
+	finish(nullptr);
+}
 
-	writer->StartArray();  // Qualifier array
-	writer->StartObject(); // Location start
-	writer->Key("Location");
+/**
+ * Hand a buffer to the writer thread. The buffer is swapped with an
+ * empty one.
+ * @param[in,out] buffer The buffer.
+ * @return False if the writer has stopped.
+ */
+bool AsyncWriter::submit(std::string *buffer)
+{
+	size_t chunk = pipe.acquire();
+	if (chunk == ChunkPipe::npos)
+	{
+		return false;
+	}
 
-	// Consume location continuation lines
-	safeGetline(*gbstream, *line);
+	pipe.chunks[chunk].swap(*buffer);
+	buffer->clear();
+	pipe.publish(chunk);
+	return true;
+}
 
-	while (isContinuation(line))
+/**
+ * Write out all buffers and stop the thread.
+ * @param[in,out] stats Statistics to add the write time and bytes to, or nullptr.
+ * @return False on a write error.
+ */
+bool AsyncWriter::finish(gbstats *stats)
+{
+	if (thread.joinable())
 	{
-		splitFeatureLine(line, &front, &back);
-
-		if (isQualifier(&back))
-		{
-			break; // Exit loop if this is not a continuation line
-		}
-		else
+		pipe.close();
+		thread.join();
+		inner.close(); // Ends compression
+		if (stats)
 		{
-			bool whitespace = isspace(back.back());
-			stringTrimRight(&back);
-			if (whitespace)
-			{
-				back.append(" ");
-			}
-			buffer.append(back);
-			safeGetline(*gbstream, *line);
+			stats->add(&counts);
 		}
 	}
+	return !inner.failed;
+}
 
-	// Write location
-	writer->String(buffer.c_str(), buffer.length(), true);
-	writer->EndObject(); // Location end
+/**
+ * Writer thread.
+ */
+void AsyncWriter::consume()
+{
+	const char *data;
+	size_t len;
 
-	// Parse qualifiers
-	while (isQualifier(&back) && isContinuation(line))
+	while (pipe.next(&data, &len))
 	{
-		parseQualifier(gbstream, line, writer);
-		if (isContinuation(line))
+		inner.write(data, len);
+		if (inner.failed)
 		{
-			splitFeatureLine(line, &front, &back);
+			pipe.cancel(); // Stop taking output
+			break;
 		}
 	}
-
-	writer->EndArray();  // Qualifier array
-	writer->EndObject(); // Feature end
 }
 
-/**
- * Parse a GenBank feature table.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
- */
-static void parseFeatures(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+/***************************************************************
+ * File handling
+ ***************************************************************/
+
+static inline int seekFile(FILE *fp, uint64_t offset)
 {
-	writer->Key("FEATURES");
-	safeGetline(*gbstream, *line);
+#ifdef _WIN32
+	return _fseeki64(fp, static_cast<__int64>(offset), SEEK_SET);
+#else
+	return fseeko(fp, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
 
-	writer->StartArray(); // Features array
+// File position, or 0 if the file is not seekable
+static inline uint64_t tellFile(FILE *fp)
+{
+#ifdef _WIN32
+	__int64 pos = _ftelli64(fp);
+#else
+	off_t pos = ftello(fp);
+#endif
+	return pos > 0 ? static_cast<uint64_t>(pos) : 0;
+}
 
-	if (!isFeature(line))
-	{ // No features present
-		goto cleanup;
-	}
+static inline void fileSize(FILE *fp, size_t *len)
+{
+	size_t pos = ftell(fp);
 
-	while (isFeature(line))
-	{
-		parseFeature(gbstream, line, writer);
-	}
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
 
-cleanup:
-	writer->EndArray(); // Features array
+	fseek(fp, pos, SEEK_SET);
 }
 
 /**
- * Parse a GenBank origin entry.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
+ * Read a file into a string. gzip and zstd files are decompressed.
+ * @param[in] filename The filename.
+ * @param[out] output The file content.
+ * @param[out] err Error object.
  */
-static void parseOrigin(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+void fileToString(const std::string *filename, std::string *output, gberror *err)
 {
-	std::string back(line->substr(6, 79 - 6));
-	stringTrimRight(&back);
+	FILE *input = fopen(filename->c_str(), "rb");
 
-	writer->Key("ORIGIN");
-	writer->StartArray();
-	if (back.empty())
-	{ // No value
-		writer->Null();
-	}
-	else
-	{ // Entry
-		writer->String(back.c_str(), back.length(), true);
+	if (!input)
+	{
+		err->flag = true;
+		err->msg = "Failed to open ";
+		err->msg.append(filename->c_str());
+		err->source = "fileToString";
+		return;
 	}
-	writer->StartArray(); // Dummy array for sub keywords
-	writer->EndArray();   // Dummy array for sub keywords
-	writer->EndArray();
-}
 
-/**
- * Parse a GenBank sequence entry.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
- */
-static void parseSequence(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
-{
-	std::string front, back, buffer;
-	safeGetline(*gbstream, *line);
+	char magic[4];
+	size_t nmagic = fread(magic, 1, sizeof(magic), input);
+	rewind(input);
 
-	if (isContig(line))
+	if (detectCompression(magic, nmagic) != GB_PLAIN)
 	{
-		// Copy content into buffer and trim whitespace
-		splitLine(line, &front, &back);
-		buffer.append(back);
-		stringTrimRight(&buffer);
+		// Decompress chunk by chunk
+		ChunkReader reader(input);
+		const char *data;
+		size_t len;
 
-		bool whitespace = isspace(back.back());
-		if (whitespace)
+		output->clear();
+		while (reader.next(&data, &len))
 		{
-			buffer.append(" ");
+			output->append(data, len);
 		}
 
-		// Consume contig lines
-		safeGetline(*gbstream, *line);
-		while (isContinuation(line))
+		if (reader.error())
 		{
-
-			splitLine(line, &front, &back);
-			whitespace = isspace(back.back());
-			stringTrimRight(&back);
-			if (whitespace)
-			{
-				back.append(" ");
-			}
-			buffer.append("\n");
-			buffer.append(back);
-			safeGetline(*gbstream, *line);
+			err->flag = true;
+			err->msg = *reader.error();
+			err->msg.append(" in ");
+			err->msg.append(filename->c_str());
+			err->source = "fileToString";
+		}
+		fclose(input);
+		return;
+	}
+
+	// Reopen plain files in text mode
+	input = freopen(filename->c_str(), "r", input);
+	if (!input)
+	{
+		err->flag = true;
+		err->msg = "Failed to open ";
+		err->msg.append(filename->c_str());
+		err->source = "fileToString";
+		return;
+	}
+
+	size_t len; // File size
+	fileSize(input, &len);
+	output->resize(len);
+
+	len = fread(&(*output)[0], 1, len, input);
+	output->resize(len); // Actual number of chars read
+
+	fclose(input);
+}
+
+/**
+ * Write a string to a file. The file is replaced only once the string is
+ * written in full.
+ * @param[in] filename The filename.
+ * @param[in] data The string.
+ * @param[out] err Error object.
+ * @param[in] compression Compression of the file.
+ */
+void stringToFile(const std::string *filename, const std::string *data, gberror *err, gbcompression compression)
+{
+	OutputFile file;
+	if (!file.open(filename, compression != GB_PLAIN, err))
+	{
+		err->source = "stringToFile";
+		return;
+	}
+
+	bool failed;
+	{
+		OutputSink output;
+		output.file = file.file;
+		if (!output.compress(compression))
+		{
+			err->flag = true;
+			err->msg = std::string("No ") + compressionName(compression) + " support";
+			err->source = "stringToFile";
+			return;
+		}
+
+		output.write(data->data(), data->size());
+		output.close();
+		failed = output.failed;
+	}
+
+	if (failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing to ";
+		err->msg.append(filename->c_str());
+		err->source = "stringToFile";
+	}
+	else if (!file.commit(err))
+	{
+		err->source = "stringToFile";
+	}
+}
+
+/**
+ * Do two filenames name the same file? Files are compared by device and
+ * inode, so different paths to one file are found as well.
+ * @param[in] a The first filename.
+ * @param[in] b The second filename.
+ * @return True if both name the same file.
+ */
+bool sameFile(const std::string *a, const std::string *b)
+{
+	std::error_code ec;
+	return *a == *b || std::filesystem::equivalent(*a, *b, ec);
+}
+
+OutputFile::OutputFile() : file(nullptr) {}
+
+OutputFile::~OutputFile()
+{
+	discard();
+}
+
+/**
+ * Open the temporary file of a target. It is named after the target and
+ * the process, in the directory of the target, so that the rename stays
+ * on one file system.
+ * @param[in] filename The target filename.
+ * @param[in] binary Open in binary mode rather than text mode.
+ * @param[out] err Error object.
+ * @return False on error.
+ */
+bool OutputFile::open(const std::string *filename, bool binary, gberror *err)
+{
+	discard();
+	name = *filename;
+#ifdef _WIN32
+	temporary = name + ".tmp" + std::to_string(_getpid());
+#else
+	temporary = name + ".tmp" + std::to_string(getpid());
+#endif
+
+	file = fopen(temporary.c_str(), binary ? "wb" : "w");
+	if (!file)
+	{
+		err->flag = true;
+		err->msg = "Failed writing to " + name;
+		err->source = "OutputFile";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Close the temporary file and rename it over the target.
+ * @param[out] err Error object.
+ * @return False on error. The temporary file is removed then.
+ */
+bool OutputFile::commit(gberror *err)
+{
+	bool failed = !file || fclose(file) != 0;
+	file = nullptr;
+
+	std::error_code ec;
+	if (!failed)
+	{
+		std::filesystem::rename(temporary, name, ec);
+	}
+	if (failed || ec)
+	{
+		discard();
+		err->flag = true;
+		err->msg = "Failed writing to " + name;
+		err->source = "OutputFile";
+		return false;
+	}
+	temporary.clear();
+	return true;
+}
+
+/**
+ * Close and remove the temporary file, leaving the target as it was.
+ */
+void OutputFile::discard()
+{
+	if (file)
+	{
+		fclose(file);
+		file = nullptr;
+	}
+	if (!temporary.empty())
+	{
+		std::error_code ec;
+		std::filesystem::remove(temporary, ec);
+		temporary.clear();
+	}
+}
+
+MappedFile::MappedFile() : data(nullptr), size(0), writable(false) {}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+/**
+ * Release the mapping.
+ */
+void MappedFile::unmap()
+{
+	if (data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<char *>(data), size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+	writable = false;
+}
+
+/**
+ * Writable view of a copy-on-write mapping.
+ * @return The data, or nullptr if the mapping is read-only.
+ */
+char *MappedFile::writableData()
+{
+	return writable ? const_cast<char *>(data) : nullptr;
+}
+
+OutputSink::OutputSink() : file(nullptr), fd(-1), callback(nullptr), user(nullptr), flushSize(1 << 20), failed(false), stats(nullptr), compressor(nullptr), writer(nullptr) {}
+
+OutputSink::~OutputSink()
+{
+	close();
+}
+
+/**
+ * Compress the output written to the attached output.
+ * @param[in] format The compression format.
+ * @return False if the format is not supported by this build.
+ */
+bool OutputSink::compress(gbcompression format)
+{
+	delete compressor;
+	compressor = nullptr;
+
+	if (format == GB_PLAIN)
+	{
+		return true;
+	}
+
+	compressor = new Compressor(format);
+	if (!compressor->good())
+	{
+		delete compressor;
+		compressor = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Write the buffered output to the attached file, file descriptor or
+ * output callback. Without any, the output stays in the buffer.
+ */
+void OutputSink::flush()
+{
+	if (writer)
+	{
+		if (!buffer.empty() && !writer->submit(&buffer))
+		{
+			failed = true;
+			buffer.clear();
+		}
+	}
+	else if (attached())
+	{
+		write(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+}
+
+/**
+ * Write flushed output on a thread of its own. Compression moves to that
+ * thread as well, so set it first.
+ */
+void OutputSink::startWriter()
+{
+	if (!writer && attached())
+	{
+		writer = new AsyncWriter(this);
+	}
+}
+
+/**
+ * Flush the output and end compression.
+ */
+void OutputSink::close()
+{
+	flush();
+
+	if (writer)
+	{
+		if (!writer->finish(stats))
+		{
+			failed = true;
+		}
+		delete writer;
+		writer = nullptr;
+	}
+
+	if (compressor)
+	{
+		if (attached() && !compressor->write(nullptr, 0, true, this))
+		{
+			failed = true;
+		}
+		delete compressor;
+		compressor = nullptr;
+	}
+}
+
+/**
+ * Write data to the attached output, bypassing the buffer. The data is
+ * compressed if compression is set.
+ * @param[in] data The data.
+ * @param[in] len The data length.
+ */
+void OutputSink::write(const char *data, size_t len)
+{
+	if (writer)
+	{
+		// Batched for the writer thread
+		buffer.append(data, len);
+		maybeFlush();
+		return;
+	}
+
+	PhaseTimer timer(PHASE(stats, writeTime));
+
+	if (compressor)
+	{
+		if (!compressor->write(data, len, false, this))
+		{
+			failed = true;
+		}
+	}
+	else
+	{
+		writeRaw(data, len);
+	}
+}
+
+/**
+ * Write data to the attached file, file descriptor or output callback as it is.
+ * @param[in] data The data.
+ * @param[in] len The data length.
+ */
+void OutputSink::writeRaw(const char *data, size_t len)
+{
+	if (stats)
+	{
+		stats->bytesOut += len;
+	}
+
+	if (file)
+	{
+		if (fwrite(data, 1, len, file) != len)
+		{
+			failed = true;
+		}
+	}
+	else if (fd >= 0)
+	{
+		while (len > 0)
+		{
+#ifdef _WIN32
+			int n = _write(fd, data, (unsigned int)std::min(len, (size_t)1 << 30));
+#else
+			ssize_t n = ::write(fd, data, len);
+#endif
+			if (n <= 0)
+			{
+				failed = true;
+				break;
+			}
+			data += n;
+			len -= n;
+		}
+	}
+	else if (callback)
+	{
+		if (callback(data, len, user) != len)
+		{
+			failed = true;
+		}
+	}
+}
+
+static void mapError(const char *msg, const std::string *filename, gberror *err)
+{
+	err->flag = true;
+	err->msg = msg;
+	err->msg.append(filename->c_str());
+	err->source = "fileToMap";
+}
+
+/**
+ * Map a file into memory. The pages are shared with the page cache and
+ * the kernel is advised of sequential access. Empty files yield an
+ * empty mapping.
+ * @param[in] filename The file name.
+ * @param[out] output The mapped file.
+ * @param[out] err Error object.
+ * @param[in] writable Map copy-on-write, so the data can be modified
+ * without changing the file.
+ */
+void fileToMap(const std::string *filename, MappedFile *output, gberror *err, bool writable)
+{
+	output->unmap();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename->c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		mapError("Failed to open ", filename, err);
+		return;
+	}
+
+	LARGE_INTEGER len;
+	if (!GetFileSizeEx(file, &len))
+	{
+		CloseHandle(file);
+		mapError("Failed to map ", filename, err);
+		return;
+	}
+
+	if (len.QuadPart == 0)
+	{ // Nothing to map
+		CloseHandle(file);
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	void *view = mapping ? MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : NULL;
+
+	// The view keeps the mapping alive
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+
+	if (!view)
+	{
+		mapError("Failed to map ", filename, err);
+		return;
+	}
+
+	output->data = static_cast<const char *>(view);
+	output->size = static_cast<size_t>(len.QuadPart);
+	output->writable = writable;
+#else
+	int fd = open(filename->c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		mapError("Failed to open ", filename, err);
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{ // Pipes and devices cannot be mapped
+		close(fd);
+		mapError("Failed to map ", filename, err);
+		return;
+	}
+
+	if (st.st_size == 0)
+	{ // Nothing to map
+		close(fd);
+		return;
+	}
+
+	void *view = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file alive
+
+	if (view == MAP_FAILED)
+	{
+		mapError("Failed to map ", filename, err);
+		return;
+	}
+
+	posix_madvise(view, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+	output->data = static_cast<const char *>(view);
+	output->size = static_cast<size_t>(st.st_size);
+	output->writable = writable;
+#endif
+}
+/***************************************************************
+ * String handling
+ ***************************************************************/
+
+static inline void stringTrimLeft(std::string_view *str)
+{
+	str->remove_prefix(std::find_if(str->begin(), str->end(), [](int c) { return !std::isspace(c); }) - str->begin());
+}
+
+static inline void stringTrimRight(std::string_view *str)
+{
+	str->remove_suffix(std::find_if(str->rbegin(), str->rend(), [](int c) { return !std::isspace(c); }) - str->rbegin());
+}
+
+static inline void stringTrim(std::string_view *str)
+{
+	stringTrimLeft(str);
+	stringTrimRight(str);
+}
+
+/***************************************************************
+ * Checksums
+ ***************************************************************/
+
+/**
+ * CRC-32 (ISO-HDLC) as used by zlib and gzip.
+ * @param[in] data The data.
+ * @param[in] len The data length.
+ * @return The checksum.
+ */
+static uint32_t crc32Of(const char *data, size_t len)
+{
+#ifdef GBJSON_ZLIB
+	uLong crc = crc32(0L, Z_NULL, 0);
+	while (len > 0)
+	{ // zlib takes 32-bit lengths
+		uInt n = static_cast<uInt>(std::min(len, size_t(1) << 30));
+		crc = crc32(crc, reinterpret_cast<const Bytef *>(data), n);
+		data += n;
+		len -= n;
+	}
+	return static_cast<uint32_t>(crc);
+#else
+	static uint32_t table[256];
+	static bool init = [] {
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+			{
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		return true;
+	}();
+	(void)init;
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+#endif
+}
+
+/***************************************************************
+ * Sequence compaction
+ ******************
+ * Sequence lines are compacted by finding the spaces of a
+ * whole SIMD register at once and copying the runs between
+ * them with fixed-width moves. Line endings are found the
+ * same way.
+ ***************************************************************/
+
+#if defined(GBJSON_SIMD_AVX2)
+static const size_t simdWidth = 32; // Bytes per register
+static const int maskShift = 0;		// log2 of mask bits per byte
+
+static inline uint64_t spaceMask(const char *p)
+{
+	__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+#elif defined(GBJSON_SIMD_SSE2)
+static const size_t simdWidth = 16;
+static const int maskShift = 0;
+
+static inline uint64_t spaceMask(const char *p)
+{
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+#elif defined(GBJSON_SIMD_NEON)
+static const size_t simdWidth = 16;
+static const int maskShift = 2;
+
+static inline uint64_t spaceMask(const char *p)
+{
+	// Narrow the comparison to 4 bits per byte, there is no movemask
+	uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(p)), vdupq_n_u8(' '));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x1111111111111111ull;
+}
+#endif
+
+#if defined(GBJSON_SIMD_AVX2)
+static inline uint64_t lineEndMask(const char *p)
+{
+	__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	__m256i eol = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	return (uint32_t)_mm256_movemask_epi8(eol);
+}
+#elif defined(GBJSON_SIMD_SSE2)
+static inline uint64_t lineEndMask(const char *p)
+{
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	__m128i eol = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	return (uint32_t)_mm_movemask_epi8(eol);
+}
+#elif defined(GBJSON_SIMD_NEON)
+static inline uint64_t lineEndMask(const char *p)
+{
+	uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+	uint8x16_t eol = vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r')));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eol), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x1111111111111111ull;
+}
+#endif
+
+static const size_t simdSlack = 32; // Output slack needed by copyWithoutSpaces
+
+#ifdef GBJSON_SIMD
+static inline int trailingZeros(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (int)i;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+#endif
+
+/**
+ * Copy a string without its spaces.
+ * Up to simdSlack bytes past the copied data may be overwritten,
+ * so the output needs that much extra room.
+ * @param[in] in The string.
+ * @param[in] len The string length.
+ * @param[out] out The output.
+ * @return Number of characters written.
+ */
+static size_t copyWithoutSpaces(const char *in, size_t len, char *out)
+{
+	char *o = out;
+	size_t i = 0;
+
+#ifdef GBJSON_SIMD
+	while (i + simdWidth <= len)
+	{
+		size_t base = i;
+		uint64_t mask = spaceMask(in + base);
+
+		if (!mask)
+		{ // No spaces
+			memcpy(o, in + base, simdWidth);
+			o += simdWidth;
+			i += simdWidth;
+			continue;
+		}
+
+		// Copy the runs before each space. The bytes after the last
+		// space are picked up by the next load.
+		while (mask)
+		{
+			size_t pos = base + (trailingZeros(mask) >> maskShift);
+			size_t run = pos - i;
+
+			if (i + simdWidth <= len)
+			{
+				memcpy(o, in + i, simdWidth);
+			}
+			else
+			{
+				memcpy(o, in + i, run);
+			}
+
+			o += run;
+			i = pos + 1;
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (in[i] != ' ')
+		{
+			*o++ = in[i];
+		}
+	}
+
+	return o - out;
+}
+
+/***************************************************************
+ * Sequence packing
+ ******************
+ * Bases are packed into 2 bits each, a, c, g and t as 0 to 3,
+ * four to a byte starting at the low bits. All other characters,
+ * i.e. IUPAC ambiguity codes and upper case bases, are packed as
+ * 0 and listed as runs of one character after the packed bytes.
+ * The list is a varint count followed by a varint gap from the
+ * end of the previous run, a varint length and the character
+ * for each run.
+ ***************************************************************/
+
+static const unsigned char notPacked = 0xff;
+
+// 2-bit codes of the packable characters
+static const struct PackTable
+{
+	unsigned char code[256];	   ///< Code of a character, or notPacked.
+	uint32_t bases[256];		   ///< Four bases of a packed byte.
+	PackTable()
+	{
+		memset(code, notPacked, sizeof(code));
+		const char *acgt = "acgt";
+		for (int i = 0; i < 4; i++)
+		{
+			code[static_cast<unsigned char>(acgt[i])] = i;
+		}
+		for (int b = 0; b < 256; b++)
+		{
+			char four[4] = {acgt[b & 3], acgt[(b >> 2) & 3], acgt[(b >> 4) & 3], acgt[(b >> 6) & 3]};
+			memcpy(&bases[b], four, 4);
+		}
+	}
+} packTable;
+
+#if defined(GBJSON_SIMD_AVX2) || defined(GBJSON_SIMD_SSE2)
+/**
+ * Pack 16 bases into 4 bytes if they are all a, c, g or t.
+ * @param[in] p The bases.
+ * @param[out] out The packed bytes.
+ * @return False if a base cannot be packed.
+ */
+static inline bool pack16(const char *p, char *out)
+{
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	__m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('a')), _mm_cmpeq_epi8(v, _mm_set1_epi8('c'))),
+							  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('g')), _mm_cmpeq_epi8(v, _mm_set1_epi8('t'))));
+	if (_mm_movemask_epi8(ok) != 0xffff)
+	{
+		return false;
+	}
+
+	// ((c >> 1) ^ (c >> 2)) & 3 maps a, c, g, t to 0, 1, 2, 3
+	__m128i code = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), _mm_set1_epi8(3));
+
+	// Merge pairs of codes, then pairs of pairs, into the low byte of each 32-bit lane
+	__m128i x = _mm_or_si128(code, _mm_slli_epi16(_mm_srli_epi16(code, 8), 2));
+	__m128i y = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(_mm_srli_epi32(x, 16), 4)), _mm_set1_epi32(0xff));
+	__m128i packed = _mm_packus_epi16(_mm_packs_epi32(y, y), y);
+
+	uint32_t bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+	memcpy(out, &bytes, 4);
+	return true;
+}
+#elif defined(GBJSON_SIMD_NEON)
+static inline bool pack16(const char *p, char *out)
+{
+	uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+	uint8x16_t ok = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('a')), vceqq_u8(v, vdupq_n_u8('c'))),
+							 vorrq_u8(vceqq_u8(v, vdupq_n_u8('g')), vceqq_u8(v, vdupq_n_u8('t'))));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(ok), 4);
+	if (vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) != ~0ull)
+	{
+		return false;
+	}
+
+	uint8x16_t code = vandq_u8(veorq_u8(vshrq_n_u8(v, 1), vshrq_n_u8(v, 2)), vdupq_n_u8(3));
+
+	uint16x8_t x = vreinterpretq_u16_u8(code);
+	x = vorrq_u16(x, vshlq_n_u16(vshrq_n_u16(x, 8), 2));
+	uint32x4_t y = vreinterpretq_u32_u16(x);
+	y = vorrq_u32(y, vshlq_n_u32(vshrq_n_u32(y, 16), 4));
+
+	uint16x4_t words = vmovn_u32(y);
+	uint8x8_t packed = vmovn_u16(vcombine_u16(words, words));
+
+	uint32_t bytes = vget_lane_u32(vreinterpret_u32_u8(packed), 0);
+	memcpy(out, &bytes, 4);
+	return true;
+}
+#endif
+
+static inline void putVarint(OutputSink *out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out->put(static_cast<char>(value | 0x80));
+		value >>= 7;
+	}
+	out->put(static_cast<char>(value));
+}
+
+static inline bool getVarint(const char **p, const char *end, uint64_t *value)
+{
+	*value = 0;
+	for (int shift = 0; *p != end && shift < 64; shift += 7)
+	{
+		unsigned char c = static_cast<unsigned char>(*(*p)++);
+		*value |= uint64_t(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Pack a sequence and append it to an output sink.
+ * @param[in] seq The bases.
+ * @param[in] len Number of bases.
+ * @param[out] out The output sink.
+ * @return Number of bytes appended.
+ */
+static size_t packSequence(const char *seq, size_t len, OutputSink *out)
+{
+	size_t start = out->buffer.size();
+	char *packed = out->extend((len + 3) / 4);
+
+	struct Run
+	{
+		size_t pos, len;
+		char c;
+	};
+	std::vector<Run> runs;
+
+	auto packByte = [&](size_t i, size_t n) {
+		unsigned char byte = 0;
+		for (size_t k = 0; k < n; k++)
+		{
+			char c = seq[i + k];
+			unsigned char code = packTable.code[static_cast<unsigned char>(c)];
+			if (code == notPacked)
+			{
+				code = 0;
+				if (!runs.empty() && runs.back().c == c && runs.back().pos + runs.back().len == i + k)
+				{
+					runs.back().len++;
+				}
+				else
+				{
+					runs.push_back({i + k, 1, c});
+				}
+			}
+			byte |= code << (2 * k);
+		}
+		packed[i / 4] = static_cast<char>(byte);
+	};
+
+	size_t i = 0;
+#ifdef GBJSON_SIMD
+	for (; i + 16 <= len; i += 16)
+	{
+		if (!pack16(seq + i, packed + i / 4))
+		{
+			for (size_t k = 0; k < 16; k += 4)
+			{
+				packByte(i + k, 4);
+			}
+		}
+	}
+#endif
+	for (; i < len; i += 4)
+	{
+		packByte(i, std::min(len - i, size_t(4)));
+	}
+
+	putVarint(out, runs.size());
+	size_t end = 0;
+	for (auto &run : runs)
+	{
+		putVarint(out, run.pos - end);
+		putVarint(out, run.len);
+		out->put(run.c);
+		end = run.pos + run.len;
+	}
+
+	return out->buffer.size() - start;
+}
+
+/**
+ * Unpack a sequence packed by packSequence.
+ * @param[in] data The packed data.
+ * @param[in] size The packed data size.
+ * @param[in] len Number of bases.
+ * @param[out] seq The bases.
+ * @return False if the data is malformed.
+ */
+static bool unpackSequence(const char *data, size_t size, size_t len, std::string *seq)
+{
+	size_t nbytes = (len + 3) / 4;
+	if (size < nbytes)
+	{
+		return false;
+	}
+
+	// Four bases per byte. The last byte may hold fewer.
+	seq->resize(nbytes * 4);
+	char *o = &(*seq)[0];
+	for (size_t i = 0; i < nbytes; i++)
+	{
+		memcpy(o + 4 * i, &packTable.bases[static_cast<unsigned char>(data[i])], 4);
+	}
+	seq->resize(len);
+
+	// Restore the runs of other characters
+	const char *p = data + nbytes, *end = data + size;
+	uint64_t nruns, gap, n, pos = 0;
+	if (!getVarint(&p, end, &nruns))
+	{
+		return false;
+	}
+
+	for (uint64_t r = 0; r < nruns; r++)
+	{
+		if (!getVarint(&p, end, &gap) || !getVarint(&p, end, &n) || p == end || gap > len - pos || n > len - pos - gap)
+		{
+			return false;
+		}
+		pos += gap;
+		memset(&(*seq)[pos], *p++, n);
+		pos += n;
+	}
+
+	return p == end;
+}
+
+/**
+ * Find the next \n or \r, a register at a time.
+ * @param[in] p Start of the search.
+ * @param[in] end End of the buffer.
+ * @return The position of the line ending, or end.
+ */
+static inline const char *findLineEnd(const char *p, const char *end)
+{
+#ifdef GBJSON_SIMD
+	for (; p + simdWidth <= end; p += simdWidth)
+	{
+		uint64_t mask = lineEndMask(p);
+		if (mask)
+		{
+			return p + (trailingZeros(mask) >> maskShift);
+		}
+	}
+#endif
+	while (p != end && *p != '\n' && *p != '\r')
+	{
+		p++;
+	}
+	return p;
+}
+
+/**
+ * Line cursor over a character buffer.
+ * Lines are returned as views into the buffer, so the input is never copied.
+ * Handles \r, \r\n, and \n line endings for files moved between platforms.
+ * Buffers without \r, the common case, are split with memchr for \n alone.
+ */
+class LineCursor
+{
+public:
+	LineCursor(const char *data, size_t len)
+		: pos(data), end(data + len), eofFlag(false), newlinesOnly(len == 0 || !memchr(data, '\r', len)) {}
+
+	// Cursor on part of the buffer of another cursor. It takes over the
+	// line ending mode of that cursor instead of scanning the part again.
+	LineCursor(const char *data, size_t len, const LineCursor *parent)
+		: pos(data), end(data + len), eofFlag(false), newlinesOnly(parent->newlinesOnly) {}
+
+	/**
+	 * Advance to the next line. The cursor reaches end-of-file only
+	 * when no more characters can be read, so a last line without
+	 * line ending is still returned.
+	 * @param[out] line The line.
+	 */
+	void getline(std::string_view *line)
+	{
+		if (pos == end)
+		{
+			*line = std::string_view();
+			eofFlag = true;
+			return;
+		}
+
+		if (newlinesOnly)
+		{
+			const char *p = static_cast<const char *>(memchr(pos, '\n', end - pos));
+			*line = std::string_view(pos, (p ? p : end) - pos);
+			pos = p ? p + 1 : end;
+			return;
+		}
+
+		const char *p = findLineEnd(pos, end);
+
+		*line = std::string_view(pos, p - pos);
+
+		if (p != end)
+		{
+			if (*p == '\r' && p + 1 != end && *(p + 1) == '\n')
+			{
+				p++;
+			}
+			p++;
+		}
+
+		pos = p;
+	}
+
+	/**
+	 * Move the cursor, so that the next line starts at a position.
+	 * @param[in] p The position in the buffer.
+	 */
+	void seek(const char *p)
+	{
+		pos = p;
+		eofFlag = false;
+	}
+
+	bool eof() const { return eofFlag; }
+	const char *position() const { return pos; }   ///< Start of the next line.
+	size_t remaining() const { return end - pos; } ///< Characters after the current line.
+
+private:
+	const char *pos;   ///< Start of the next line.
+	const char *end;   ///< End of the buffer.
+	bool eofFlag;	   ///< End of file reached?
+	bool newlinesOnly; ///< No \r in the buffer?
+};
+
+static inline std::string_view subview(const std::string_view *line, size_t pos, size_t n = std::string_view::npos)
+{
+	return pos < line->size() ? line->substr(pos, n) : std::string_view();
+}
+
+/**
+ * Split a string into lines and left pad with whitespace.
+ * The padded block is written straight to the output.
+ * @param[in] input The string.
+ * @param[out] out The output sink.
+ * @param[in] leader Number of leading whitespaces.
+ * @param[in] len Line length.
+ * @param[in] offset Offset for the first line.
+ */
+static void blockPad(
+	const std::string_view *input,
+	OutputSink *out,
+	int leader,
+	int len,
+	int offset)
+{
+	// Sanity check
+	if (len < leader || len <= 0 || offset >= len - leader)
+	{
+		return;
+	}
+
+	LineCursor in(input->data(), input->size());
+	std::string_view line;
+
+	// Consume first input line. This does not get leading whitespace.
+	in.getline(&line);
+
+	long long writeLen = len - leader;											// Length that contains parts of the string
+	long long nchars = (long long)line.length() + offset;						// Characters to place
+	long long nfrag = nchars > 0 ? (nchars + writeLen - 1) / writeLen : 0; // Number of fragments
+
+	// First part that does not have leading whitespace.
+	std::string_view frag(subview(&line, 0, writeLen - offset));
+	out->append(frag.data(), frag.length());
+	out->put('\n');
+
+	// Remaining parts
+	for (long long i = 0; i < nfrag - 1; i++)
+	{
+		frag = subview(&line, writeLen - offset + i * writeLen, writeLen);
+		out->fill(leader);
+		out->append(frag.data(), frag.length());
+		out->put('\n');
+	}
+
+	// Consume remaining input lines
+	while (!in.eof())
+	{
+		in.getline(&line);
+		nfrag = ((long long)line.length() + writeLen - 1) / writeLen;
+
+		for (long long i = 0; i < nfrag; i++)
+		{
+			frag = subview(&line, i * writeLen, writeLen);
+			out->fill(leader);
+			out->append(frag.data(), frag.length());
+			out->put('\n');
+		}
+	}
+}
+
+/***************************************************************
+ * GenBank line processing
+ ***************************************************************/
+
+static inline bool endsWithSpace(const std::string_view *str)
+{
+	return !str->empty() && isspace(str->back());
+}
+
+static void splitLine(const std::string_view *line, std::string_view *front, std::string_view *back)
+{
+	*front = subview(line, 0, 10);
+	*back = subview(line, 12);
+}
+
+static void splitSequenceLine(const std::string_view *line, std::string_view *front, std::string_view *back)
+{
+	*front = subview(line, 0, 10);
+	*back = subview(line, 10);
+}
+
+static inline bool isInteger(const std::string_view *n)
+{
+	return !n->empty() && n->end() == std::find_if(n->begin(), n->end(), [](char c) { return !std::isdigit(c); });
+}
+
+static inline bool isLocus(const std::string_view *line)
+{
+	return line->length() >= 13 && line->substr(0, 5) == "LOCUS" && !isspace((*line)[12]);
+}
+
+static const size_t maxReservedLength = size_t(1) << 31; // Longest LOCUS length trusted for reserving buffers
+
+/**
+ * Sequence length declared on a LOCUS line, i.e. the number before bp or aa.
+ * @param[in] value The LOCUS line after the keyword.
+ * @return The length, or 0 if none is declared or it is implausibly long.
+ */
+static size_t locusLength(const std::string_view *value)
+{
+	size_t unit = value->find(" bp");
+	if (unit == std::string_view::npos)
+	{
+		unit = value->find(" aa");
+	}
+	if (unit == std::string_view::npos)
+	{
+		return 0;
+	}
+
+	size_t start = unit;
+	while (start > 0 && isdigit((*value)[start - 1]))
+	{
+		start--;
+	}
+
+	size_t length = 0;
+	for (size_t i = start; i < unit && length <= maxReservedLength; i++)
+	{
+		length = length * 10 + ((*value)[i] - '0');
+	}
+	return length <= maxReservedLength ? length : 0;
+}
+
+static inline bool isKeyword(const std::string_view *line)
+{
+	return line->length() >= 13 && !isspace((*line)[0]) && isalpha((*line)[0]);
+}
+
+static inline bool isSubkeyword(const std::string_view *line)
+{
+	return line->length() >= 3 && (line->substr(0, 2) == "  ") && !isspace((*line)[2]);
+}
+
+static inline bool isSubsubkeyword(const std::string_view *line)
+{
+	return line->length() >= 4 && (line->substr(0, 3) == "   ") && !isspace((*line)[3]);
+}
+
+static inline bool isContinuation(const std::string_view *line)
+{
+	return line->length() >= 11 && line->substr(0, 11) == "           ";
+}
+
+static inline bool isFeatureHeader(const std::string_view *line)
+{
+	return line->length() >= 8 && line->substr(0, 8) == "FEATURES";
+}
+
+static inline bool isOrigin(const std::string_view *line)
+{
+	return line->length() >= 6 && line->substr(0, 6) == "ORIGIN";
+}
+
+static inline bool isContig(const std::string_view *line)
+{
+	return line->length() >= 6 && line->substr(0, 6) == "CONTIG";
+}
+
+static bool isSequence(const std::string_view *line)
+{
+	if (line->length() < 11)
+	{
+		return false;
+	}
+
+	std::string_view n(line->substr(3, 6));
+	stringTrimLeft(&n);
+
+	return isInteger(&n) && std::isspace((*line)[9]) && !std::isspace((*line)[10]);
+}
+
+static inline bool isEnd(const std::string_view *line)
+{
+	return line->length() >= 2 && line->substr(0, 2) == "//";
+}
+
+/**
+ * Kinds of feature table lines.
+ */
+enum featureLineKind
+{
+	FEATURE_LINE,	   // First line of a feature
+	QUALIFIER_LINE,	   // First line of a qualifier
+	CONTINUATION_LINE, // Further line of a location or qualifier
+	OTHER_LINE		   // Not in the feature table
+};
+
+/**
+ * Feature table line, classified once by its column offsets.
+ */
+struct FeatureLine
+{
+	featureLineKind kind;  ///< The kind of line.
+	std::string_view key;  ///< Feature key of a feature line.
+	std::string_view text; ///< The line from column 21.
+};
+
+/**
+ * Classify a feature table line. Feature keys start in column 5, and
+ * locations, qualifiers and their continuations in column 21.
+ * @param[in] line The line.
+ * @param[out] out The classified line.
+ */
+static inline void classifyFeatureLine(const std::string_view *line, FeatureLine *out)
+{
+	const char *p = line->data();
+	size_t len = line->length();
+
+	size_t spaces = 0;
+	while (spaces < len && spaces < 11 && p[spaces] == ' ')
+	{
+		spaces++;
+	}
+
+	if (spaces == 11)
+	{
+		out->text = subview(line, 21);
+		out->kind = !out->text.empty() && out->text[0] == '/' ? QUALIFIER_LINE : CONTINUATION_LINE;
+	}
+	else if (spaces == 5 && len > 5 && !isspace(p[5]))
+	{
+		out->key = subview(line, 0, 21);
+		stringTrim(&out->key);
+		out->text = subview(line, 21);
+		out->kind = FEATURE_LINE;
+	}
+	else
+	{
+		out->kind = OTHER_LINE;
+	}
+}
+
+// Read and classify the next feature table line
+static inline void nextFeatureLine(LineCursor *cursor, std::string_view *line, FeatureLine *next)
+{
+	cursor->getline(line);
+	classifyFeatureLine(line, next);
+}
+
+// Function table for testing keyword level
+bool (*isItemLevel[3])(const std::string_view *line) = {&isKeyword, &isSubkeyword, &isSubsubkeyword};
+
+/**
+ * Scan for the end of a GenBank record, i.e. the position after its // line.
+ * Scanning resumes at pos, which is left at the start of the first line that
+ * has not been scanned, so a growing buffer is scanned only once.
+ * @param[in] data The buffer.
+ * @param[in] len The buffer length.
+ * @param[in,out] pos The scan position.
+ * @param[in] final No more data follows the buffer.
+ * @return True if pos is at the end of a record.
+ */
+static bool scanRecordEnd(const char *data, size_t len, size_t *pos, bool final)
+{
+	const char *end = data + len;
+
+	while (*pos < len)
+	{
+		const char *start = data + *pos;
+		const char *p = findLineEnd(start, end);
+
+		// Unterminated line, or a \r that may be followed by \n
+		if (p == end || (*p == '\r' && p + 1 == end && !final))
+		{
+			return false;
+		}
+
+		std::string_view line(start, p - start);
+		if (*p == '\r' && p + 1 != end && *(p + 1) == '\n')
+		{
+			p++;
+		}
+		*pos = p + 1 - data;
+
+		if (isEnd(&line))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Test whether a name passes the filter.
+ * @param[in] name The name.
+ * @return True if the name is kept.
+ */
+bool gbfilter::keep(const std::string_view *name) const
+{
+	auto has = [name](const std::vector<std::string> *names) {
+		return std::find(names->begin(), names->end(), *name) != names->end();
+	};
+	return (include.empty() || has(&include)) && !has(&exclude);
+}
+
+// First word of a keyword value
+static inline std::string_view keywordValue(const std::string_view *line)
+{
+	std::string_view value(subview(line, 12));
+	stringTrimLeft(&value);
+	return value.substr(0, value.find_first_of(" \t"));
+}
+
+static inline bool isKeywordNamed(const std::string_view *line, const char *keyword, size_t len)
+{
+	return line->compare(0, len, keyword) == 0 && isKeyword(line);
+}
+
+// Name of a top level item, e.g. DEFINITION or ORIGIN
+static inline std::string_view itemName(const std::string_view *line)
+{
+	std::string_view name(line->substr(0, 12));
+	stringTrim(&name);
+	return name;
+}
+
+// Key of a feature line
+// Name of a qualifier, given the content of its first line
+static inline std::string_view qualifierName(const std::string_view *back)
+{
+	std::string_view name(back->substr(1, back->find('=') - 1));
+	stringTrimRight(&name);
+	return name;
+}
+
+// Test whether a top level item is converted
+static inline bool keepItem(const std::string_view *line, const gbprojection *projection)
+{
+	std::string_view name(itemName(line));
+	return projection->keywords.keep(&name);
+}
+
+/**
+ * Skip a top level item up to the next top level line.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ */
+static void skipItem(LineCursor *cursor, std::string_view *line)
+{
+	bool origin = isOrigin(line);
+	cursor->getline(line);
+
+	if (origin && isContig(line))
+	{ // CONTIG belongs to the ORIGIN block here
+		cursor->getline(line);
+	}
+
+	while (!cursor->eof() && !isKeyword(line) && !isOrigin(line) && !isEnd(line))
+	{
+		cursor->getline(line);
+	}
+}
+
+/**
+ * Skip a feature with its location and qualifiers.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in,out] current The feature line, then the line after the feature.
+ */
+static void skipFeature(LineCursor *cursor, std::string_view *line, FeatureLine *current)
+{
+	do
+	{
+		nextFeatureLine(cursor, line, current);
+	} while (current->kind == CONTINUATION_LINE || current->kind == QUALIFIER_LINE);
+}
+
+/**
+ * Skip a qualifier with its continuation lines.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in,out] current The qualifier line, then the line after the qualifier.
+ */
+static void skipQualifier(LineCursor *cursor, std::string_view *line, FeatureLine *current)
+{
+	do
+	{
+		nextFeatureLine(cursor, line, current);
+	} while (current->kind == CONTINUATION_LINE);
+}
+
+/**
+ * Test whether one of the names of a record is selected. The ACCESSION and
+ * VERSION lines are looked up ahead of the cursor in the record header.
+ * @param[in] cursor The input line cursor, after the LOCUS line.
+ * @param[in] locus The LOCUS name.
+ * @param[in] names The selected names.
+ */
+static bool selectName(const LineCursor *cursor, std::string_view locus, const std::unordered_set<std::string> *names)
+{
+	auto has = [names](std::string_view name) {
+		return !name.empty() && names->count(std::string(name)) != 0;
+	};
+
+	if (has(locus))
+	{
+		return true;
+	}
+
+	LineCursor ahead(*cursor);
+	std::string_view line;
+	for (ahead.getline(&line); !ahead.eof() && !isEnd(&line) && !isFeatureHeader(&line) && !isOrigin(&line); ahead.getline(&line))
+	{
+		if ((isKeywordNamed(&line, "ACCESSION", 9) || isKeywordNamed(&line, "VERSION", 7)) && has(keywordValue(&line)))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Test whether a record is selected, from its LOCUS line, e.g.
+ * LOCUS       NC_000913            4641652 bp    DNA     circular BCT 09-MAR-2022
+ * The division is the word before the date. The topology may be missing.
+ * @param[in] cursor The input line cursor, after the LOCUS line.
+ * @param[in] line The LOCUS line.
+ * @param[in] selection The selection.
+ */
+static bool selectRecord(const LineCursor *cursor, const std::string_view *line, const gbselection *selection)
+{
+	std::string_view value(subview(line, 12));
+
+	size_t length = locusLength(&value);
+	if (length < selection->minLength || (selection->maxLength && length > selection->maxLength))
+	{
+		return false;
+	}
+
+	// Split the LOCUS line into words
+	static const size_t maxWords = 8; // Name, length, unit, molecule, topology, division, date and a spare
+	std::string_view words[maxWords];
+	size_t n = 0;
+	for (std::string_view rest(value); n < maxWords;)
+	{
+		stringTrimLeft(&rest);
+		if (rest.empty())
+		{
+			break;
+		}
+		size_t space = std::min(rest.find_first_of(" \t"), rest.size());
+		words[n++] = rest.substr(0, space);
+		rest.remove_prefix(space);
+	}
+
+	// The molecule type follows the unit, and the division precedes the date
+	size_t unit = std::find_if(words, words + n, [](std::string_view w) { return w == "bp" || w == "aa"; }) - words;
+	std::string_view molecule = unit + 1 < n ? words[unit + 1] : std::string_view();
+	size_t date = n > 0 && words[n - 1].find('-') != std::string_view::npos ? n - 1 : n;
+	std::string_view division = date > unit + 2 ? words[date - 1] : std::string_view();
+
+	if (!selection->molecules.keep(&molecule) || !selection->divisions.keep(&division))
+	{
+		return false;
+	}
+
+	return selection->names.empty() || selectName(cursor, words[0], &selection->names);
+}
+
+/**
+ * Skip a record that is not selected, up to and including its // line. A
+ * record without // ends at the next LOCUS line, as in the record index.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer, then the line after the record.
+ */
+static void skipRecord(LineCursor *cursor, std::string_view *line)
+{
+	for (cursor->getline(line); !cursor->eof(); cursor->getline(line))
+	{
+		if (isEnd(line))
+		{
+			cursor->getline(line);
+			break;
+		}
+		if (isLocus(line))
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Range of a parsed location.
+ */
+struct LocationRange
+{
+	uint64_t start;	   ///< First base.
+	uint64_t end;	   ///< Last base.
+	bool startPartial; ///< Start has a < or > marker?
+	bool endPartial;   ///< End has a < or > marker?
+	bool between;	   ///< Site between two bases, a^b?
+};
+
+/**
+ * Feature location parsed into ranges.
+ */
+struct ParsedLocation
+{
+	std::vector<LocationRange> ranges; ///< Ranges in text order.
+	int strand;						   ///< 1 forward, -1 complement, 0 mixed, 2 before the first range.
+};
+
+/**
+ * Parse a location position, e.g. <123.
+ * @param[in,out] p The parse position.
+ * @param[in] end The end of the location.
+ * @param[out] pos The position.
+ * @param[out] partial Has the position a < or > marker?
+ * @return False if there is no position.
+ */
+static inline bool parsePosition(const char **p, const char *end, uint64_t *pos, bool *partial)
+{
+	*partial = *p != end && (**p == '<' || **p == '>');
+	if (*partial)
+	{
+		(*p)++;
+	}
+
+	const char *start = *p;
+	uint64_t value = 0;
+	while (*p != end && **p >= '0' && **p <= '9' && *p - start < 19)
+	{
+		value = value * 10 + (**p - '0');
+		(*p)++;
+	}
+	*pos = value;
+	return *p != start && (*p == end || **p < '0' || **p > '9');
+}
+
+/**
+ * Parse a location range: a base, a..b, a^b for a site between bases,
+ * or a.b for one base within a range.
+ * @param[in,out] p The parse position.
+ * @param[in] end The end of the location.
+ * @param[in] strand Strand of the range.
+ * @param[in,out] location The location.
+ * @return False on a syntax error.
+ */
+static bool parseRange(const char **p, const char *end, int strand, ParsedLocation *location)
+{
+	LocationRange range;
+	if (!parsePosition(p, end, &range.start, &range.startPartial))
+	{
+		return false;
+	}
+
+	range.end = range.start;
+	range.endPartial = range.startPartial; // One base is both ends
+	range.between = false;
+	if (end - *p >= 2 && (*p)[0] == '.' && (*p)[1] == '.')
+	{
+		*p += 2;
+		if (!parsePosition(p, end, &range.end, &range.endPartial))
+		{
+			return false;
+		}
+	}
+	else if (*p != end && (**p == '^' || **p == '.'))
+	{
+		range.between = **p == '^';
+		(*p)++;
+		if (!parsePosition(p, end, &range.end, &range.endPartial))
+		{
+			return false;
+		}
+	}
+
+	location->ranges.push_back(range);
+	location->strand = location->strand == 2 || location->strand == strand ? strand : 0;
+	return true;
+}
+
+/**
+ * Parse a location with its complement, join or order operators.
+ * @param[in,out] p The parse position.
+ * @param[in] end The end of the location.
+ * @param[in] strand Strand of the location.
+ * @param[in] depth Operator nesting depth, which is bounded.
+ * @param[in,out] location The location.
+ * @return False on a syntax error or what has no ranges in this file,
+ * e.g. a location in another entry.
+ */
+static bool parseLocationPart(const char **p, const char *end, int strand, int depth, ParsedLocation *location)
+{
+	const char *name = *p;
+	while (*p != end && **p >= 'a' && **p <= 'z')
+	{
+		(*p)++;
+	}
+	if (*p == name)
+	{
+		return parseRange(p, end, strand, location);
+	}
+
+	std::string_view op(name, *p - name);
+	if (depth > 8 || *p == end || **p != '(' || !(op == "complement" || op == "join" || op == "order" || op == "bond"))
+	{
+		return false;
+	}
+	if (op == "complement")
+	{
+		strand = -strand;
+	}
+
+	do
+	{
+		(*p)++; // ( or ,
+		if (!parseLocationPart(p, end, strand, depth + 1, location))
+		{
+			return false;
+		}
+	} while (*p != end && **p == ',');
+
+	if (*p == end || **p != ')')
+	{
+		return false;
+	}
+	(*p)++;
+	return true;
+}
+
+/**
+ * Parse a feature location into ranges.
+ * @param[in] text The location string.
+ * @param[out] location The location.
+ * @return False if the location is not made of ranges in this entry.
+ */
+static bool parseLocation(const std::string_view *text, ParsedLocation *location)
+{
+	location->ranges.clear();
+	location->strand = 2;
+
+	const char *p = text->data();
+	const char *end = p + text->length();
+	return parseLocationPart(&p, end, 1, 0, location) && p == end;
+}
+
+/**
+ * Write a parsed location as an object after the location string,
+ * {"ParsedLocation": {"strand": "+", "ranges": [{"start": 1, "end": 20}, ...]}}.
+ * Strand is +, - or mixed. A range has start_partial or end_partial if
+ * that end has a < or > marker, and between for a site a^b.
+ * @param[in] location The parsed location.
+ * @param[in] writer The JSON writer object.
+ */
+template <typename Writer>
+static void writeParsedLocation(const ParsedLocation *location, Writer *writer)
+{
+	writer->StartObject();
+	writer->Key("ParsedLocation");
+	writer->StartObject();
+	writer->Key("strand");
+	writer->String(location->strand == 1 ? "+" : location->strand == -1 ? "-" : "mixed");
+	writer->Key("ranges");
+	writer->StartArray();
+	for (const LocationRange &range : location->ranges)
+	{
+		writer->StartObject();
+		writer->Key("start");
+		writer->Uint64(range.start);
+		writer->Key("end");
+		writer->Uint64(range.end);
+		if (range.startPartial)
+		{
+			writer->Key("start_partial");
+			writer->Bool(true);
+		}
+		if (range.endPartial)
+		{
+			writer->Key("end_partial");
+			writer->Bool(true);
+		}
+		if (range.between)
+		{
+			writer->Key("between");
+			writer->Bool(true);
+		}
+		writer->EndObject();
+	}
+	writer->EndArray();
+	writer->EndObject();
+	writer->EndObject();
+}
+
+/**
+ * Run a function for the indices 0..n-1 on a pool of threads, passing
+ * the number of the thread as well, so that each thread can keep its
+ * own buffers across its items.
+ * @param[in] n Number of work items.
+ * @param[in] threads Number of threads, including the calling thread.
+ * @param[in] fn The function, taking the thread number below threads and the index.
+ */
+template <typename Function>
+static void parallelForWorkers(size_t n, int threads, Function fn)
+{
+	std::atomic<size_t> next(0);
+
+	auto work = [&](int worker) {
+		for (size_t i = next++; i < n; i = next++)
+		{
+			fn(worker, i);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads && (size_t)i < n; i++)
+	{
+		pool.emplace_back(work, i);
+	}
+
+	work(0);
+
+	for (auto &t : pool)
+	{
+		t.join();
+	}
+}
+
+/**
+ * Run a function for the indices 0..n-1 on a pool of threads.
+ * @param[in] n Number of work items.
+ * @param[in] threads Number of threads, including the calling thread.
+ * @param[in] fn The function.
+ */
+template <typename Function>
+static void parallelFor(size_t n, int threads, Function fn)
+{
+	parallelForWorkers(n, threads, [&](int, size_t i) { fn(i); });
+}
+
+/**
+ * Settings and counters shared by the parse functions.
+ */
+struct ParseContext
+{
+	gbstats *counts;				///< The counters.
+	const gbprojection *projection; ///< Sections to convert, or nullptr for all.
+	const gbselection *selection;	///< Records to convert, or nullptr for all.
+	OutputSink *sequences;			///< Sequence sidecar, or nullptr to embed sequences.
+	uint64_t sequenceOffset;		///< Sidecar offset of the next sequence.
+	bool packSequences;				///< 2-bit pack sidecar sequences?
+	bool parseLocations;			///< Write parsed feature locations?
+	std::string buffer;				///< Text buffer of the parse functions.
+	ParsedLocation location;		///< The last parsed location.
+	rapidjson::StringBuffer *output; ///< Output of the JSON writer to reserve, or nullptr.
+	int splitThreads;				 ///< Threads for the feature table of a large record.
+	const char *splicedBlock;		 ///< Sequence block rendered with the feature table, or nullptr.
+	const char *splicedEnd;			 ///< Start of the line after the rendered block.
+	std::string splicedSequence;	 ///< The rendered SEQUENCE value.
+	ParseContext(gbstats *counts, const gboptions *opts)
+		: counts(counts), projection(opts->projection), selection(opts->selection), sequences(nullptr), sequenceOffset(0), packSequences(false),
+		  parseLocations(opts->parseLocations), output(nullptr),
+		  splitThreads(!opts->splitFeatures ? 1 : opts->threads > 0 ? opts->threads : std::max(1u, std::thread::hardware_concurrency())),
+		  splicedBlock(nullptr), splicedEnd(nullptr) {}
+
+	// Context for parsing part of a record on another thread
+	ParseContext(gbstats *counts, const ParseContext *parent)
+		: counts(counts), projection(parent->projection), selection(parent->selection), sequences(parent->sequences),
+		  sequenceOffset(parent->sequenceOffset), packSequences(parent->packSequences), parseLocations(parent->parseLocations),
+		  output(nullptr), splitThreads(1), splicedBlock(nullptr), splicedEnd(nullptr) {}
+};
+
+/***************************************************************
+ * GenBank parsing
+ ******************
+ * All values are parsed into JSON strings since GenBank
+ * is lacking a type system.
+ ***************************************************************/
+
+/**
+   * Parse a GenBank LOCUS entry.
+   * @param[in] cursor The input line cursor.
+   * @param[out] line The line buffer.
+   * @param[in] writer The JSON writer object.
+   * @param[in,out] context The parse context.
+   */
+template <typename Writer>
+static void parseLocus(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	std::string_view back(line->substr(12));
+	writer->Key("LOCUS");
+	writer->StartArray();
+	writer->String(back.data(), back.length(), true);
+	writer->StartArray(); // Dummy array for sub keywords
+	writer->EndArray();   // Dummy array for sub keywords
+	writer->EndArray();
+
+	// Take the output to the size of the record in one step, rather than
+	// growing it through the feature table and again for the sequence.
+	// The writer reserves room to escape every base, and the other
+	// entries are assumed to be no longer than the bases.
+	size_t length = std::min(locusLength(&back), cursor->remaining());
+	if (context->output && length)
+	{
+		context->output->Reserve(7 * length + 2);
+	}
+
+	cursor->getline(line);
+}
+
+/**
+ * Parse a GenBank KEYWORD entry.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseKeyword(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context,
+	int level // 0 for Keywords, 1 for Subkeywords, 2 for Subsubkeywords
+)
+{
+	std::string_view front, back;
+	splitLine(line, &front, &back);
+
+	// Copy content into buffer and trim whitespace
+	bool whitespace = endsWithSpace(&back);
+	stringTrimRight(&back);
+	std::string &buffer = context->buffer; // Written out before the subkeywords reuse it
+	buffer.assign(back);
+	if (whitespace)
+	{
+		buffer.append(" ");
+	}
+	stringTrim(&front);
+
+	writer->Key(front.data(), front.length(), true);
+	writer->StartArray(); // Top level array
+
+	// Read the next line
+	cursor->getline(line);
+
+	// Push continuation lines into buffer
+	while (isContinuation(line))
+	{
+		splitLine(line, &front, &back);
+		whitespace = endsWithSpace(&back);
+		stringTrimRight(&back);
+		buffer.append("\n");
+		buffer.append(back);
+		if (whitespace)
+		{
+			buffer.append(" ");
+		}
+		cursor->getline(line);
+	}
+
+	// Write buffer to JSON
+	writer->String(buffer.c_str(), buffer.length(), true);
+
+	// Parse Sub keywords
+	writer->StartArray();
+	if (level < 2)
+	{ // Genbank allows 3 levels for keywords
+		while (isItemLevel[level + 1](line))
+		{
+			writer->StartObject();
+			parseKeyword(cursor, line, writer, context, level + 1);
+			writer->EndObject();
+		}
+	}
+	writer->EndArray(); // Sub keywords
+	writer->EndArray(); // Top level array
+}
+
+// INSDC qualifier names in byte order, for writing names as static strings
+static const std::string_view qualifierNames[] = {
+	"EC_number", "PCR_conditions", "PCR_primers", "allele", "altitude", "anticodon",
+	"artificial_location", "bio_material", "bound_moiety", "cell_line", "cell_type", "chromosome",
+	"circular_RNA", "citation", "clone", "clone_lib", "codon_start", "collected_by",
+	"collection_date", "compare", "country", "cultivar", "culture_collection", "db_xref", "dev_stage",
+	"direction", "ecotype", "environmental_sample", "estimated_length", "exception", "experiment",
+	"focus", "frequency", "function", "gap_type", "gene", "gene_synonym", "geo_loc_name", "germline",
+	"haplogroup", "haplotype", "host", "identified_by", "inference", "isolate", "isolation_source",
+	"lab_host", "lat_lon", "linkage_evidence", "locus_tag", "macronuclear", "map", "mating_type",
+	"metagenome_source", "mobile_element_type", "mod_base", "mol_type", "ncRNA_class", "note",
+	"number", "old_locus_tag", "operon", "organelle", "organism", "partial", "phenotype", "plasmid",
+	"pop_variant", "product", "protein_id", "proviral", "pseudo", "pseudogene", "rearranged",
+	"recombination_class", "regulatory_class", "replace", "ribosomal_slippage", "rpt_family",
+	"rpt_type", "rpt_unit_range", "rpt_unit_seq", "satellite", "segment", "serotype", "serovar",
+	"sex", "specimen_voucher", "standard_name", "strain", "sub_clone", "sub_species", "sub_strain",
+	"submitter_seqid", "tag_peptide", "tissue_lib", "tissue_type", "trans_splicing", "transgenic",
+	"transl_except", "transl_table", "translation", "type_material", "variety"};
+
+/**
+ * Write a qualifier name. Known names are written from the static table
+ * above without copying, so handlers that keep strings need not copy them.
+ * @param[in] name The name.
+ * @param[in] len The name length.
+ * @param[in] writer The JSON writer object.
+ */
+template <typename Writer>
+static inline void writeQualifierName(const char *name, size_t len, Writer *writer)
+{
+	std::string_view key(name, len);
+	const std::string_view *end = qualifierNames + sizeof(qualifierNames) / sizeof(qualifierNames[0]);
+	const std::string_view *known = std::lower_bound(qualifierNames, end, key);
+
+	if (known != end && *known == key)
+	{
+		writer->Key(known->data(), known->length(), false);
+	}
+	else
+	{
+		writer->Key(name, len, true);
+	}
+}
+
+/**
+ * Parse a GenBank qualifier entry.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in,out] current The qualifier line, then the line after the qualifier.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseQualifier(
+	LineCursor *cursor,
+	std::string_view *line,
+	FeatureLine *current,
+	Writer *writer,
+	ParseContext *context)
+{
+	// Trim whitespace, keeping one trailing space
+	std::string_view back(current->text);
+	bool whitespace = endsWithSpace(&back);
+	stringTrimRight(&back);
+	std::string_view text(back.data(), back.length() + whitespace);
+	bool inInput = !whitespace || back.data()[back.length()] == ' ';
+
+	nextFeatureLine(cursor, line, current);
+
+	// A qualifier on one line is written from the input. Push one with
+	// continuation lines into the buffer.
+	if (!inInput || current->kind == CONTINUATION_LINE)
+	{
+		std::string &buffer = context->buffer;
+		buffer.assign(text.data(), text.length() - whitespace);
+		if (whitespace)
+		{
+			buffer.append(" ");
+		}
+		buffer.append("\n");
+
+		while (current->kind == CONTINUATION_LINE)
+		{
+			back = current->text;
+			whitespace = endsWithSpace(&back);
+			stringTrimRight(&back);
+			if (whitespace)
+			{
+				buffer.append(" ");
+			}
+
+			buffer.append(back);
+			buffer.append("\n");
+			nextFeatureLine(cursor, line, current);
+		}
+
+		// Drop last newline
+		buffer.pop_back();
+		text = buffer;
+	}
+
+	// Find the qualifier delimiter if it exists
+	size_t equalSignPos = text.find('=');
+
+	// Write out the qualifier
+	writer->StartObject(); // Qualifier start
+
+	if (equalSignPos == std::string::npos || equalSignPos == text.length() - 1)
+	{
+		// No qualifier value
+		writeQualifierName(text.data() + 1, text.length() - 1, writer);
+		writer->Null();
+	}
+	else
+	{
+		// Key value pair
+		writeQualifierName(text.data() + 1, equalSignPos - 1, writer);
+		writer->String(text.data() + equalSignPos + 1, text.length() - equalSignPos - 1, true);
+	}
+
+	writer->EndObject(); // Qualifier end
+}
+
+/**
+ * Parse a GenBank feature entry.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in,out] current The feature line, then the line after the feature.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseFeature(
+	LineCursor *cursor,
+	std::string_view *line,
+	FeatureLine *current,
+	Writer *writer,
+	ParseContext *context)
+{
+	writer->StartObject(); // Feature start
+	writer->Key(current->key.data(), current->key.length(), true);
+
+	writer->StartArray();  // Qualifier array
+	writer->StartObject(); // Location start
+	writer->Key("Location");
+
+	std::string_view text(current->text);
+	stringTrimRight(&text);
+	nextFeatureLine(cursor, line, current);
+
+	// A location on one line is written from the input. Push one with
+	// continuation lines into the buffer.
+	if (current->kind == CONTINUATION_LINE)
+	{
+		std::string &buffer = context->buffer; // Written out before the qualifiers reuse it
+		buffer.assign(text);
+
+		while (current->kind == CONTINUATION_LINE)
+		{
+			std::string_view back(current->text);
+			bool whitespace = endsWithSpace(&back);
+			stringTrimRight(&back);
+			buffer.append(back);
+			if (whitespace)
+			{
+				buffer.append(" ");
+			}
+			nextFeatureLine(cursor, line, current);
+		}
+		text = buffer;
+	}
+
+	// Write location
+	writer->String(text.data(), text.length(), true);
+	writer->EndObject(); // Location end
+
+	if (context->parseLocations && parseLocation(&text, &context->location))
+	{
+		writeParsedLocation(&context->location, writer);
+	}
+
+	// Parse qualifiers
+	while (current->kind == QUALIFIER_LINE)
+	{
+		std::string_view name(qualifierName(&current->text));
+		if (!context->projection || context->projection->qualifiers.keep(&name))
+		{
+			parseQualifier(cursor, line, current, writer, context);
+			context->counts->qualifiers++;
+		}
+		else
+		{
+			skipQualifier(cursor, line, current);
+		}
+	}
+
+	writer->EndArray();  // Qualifier array
+	writer->EndObject(); // Feature end
+}
+
+/**
+ * Parse the features of a feature table up to the first line that is not
+ * part of a feature.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in,out] current The first feature line, then the line after the features.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseFeatureList(
+	LineCursor *cursor,
+	std::string_view *line,
+	FeatureLine *current,
+	Writer *writer,
+	ParseContext *context)
+{
+	while (current->kind == FEATURE_LINE)
+	{
+		if (context->projection && !context->projection->features.keep(&current->key))
+		{
+			skipFeature(cursor, line, current);
+			continue;
+		}
+
+		parseFeature(cursor, line, current, writer, context);
+		context->counts->features++;
+	}
+}
+
+/**
+ * Parse a GenBank feature table. Each line is classified once, and the
+ * classified line is passed on to the feature and qualifier parsers.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseFeatures(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	writer->Key("FEATURES");
+
+	FeatureLine current;
+	nextFeatureLine(cursor, line, &current);
+
+	writer->StartArray(); // Features array
+	parseFeatureList(cursor, line, &current, writer, context);
+	writer->EndArray(); // Features array
+}
+
+/**
+ * Parse a GenBank origin entry.
+ * @param[in] line The ORIGIN line.
+ * @param[in] writer The JSON writer object.
+ */
+template <typename Writer>
+static void parseOrigin(
+	std::string_view *line,
+	Writer *writer)
+{
+	std::string_view back(subview(line, 6, 79 - 6));
+	stringTrimRight(&back);
+
+	writer->Key("ORIGIN");
+	writer->StartArray();
+	if (back.empty())
+	{ // No value
+		writer->Null();
+	}
+	else
+	{ // Entry
+		writer->String(back.data(), back.length(), true);
+	}
+	writer->StartArray(); // Dummy array for sub keywords
+	writer->EndArray();   // Dummy array for sub keywords
+	writer->EndArray();
+}
+
+/**
+ * Parse a GenBank sequence entry.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseSequence(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	std::string_view front, back;
+	std::string &buffer = context->buffer;
+	buffer.clear();
+	cursor->getline(line);
+
+	if (isContig(line))
+	{
+		// Copy content into buffer and trim whitespace
+		splitLine(line, &front, &back);
+		bool whitespace = endsWithSpace(&back);
+		stringTrimRight(&back);
+		buffer.append(back);
+
+		if (whitespace)
+		{
+			buffer.append(" ");
+		}
+
+		// Consume contig lines
+		cursor->getline(line);
+		while (isContinuation(line))
+		{
+
+			splitLine(line, &front, &back);
+			whitespace = endsWithSpace(&back);
+			stringTrimRight(&back);
+			buffer.append("\n");
+			buffer.append(back);
+			if (whitespace)
+			{
+				buffer.append(" ");
+			}
+			cursor->getline(line);
 		}
 
 		// Write the data
@@ -693,610 +3513,4929 @@ static void parseSequence(
 		writer->StartArray();
 		if (buffer.empty())
 		{
-			writer->Null();
+			writer->Null();
+		}
+		else
+		{
+			writer->String(buffer.c_str(), buffer.length(), true);
+		}
+		writer->StartArray(); // Dummy array for sub keywords
+		writer->EndArray();   // Dummy array for sub keywords
+		writer->EndArray();
+	}
+	else if (isSequence(line))
+	{
+		// Find the extent of the sequence block
+		const char *blockStart = line->data();
+		const char *blockEnd = blockStart;
+
+		while (isSequence(line))
+		{
+			blockEnd = line->data() + line->length();
+			cursor->getline(line);
+		}
+
+		// Compact the bases into a buffer that can hold the whole block
+		buffer.resize(blockEnd - blockStart + simdSlack);
+		size_t nbases = 0;
+
+		LineCursor block(blockStart, blockEnd - blockStart, cursor);
+		std::string_view blockLine;
+		block.getline(&blockLine);
+
+		while (!block.eof())
+		{
+			splitSequenceLine(&blockLine, &front, &back);
+			nbases += copyWithoutSpaces(back.data(), back.length(), &buffer[nbases]);
+			block.getline(&blockLine);
+		}
+
+		buffer.resize(nbases);
+		context->counts->bases += nbases;
+
+		// Write the data
+		writer->Key("SEQUENCE");
+		writer->StartArray();
+		if (buffer.empty())
+		{
+			writer->Null();
+		}
+		else if (context->sequences)
+		{
+			// Move the bases to the sidecar and refer to them
+			size_t size = nbases;
+			if (context->packSequences)
+			{
+				size = packSequence(buffer.data(), nbases, context->sequences);
+			}
+			else
+			{
+				context->sequences->append(buffer.data(), nbases);
+			}
+			context->sequences->maybeFlush();
+
+			writer->StartObject();
+			writer->Key("offset");
+			writer->Uint64(context->sequenceOffset);
+			if (context->packSequences)
+			{
+				writer->Key("size");
+				writer->Uint64(size);
+				writer->Key("encoding");
+				writer->String("2bit");
+			}
+			writer->Key("length");
+			writer->Uint64(nbases);
+			writer->Key("crc32");
+			writer->Uint(crc32Of(buffer.data(), nbases));
+			writer->EndObject();
+
+			context->sequenceOffset += size;
+		}
+		else
+		{
+			writer->String(buffer.c_str(), buffer.length(), true);
+		}
+		writer->StartArray(); // Dummy array for sub keywords
+		writer->EndArray();   // Dummy array for sub keywords
+		writer->EndArray();
+	}
+}
+
+/***************************************************************
+ * Feature table splitting
+ ******************
+ * The feature table of a large record is cut at feature lines
+ * into chunks that are parsed on several threads, each by a
+ * writer of its own. The sequence block is converted alongside.
+ * The rendered JSON is spliced into the output in input order.
+ ***************************************************************/
+
+static const size_t splitFeatureTable = 1 << 20; // Shortest feature table split across threads
+static const size_t featureChunk = 1 << 16;		 // Smallest chunk of a split feature table
+static const int featureDepth = 4;				 // Nesting of features: top level array, record, FEATURES object and feature array
+static const int sequenceDepth = 3;				 // Nesting of the SEQUENCE value: top level array, record and SEQUENCE object
+
+class LinesWriter;
+
+// Writers whose rendered JSON can be spliced into their output
+template <typename Writer>
+static constexpr bool splicesJSON(Writer *) { return false; }
+static constexpr bool splicesJSON(rapidjson::Writer<rapidjson::StringBuffer> *) { return true; }
+static constexpr bool splicesJSON(rapidjson::PrettyWriter<rapidjson::StringBuffer> *) { return true; }
+static constexpr bool splicesJSON(LinesWriter *) { return true; }
+
+/**
+ * Splice JSON rendered by another writer into the output as one value.
+ * The writer writes the separator and indentation before it.
+ * @param[in] writer The JSON writer object.
+ * @param[in] text The rendered JSON, one or more values.
+ */
+template <typename Writer>
+static void spliceJSON(Writer *writer, std::string_view text)
+{
+	writer->RawValue(text.data(), text.size(), rapidjson::kArrayType);
+}
+
+/**
+ * Writer for rendering part of a record on a thread of its own. It
+ * opens stand-in arrays to the nesting of the part in the output, so
+ * that indentation is preserved.
+ */
+template <typename Writer>
+struct PartWriter
+{
+	rapidjson::StringBuffer *buffer; ///< The rendered JSON.
+	Writer writer;					 ///< The writer.
+	size_t start;					 ///< Start of the part in the buffer.
+
+	PartWriter(rapidjson::StringBuffer *buffer, int depth) : buffer(buffer), writer(*buffer)
+	{
+		for (int i = 0; i < depth; i++)
+		{
+			writer.StartArray();
+		}
+		start = buffer->GetSize();
+	}
+
+	// The part from its first value, without the separator and indentation before it
+	std::string_view text(char first) const
+	{
+		std::string_view part(buffer->GetString() + start, buffer->GetSize() - start);
+		part.remove_prefix(std::min(part.find(first), part.size()));
+		return part;
+	}
+};
+
+/**
+ * Parse a large feature table on several threads, and render the sequence
+ * block of the record alongside for parseItem to splice when it reaches
+ * ORIGIN. Small tables are left to parseFeatures.
+ * @param[in] cursor The input line cursor, at the FEATURES line.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ * @return False if the table was not parsed.
+ */
+template <typename Writer>
+static bool parseFeaturesSplit(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	// Find the feature lines and the end of the table
+	LineCursor ahead(*cursor);
+	std::string_view aheadLine;
+	FeatureLine current;
+	std::vector<const char *> starts;
+
+	nextFeatureLine(&ahead, &aheadLine, &current);
+	const char *tableStart = aheadLine.data();
+	while (!ahead.eof() && current.kind != OTHER_LINE)
+	{
+		if (current.kind == FEATURE_LINE)
+		{
+			starts.push_back(aheadLine.data());
+		}
+		nextFeatureLine(&ahead, &aheadLine, &current);
+	}
+	const char *tableEnd = ahead.eof() ? ahead.position() : aheadLine.data();
+
+	if (starts.empty() || starts[0] != tableStart || size_t(tableEnd - tableStart) < splitFeatureTable)
+	{
+		return false;
+	}
+
+	// Cut the table at feature lines into chunks of similar size
+	size_t target = std::max<size_t>((tableEnd - tableStart) / (context->splitThreads * 4), featureChunk);
+	std::vector<std::string_view> chunks;
+	const char *chunkStart = tableStart;
+	for (const char *start : starts)
+	{
+		if (size_t(start - chunkStart) >= target)
+		{
+			chunks.emplace_back(chunkStart, start - chunkStart);
+			chunkStart = start;
+		}
+	}
+	chunks.emplace_back(chunkStart, tableEnd - chunkStart);
+
+	// Find the sequence block after the table. The sidecar takes sequences in order.
+	const char *block = nullptr;
+	LineCursor next(ahead);
+	for (std::string_view l(aheadLine); !next.eof() && !isEnd(&l) && !isLocus(&l); next.getline(&l))
+	{
+		if (isOrigin(&l))
+		{
+			bool kept = !context->projection || keepItem(&l, context->projection);
+			next.getline(&l);
+			block = kept && !context->sequences && isSequence(&l) ? l.data() : nullptr;
+			break;
+		}
+	}
+	const char *end = cursor->position() + cursor->remaining();
+
+	// Parse the chunks, and convert the sequence as one more task
+	size_t tasks = chunks.size() + (block != nullptr);
+	std::vector<rapidjson::StringBuffer> buffers(tasks);
+	std::vector<std::string_view> parts(tasks);
+	std::vector<gbstats> counts(tasks);
+	const char *sequenceEnd = end;
+
+	parallelFor(tasks, context->splitThreads, [&](size_t i) {
+		ParseContext local(&counts[i], context);
+
+		if (i < chunks.size())
+		{
+			// The JSON of features is about 1.5 times as long as their text
+			buffers[i].Reserve(2 * chunks[i].size());
+			PartWriter<Writer> part(&buffers[i], featureDepth);
+			LineCursor chunk(chunks[i].data(), chunks[i].size(), cursor);
+			std::string_view chunkLine;
+			FeatureLine chunkCurrent;
+			nextFeatureLine(&chunk, &chunkLine, &chunkCurrent);
+			parseFeatureList(&chunk, &chunkLine, &chunkCurrent, &part.writer, &local);
+			parts[i] = part.text('{');
+		}
+		else
+		{
+			PartWriter<Writer> part(&buffers[i], sequenceDepth - 1);
+			part.writer.StartObject();
+			LineCursor sequence(block, end - block, cursor);
+			std::string_view sequenceLine;
+			parseSequence(&sequence, &sequenceLine, &part.writer, &local);
+			parts[i] = part.text('[');
+			sequenceEnd = sequence.eof() ? end : sequenceLine.data();
+		}
+	});
+
+	for (auto &c : counts)
+	{
+		context->counts->add(&c);
+	}
+
+	// Splice the features, and keep the sequence for parseItem
+	if (context->output)
+	{
+		size_t size = 0;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			size += parts[i].size() + 2 + 4 * featureDepth; // With the separator and indentation
+		}
+		context->output->Reserve(size + (block ? parts.back().size() : 0));
+	}
+
+	writer->Key("FEATURES");
+	writer->StartArray(); // Features array
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!parts[i].empty())
+		{
+			spliceJSON(writer, parts[i]);
+		}
+	}
+	writer->EndArray(); // Features array
+
+	context->splicedBlock = block;
+	context->splicedEnd = sequenceEnd;
+	if (block)
+	{
+		context->splicedSequence.assign(parts.back());
+	}
+
+	*cursor = ahead;
+	*line = aheadLine;
+	return true;
+}
+
+/**
+ * Parse a feature table on several threads if it is large and the writer
+ * can splice, as set by gboptions::splitFeatures.
+ * @param[in] cursor The input line cursor, at the FEATURES line.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ * @return False if the table is left to parseFeatures.
+ */
+template <typename Writer>
+static bool splitFeatures(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	if constexpr (splicesJSON((Writer *)nullptr))
+	{
+		return context->splitThreads > 1 && parseFeaturesSplit(cursor, line, writer, context);
+	}
+	return false;
+}
+
+/**
+ * Write the SEQUENCE entry rendered by parseFeaturesSplit, if it is of the
+ * block at the cursor, and move the cursor past the block.
+ * @param[in] cursor The input line cursor, at the ORIGIN line.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ * @return False if the sequence is left to parseSequence.
+ */
+template <typename Writer>
+static bool spliceSequence(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+	if constexpr (splicesJSON((Writer *)nullptr))
+	{
+		if (context->splicedBlock && context->splicedBlock == cursor->position())
+		{
+			writer->Key("SEQUENCE");
+			spliceJSON(writer, context->splicedSequence);
+			context->splicedBlock = nullptr;
+
+			cursor->seek(context->splicedEnd);
+			cursor->getline(line);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Delegator function for parsing GenBank items.
+ * @param[in] cursor The input line cursor.
+ * @param[out] line The line buffer.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseItem(
+	LineCursor *cursor,
+	std::string_view *line,
+	Writer *writer,
+	ParseContext *context)
+{
+
+	if (isLocus(line) && context->selection && !selectRecord(cursor, line, context->selection))
+	{
+		skipRecord(cursor, line);
+	}
+	else if (isLocus(line))
+	{
+		context->counts->records++;
+		writer->StartArray(); // Start the GenBank array
+
+		writer->StartObject();
+		parseLocus(cursor, line, writer, context);
+		writer->EndObject();
+	}
+	else if (isEnd(line))
+	{
+		writer->EndArray(); // Start the GenBank array
+		cursor->getline(line);
+	}
+	else if (context->projection && (isOrigin(line) || isKeyword(line)) && !keepItem(line, context->projection))
+	{
+		skipItem(cursor, line);
+	}
+	else if (isOrigin(line))
+	{
+		writer->StartObject();
+		parseOrigin(line, writer);
+		writer->EndObject();
+
+		writer->StartObject();
+		if (!spliceSequence(cursor, line, writer, context))
+		{
+			parseSequence(cursor, line, writer, context);
+		}
+		writer->EndObject();
+	}
+	else if (isKeyword(line) && !isFeatureHeader(line))
+	{
+		writer->StartObject();
+		parseKeyword(cursor, line, writer, context, 0);
+		writer->EndObject();
+	}
+	else if (isFeatureHeader(line))
+	{
+		writer->StartObject();
+		if (!splitFeatures(cursor, line, writer, context))
+		{
+			parseFeatures(cursor, line, writer, context);
+		}
+		writer->EndObject();
+	}
+	else
+	{
+		cursor->getline(line);
+	}
+}
+
+/***************************************************************
+* GenBank to JSON converter
+***************************************************************/
+
+/**
+ * GenBank to JSON converter.
+ * @param[in] gb The GenBank string.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const std::string *gb, std::string *json, gberror *err, const gboptions *opts)
+{
+	gb2json(gb->data(), gb->size(), json, err, opts);
+}
+
+/**
+ * GenBank to JSON converter returning the JSON string.
+ * @param[in] gb The GenBank string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The JSON string, empty on error.
+ */
+std::string gb2json(const std::string *gb, gberror *err, const gboptions *opts)
+{
+	std::string json;
+	gb2json(gb->data(), gb->size(), &json, err, opts);
+	return json;
+}
+
+/**
+ * Parse all GenBank items in a buffer.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] writer The JSON writer object.
+ * @param[in,out] context The parse context.
+ */
+template <typename Writer>
+static void parseBuffer(
+	const char *gb,
+	size_t len,
+	Writer *writer,
+	ParseContext *context)
+{
+	// Initialize the line cursor
+	LineCursor cursor(gb, len);
+	std::string_view line;
+
+	// Start the parsing
+	cursor.getline(&line);
+
+	while (!cursor.eof())
+	{
+		parseItem(&cursor, &line, writer, context);
+	}
+}
+
+/**
+ * Split a GenBank buffer into chunks of whole records.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] target Minimum chunk size, except for the last chunk.
+ * @param[out] chunks The chunks.
+ */
+static void splitRecords(const char *gb, size_t len, size_t target, std::vector<std::string_view> *chunks)
+{
+	size_t start = 0, pos = 0;
+
+	while (scanRecordEnd(gb, len, &pos, true))
+	{
+		if (pos - start >= target)
+		{
+			chunks->emplace_back(gb + start, pos - start);
+			start = pos;
+		}
+	}
+
+	if (start < len)
+	{
+		chunks->emplace_back(gb + start, len - start);
+	}
+}
+
+/**
+ * JSON Lines writer. The top level array is dropped and every value in
+ * it is written compact on a line of its own, so each record is a JSON
+ * document that can be read without reading the others.
+ */
+class LinesWriter
+{
+public:
+	LinesWriter(rapidjson::StringBuffer &os) : os(&os), writer(os), depth(0) {}
+
+	bool Null() { return value() && done(writer.Null()); }
+	bool Bool(bool b) { return value() && done(writer.Bool(b)); }
+	bool Uint(unsigned u) { return value() && done(writer.Uint(u)); }
+	bool Uint64(uint64_t u) { return value() && done(writer.Uint64(u)); }
+	bool String(const char *str, rapidjson::SizeType length, bool copy = false) { return value() && done(writer.String(str, length, copy)); }
+	bool String(const char *str) { return String(str, static_cast<rapidjson::SizeType>(strlen(str))); }
+	bool Key(const char *str, rapidjson::SizeType length, bool copy = false) { return writer.Key(str, length, copy); }
+	bool Key(const char *str) { return Key(str, static_cast<rapidjson::SizeType>(strlen(str))); }
+	bool RawValue(const char *json, size_t length, rapidjson::Type type) { return value() && done(writer.RawValue(json, length, type)); }
+
+	bool StartObject() { return depth++ == 0 || writer.StartObject(); }
+	bool StartArray() { return depth++ == 0 || writer.StartArray(); }
+	bool EndObject(rapidjson::SizeType = 0) { return --depth == 0 || done(writer.EndObject()); }
+	bool EndArray(rapidjson::SizeType = 0) { return --depth == 0 || done(writer.EndArray()); }
+
+	void Reset(rapidjson::StringBuffer &os)
+	{
+		this->os = &os;
+		writer.Reset(os);
+		depth = 0;
+	}
+	bool IsComplete() const { return depth == 0; }
+
+private:
+	rapidjson::StringBuffer *os;
+	rapidjson::Writer<rapidjson::StringBuffer> writer;
+	int depth; // Nesting depth including the dropped top level array
+
+	// Values outside the top level array are not expected
+	bool value() const { return depth > 0; }
+
+	// End the line after a complete top level value
+	bool done(bool ok)
+	{
+		if (depth == 1)
+		{
+			os->Put('\n');
+			writer.Reset(*os);
+		}
+		return ok;
+	}
+};
+
+// Framing of a non-empty top level array
+static inline const char *arrayOpen(rapidjson::Writer<rapidjson::StringBuffer> *) { return "["; }
+static inline const char *arrayOpen(rapidjson::PrettyWriter<rapidjson::StringBuffer> *) { return "["; }
+static inline const char *arrayOpen(LinesWriter *) { return ""; }
+static inline const char *arraySeparator(rapidjson::Writer<rapidjson::StringBuffer> *) { return ","; }
+static inline const char *arraySeparator(rapidjson::PrettyWriter<rapidjson::StringBuffer> *) { return ","; }
+static inline const char *arraySeparator(LinesWriter *) { return ""; }
+static inline const char *arrayClose(rapidjson::Writer<rapidjson::StringBuffer> *) { return "]"; }
+static inline const char *arrayClose(rapidjson::PrettyWriter<rapidjson::StringBuffer> *) { return "\n]"; }
+static inline const char *arrayClose(LinesWriter *) { return ""; }
+
+// Empty top level array, or nothing for JSON Lines
+template <typename Writer>
+static inline const char *arrayEmpty(Writer *writer) { return *arrayOpen(writer) ? "[]" : ""; }
+
+/**
+ * Buffers of a thread converting chunks. They are reset rather than freed
+ * between chunks, so the JSON buffer, the writer stack and the text buffer
+ * of the parse functions are allocated once per thread, not per chunk,
+ * and the threads do not contend on the allocator.
+ */
+template <typename Writer>
+struct ChunkBuffers
+{
+	rapidjson::StringBuffer buffer; ///< JSON of the chunk.
+	Writer writer;					///< Writer on the buffer.
+	std::string text;				///< Text buffer of the parse functions.
+	ChunkBuffers() : writer(buffer) {}
+};
+
+/**
+ * Convert a chunk of records to a JSON fragment. The fragment holds the
+ * records as they appear inside the top level array, so fragments joined
+ * by commas are identical to the output of a single writer.
+ * @param[in] chunk The GenBank chunk.
+ * @param[out] fragment The JSON fragment.
+ * @param[in,out] counts The counters.
+ * @param[in] opts Conversion options.
+ * @param[in,out] buffers The buffers of the converting thread.
+ * @return False if the chunk is incomplete.
+ */
+template <typename Writer>
+static bool convertChunk(std::string_view chunk, std::string *fragment, gbstats *counts, const gboptions *opts, ChunkBuffers<Writer> *buffers)
+{
+	rapidjson::StringBuffer &buffer = buffers->buffer;
+	Writer &writer = buffers->writer;
+	buffer.Clear();
+	buffer.Reserve(2 * chunk.size()); // Grows once, on the first chunk of the thread
+	writer.Reset(buffer);
+
+	ParseContext context(counts, opts);
+	context.buffer.swap(buffers->text);
+	context.output = &buffer;
+
+	writer.StartArray(); // Stands in for the top level array
+	parseBuffer(chunk.data(), chunk.size(), &writer, &context);
+	writer.EndArray();
+	context.buffer.swap(buffers->text);
+
+	// Strip the brackets of the stand-in array
+	size_t openLen = strlen(arrayOpen(&writer));
+	size_t closeLen = strlen(arrayClose(&writer));
+	if (buffer.GetSize() > strlen(arrayEmpty(&writer)))
+	{
+		fragment->assign(buffer.GetString() + openLen, buffer.GetSize() - openLen - closeLen);
+	}
+
+	return writer.IsComplete();
+}
+
+static const size_t parallelChunk = 1 << 16; // Smallest chunk of a parallel conversion
+
+/**
+ * Convert chunks of records to JSON fragments in parallel.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] fragments The fragments in input order.
+ * @param[out] err Error object.
+ * @param[in] threads Number of threads.
+ * @param[in] opts Conversion options.
+ * @return False on error.
+ */
+template <typename Writer>
+static bool convertChunks(const char *gb, size_t len, std::vector<std::string> *fragments, gberror *err, int threads, const gboptions *opts)
+{
+	gbstats *stats = opts->stats;
+
+	// Several chunks per thread balance the load
+	size_t target = std::max(len / (threads * 8), parallelChunk);
+
+	std::vector<std::string_view> chunks;
+	{
+		PhaseTimer timer(PHASE(stats, scanTime));
+		splitRecords(gb, len, target, &chunks);
+	}
+
+	PhaseTimer timer(PHASE(stats, parseTime));
+
+	fragments->assign(chunks.size(), std::string());
+	std::vector<char> complete(chunks.size());
+	std::vector<gbstats> counts(chunks.size());
+	std::vector<ChunkBuffers<Writer>> buffers(std::min((size_t)threads, chunks.size()));
+
+	parallelForWorkers(chunks.size(), threads, [&](int worker, size_t i) {
+		complete[i] = convertChunk<Writer>(chunks[i], &(*fragments)[i], &counts[i], opts, &buffers[worker]);
+	});
+
+	if (stats)
+	{
+		for (auto &c : counts)
+		{
+			stats->add(&c);
+		}
+	}
+
+	if (std::find(complete.begin(), complete.end(), false) != complete.end())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2json";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stitch JSON fragments into the top level array.
+ * @param[in] fragments The fragments, as strings or string views.
+ * @param[in] emit Function taking each piece of the output and its length.
+ */
+template <typename Writer, typename Fragments, typename Output>
+static void joinFragments(const Fragments *fragments, Output emit)
+{
+	const char *open = arrayOpen((Writer *)nullptr);
+	const char *separator = arraySeparator((Writer *)nullptr);
+	const char *close = arrayClose((Writer *)nullptr);
+
+	bool empty = true;
+	for (auto &f : *fragments)
+	{
+		if (f.empty())
+		{
+			continue;
+		}
+
+		if (empty)
+		{
+			emit(open, strlen(open));
+		}
+		else
+		{
+			emit(separator, strlen(separator));
+		}
+		emit(f.data(), f.length());
+		empty = false;
+	}
+
+	if (empty)
+	{
+		const char *none = arrayEmpty((Writer *)nullptr);
+		emit(none, strlen(none));
+	}
+	else
+	{
+		emit(close, strlen(close));
+	}
+}
+
+/**
+ * Record-parallel GenBank to JSON converter.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] threads Number of threads.
+ * @param[in] opts Conversion options.
+ */
+template <typename Writer>
+static void gb2jsonParallel(const char *gb, size_t len, std::string *json, gberror *err, int threads, const gboptions *opts)
+{
+	std::vector<std::string> fragments;
+	if (!convertChunks<Writer>(gb, len, &fragments, err, threads, opts))
+	{
+		return;
+	}
+
+	size_t outLen = 4;
+	for (auto &f : fragments)
+	{
+		outLen += f.length() + 1;
+	}
+
+	json->clear();
+	json->reserve(outLen);
+	joinFragments<Writer>(&fragments, [json](const char *str, size_t n) { json->append(str, n); });
+}
+
+/**
+ * Set up writing sequences to the sidecar file of the options, if any.
+ * Offsets count from the current position of the file.
+ * @param[out] context The parse context.
+ * @param[out] sink The sidecar sink.
+ * @param[in] opts Conversion options.
+ */
+static void startSequences(ParseContext *context, OutputSink *sink, const gboptions *opts)
+{
+	if (opts->sequences)
+	{
+		sink->file = opts->sequences;
+		context->sequences = sink;
+		context->sequenceOffset = tellFile(opts->sequences);
+		context->packSequences = opts->packSequences;
+	}
+}
+
+/**
+ * Single-threaded GenBank to JSON converter with the buffers of the caller.
+ * The buffers are reset, not freed, so a caller can keep them across calls.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options.
+ * @param[in,out] buffer The JSON buffer.
+ * @param[in,out] writer The JSON writer on the buffer.
+ * @param[in,out] text The text buffer of the parse functions.
+ */
+template <typename Writer>
+static void gb2jsonSerial(
+	const char *gb,
+	size_t len,
+	std::string *json,
+	gberror *err,
+	const gboptions *opts,
+	rapidjson::StringBuffer *buffer,
+	Writer *writer,
+	std::string *text)
+{
+	gbstats *stats = opts->stats;
+	PhaseTimer timer(PHASE(stats, parseTime));
+	gbstats counts;
+
+	ParseContext context(&counts, opts);
+	context.buffer.swap(*text);
+	OutputSink sequences;
+	startSequences(&context, &sequences, opts);
+
+	// Reset the writer. The JSON is up to about twice as long as the
+	// GenBank text, so the buffer is taken to that size in one step rather
+	// than grown and copied again and again. A kept buffer is large enough.
+	buffer->Clear();
+	buffer->Reserve(len / 4 * 9);
+	writer->Reset(*buffer);
+	context.output = buffer;
+
+	writer->StartArray();
+	parseBuffer(gb, len, writer, &context);
+	sequences.close();
+	context.buffer.swap(*text);
+
+	if (stats)
+	{
+		stats->add(&counts);
+	}
+
+	// Close the JSON array and write to string
+	writer->EndArray();
+
+	if (!writer->IsComplete())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2json";
+	}
+	else if (sequences.failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing sequences";
+		err->source = "gb2json";
+	}
+	else
+	{
+		json->assign(buffer->GetString(), buffer->GetSize());
+	}
+}
+
+/**
+ * Single-threaded GenBank to JSON converter.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options.
+ */
+template <typename Writer>
+static void gb2jsonSerial(const char *gb, size_t len, std::string *json, gberror *err, const gboptions *opts)
+{
+	rapidjson::StringBuffer buffer;
+	Writer writer(buffer);
+	std::string text;
+	gb2jsonSerial(gb, len, json, err, opts, &buffer, &writer, &text);
+}
+
+/**
+ * Number of threads for converting a buffer.
+ * @param[in] len The buffer length.
+ * @param[in] opts Conversion options.
+ * @return 1 for a serial conversion.
+ */
+static int conversionThreads(size_t len, const gboptions *opts)
+{
+	if (opts->sequences)
+	{
+		return 1; // Sidecar offsets follow the record order
+	}
+	if (len <= 2 * parallelChunk)
+	{
+		return 1; // Too small to split
+	}
+	return opts->threads > 0 ? opts->threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * GenBank to JSON converter for a character buffer, e.g. a mapped file.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const char *gb, size_t len, std::string *json, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+
+	int threads = conversionThreads(len, opts);
+	gbstats *stats = opts->stats;
+
+	if (threads > 1 && opts->ndjson)
+	{
+		gb2jsonParallel<LinesWriter>(gb, len, json, err, threads, opts);
+	}
+	else if (threads > 1 && opts->compact)
+	{
+		gb2jsonParallel<rapidjson::Writer<rapidjson::StringBuffer>>(gb, len, json, err, threads, opts);
+	}
+	else if (threads > 1)
+	{
+		gb2jsonParallel<rapidjson::PrettyWriter<rapidjson::StringBuffer>>(gb, len, json, err, threads, opts);
+	}
+	else if (opts->ndjson)
+	{
+		gb2jsonSerial<LinesWriter>(gb, len, json, err, opts);
+	}
+	else if (opts->compact)
+	{
+		gb2jsonSerial<rapidjson::Writer<rapidjson::StringBuffer>>(gb, len, json, err, opts);
+	}
+	else
+	{
+		gb2jsonSerial<rapidjson::PrettyWriter<rapidjson::StringBuffer>>(gb, len, json, err, opts);
+	}
+
+	if (stats && !err->flag)
+	{
+		stats->bytesIn += len;
+		stats->bytesOut += json->size();
+	}
+}
+
+/**
+ * Writer that sends the events of the parse functions to a gbhandler.
+ * It supplies the member and element counts of closing events, which
+ * rapidjson writers do not need but handlers such as Document do.
+ */
+class EventWriter
+{
+public:
+	EventWriter(gbhandler *handler) : handler(handler), ok(true), started(false) {}
+
+	bool Null() { return value() && forward(handler->Null()); }
+	bool Bool(bool b) { return value() && forward(handler->Bool(b)); }
+	bool Uint(unsigned u) { return value() && forward(handler->Uint(u)); }
+	bool Uint64(uint64_t u) { return value() && forward(handler->Uint64(u)); }
+	bool String(const char *str, rapidjson::SizeType length, bool copy = false) { return value() && forward(handler->String(str, length, copy)); }
+	bool String(const char *str) { return String(str, static_cast<rapidjson::SizeType>(strlen(str)), false); } // Literals only
+
+	bool Key(const char *str, rapidjson::SizeType length, bool copy = false)
+	{
+		if (!ok)
+		{
+			return false;
+		}
+		frames.back().count++;
+		return forward(handler->Key(str, length, copy));
+	}
+	bool Key(const char *str) { return Key(str, static_cast<rapidjson::SizeType>(strlen(str)), false); } // Literals only
+
+	bool StartObject() { return start(true) && forward(handler->StartObject()); }
+	bool StartArray() { return start(false) && forward(handler->StartArray()); }
+	bool EndObject(rapidjson::SizeType = 0) { return ok && forward(handler->EndObject(end())); }
+	bool EndArray(rapidjson::SizeType = 0) { return ok && forward(handler->EndArray(end())); }
+
+	bool IsComplete() const { return ok && started && frames.empty(); }
+	bool stopped() const { return !ok; } ///< Did the handler stop the events?
+
+private:
+	struct Frame
+	{
+		rapidjson::SizeType count; ///< Members or elements so far.
+		bool object;			   ///< Object or array?
+	};
+
+	// Count a value in its array. Object members are counted by their keys.
+	bool value()
+	{
+		if (ok && !frames.empty() && !frames.back().object)
+		{
+			frames.back().count++;
+		}
+		return ok;
+	}
+
+	bool start(bool object)
+	{
+		if (!value())
+		{
+			return false;
+		}
+		frames.push_back({0, object});
+		started = true;
+		return true;
+	}
+
+	rapidjson::SizeType end()
+	{
+		rapidjson::SizeType count = frames.back().count;
+		frames.pop_back();
+		return count;
+	}
+
+	bool forward(bool result)
+	{
+		ok = result;
+		return ok;
+	}
+
+	gbhandler *handler;		   ///< The receiving handler.
+	std::vector<Frame> frames; ///< Open objects and arrays.
+	bool ok;				   ///< Has the handler accepted all events?
+	bool started;			   ///< Has the root value begun?
+};
+
+/**
+ * GenBank to JSON events. The records are parsed in order on the calling
+ * thread and their events sent to the handler, with no JSON text in between.
+ * @param[in] gb The GenBank string.
+ * @param[in] handler The event handler.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const std::string *gb, gbhandler *handler, gberror *err, const gboptions *opts)
+{
+	gb2json(gb->data(), gb->size(), handler, err, opts);
+}
+
+/**
+ * GenBank to JSON events for a character buffer, e.g. a mapped file.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] handler The event handler.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const char *gb, size_t len, gbhandler *handler, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+
+	gbstats *stats = opts->stats;
+	PhaseTimer timer(PHASE(stats, parseTime));
+	gbstats counts;
+
+	ParseContext context(&counts, opts);
+	OutputSink sequences;
+	startSequences(&context, &sequences, opts);
+
+	EventWriter writer(handler);
+	writer.StartArray();
+	parseBuffer(gb, len, &writer, &context);
+	writer.EndArray();
+	sequences.close();
+
+	if (stats)
+	{
+		counts.bytesIn = len;
+		stats->add(&counts);
+	}
+
+	if (writer.stopped())
+	{
+		err->flag = true;
+		err->msg = "Handler stopped the conversion";
+		err->source = "gb2json";
+	}
+	else if (!writer.IsComplete())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2json";
+	}
+	else if (sequences.failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing sequences";
+		err->source = "gb2json";
+	}
+}
+
+/***************************************************************
+* GenBank record model
+***************************************************************/
+
+/**
+ * Constructor.
+ * @param[in] blockSize Size of new blocks.
+ */
+Arena::Arena(size_t blockSize) : blockSize(blockSize), current(0), used(0) {}
+
+/**
+ * Copy a string into the arena.
+ * @param[in] str The string.
+ * @param[in] len The string length.
+ * @return View of the copy.
+ */
+std::string_view Arena::copy(const char *str, size_t len)
+{
+	// Use the first kept block with room, or add one
+	while (current < blocks.size() && blocks[current].size - used < len)
+	{
+		current++;
+		used = 0;
+	}
+	if (current == blocks.size())
+	{
+		size_t size = std::max(blockSize, len);
+		blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+	}
+
+	char *p = blocks[current].data.get() + used;
+	if (len)
+	{
+		memcpy(p, str, len);
+	}
+	used += len;
+	return std::string_view(p, len);
+}
+
+/**
+ * Drop all copies and keep the blocks.
+ */
+void Arena::clear()
+{
+	current = 0;
+	used = 0;
+}
+
+/**
+ * Total size of the blocks.
+ * @return Bytes allocated.
+ */
+size_t Arena::capacity() const
+{
+	size_t size = 0;
+	for (const Block &block : blocks)
+	{
+		size += block.size;
+	}
+	return size;
+}
+
+/**
+ * Empty the record and keep its memory.
+ */
+void GenBankRecord::clear()
+{
+	locus = std::string_view();
+	keywords.clear();
+	features.clear();
+	qualifiers.clear();
+	sequence = std::string_view();
+	arena.clear();
+}
+
+/**
+ * Writer that fills a GenBankRecord from the events of the parse
+ * functions. The events are placed by their nesting depth, which the
+ * JSON layout fixes: an item key at depth 2, keyword values one below
+ * their key and subkeywords three below, feature keys at depth 4 and
+ * their locations and qualifiers at depth 6. Text inside the input or
+ * passed without copy is viewed, other text copied into the record arena.
+ */
+class RecordWriter
+{
+public:
+	RecordWriter(const char *gb, size_t len, GenBankRecord *record)
+		: begin(gb), end(gb + len), record(record), depth(0), item(OTHER), inRecord(false), closed(false), location(false) {}
+
+	bool Null() { return value(std::string_view(), false); }
+	bool Bool(bool) { return true; }		 // Only in parsed locations
+	bool Uint(unsigned) { return true; }	 // Only in sequence references
+	bool Uint64(uint64_t) { return true; } // Only in sequence references
+	bool String(const char *str, rapidjson::SizeType length, bool copy = false) { return value(view(str, length, copy), true); }
+	bool String(const char *str) { return value(std::string_view(str), true); }
+	bool Key(const char *str, rapidjson::SizeType length, bool copy = false) { return key(view(str, length, copy)); }
+	bool Key(const char *str) { return key(std::string_view(str)); } // Literals only
+
+	bool StartObject()
+	{
+		depth++;
+		return true;
+	}
+
+	bool StartArray()
+	{
+		if (depth++ == 0 && !closed)
+		{
+			inRecord = true; // The GenBank array
+		}
+		return true;
+	}
+
+	bool EndObject(rapidjson::SizeType = 0)
+	{
+		depth--;
+		return true;
+	}
+
+	bool EndArray(rapidjson::SizeType = 0)
+	{
+		if (--depth == 0 && inRecord)
+		{
+			inRecord = false;
+			closed = true;
+		}
+		return true;
+	}
+
+	/**
+	 * Link the keyword tree once the events are done.
+	 * @return True if a complete record was read, or none at all.
+	 */
+	bool finish()
+	{
+		std::vector<gbkeyword> *keywords = &record->keywords;
+		std::vector<size_t> open;
+		for (size_t i = 0; i < keywords->size(); i++)
+		{
+			while (!open.empty() && (*keywords)[open.back()].level >= (*keywords)[i].level)
+			{
+				(*keywords)[open.back()].end = i;
+				open.pop_back();
+			}
+			open.push_back(i);
+		}
+		for (size_t i : open)
+		{
+			(*keywords)[i].end = keywords->size();
+		}
+
+		return !inRecord;
+	}
+
+private:
+	enum Item
+	{
+		LOCUS,
+		KEYWORD,
+		FEATURES,
+		SEQUENCE,
+		OTHER
+	};
+
+	// View text that stays valid, i.e. static text or text in the input
+	std::string_view view(const char *str, size_t len, bool copy)
+	{
+		if (!copy || (str >= begin && str + len <= end))
+		{
+			return std::string_view(str, len);
+		}
+		return record->arena.copy(str, len);
+	}
+
+	bool key(std::string_view name)
+	{
+		if (!inRecord)
+		{
+			return true; // Release header
+		}
+
+		if (depth == 2)
+		{
+			if (name == "LOCUS")
+			{
+				item = LOCUS;
+			}
+			else if (name == "FEATURES")
+			{
+				item = FEATURES;
+			}
+			else if (name == "SEQUENCE")
+			{
+				item = SEQUENCE;
+			}
+			else
+			{
+				item = KEYWORD;
+				record->keywords.push_back({name, std::string_view(), false, 0, 0});
+			}
+		}
+		else if (item == KEYWORD && (depth - 2) % 3 == 0)
+		{
+			record->keywords.push_back({name, std::string_view(), false, (depth - 2) / 3, 0});
+		}
+		else if (item == FEATURES && depth == 4)
+		{
+			record->features.push_back({name, std::string_view(), record->qualifiers.size(), 0});
+			location = true; // The location comes first
+		}
+		else if (item == FEATURES && depth == 6)
+		{
+			if (!location && name != "ParsedLocation")
+			{
+				record->qualifiers.push_back({name, std::string_view(), false});
+				record->features.back().qualifiers++;
+			}
+		}
+		return true;
+	}
+
+	bool value(std::string_view text, bool hasValue)
+	{
+		if (!inRecord)
+		{
+			return true;
+		}
+
+		if (item == LOCUS && depth == 3)
+		{
+			record->locus = text;
+		}
+		else if (item == SEQUENCE && depth == 3)
+		{
+			record->sequence = text;
+		}
+		else if (item == KEYWORD && depth == 3 + 3 * record->keywords.back().level)
+		{
+			record->keywords.back().value = text;
+			record->keywords.back().hasValue = hasValue;
+		}
+		else if (item == FEATURES && depth == 6)
+		{
+			if (location)
+			{
+				record->features.back().location = text;
+				location = false;
+			}
+			else
+			{
+				record->qualifiers.back().value = text;
+				record->qualifiers.back().hasValue = hasValue;
+			}
+		}
+		return true;
+	}
+
+	const char *begin;		///< Start of the input.
+	const char *end;		///< End of the input.
+	GenBankRecord *record;	///< The record being filled.
+	size_t depth;			///< Open objects and arrays.
+	Item item;				///< Item being parsed.
+	bool inRecord;			///< Inside the GenBank array?
+	bool closed;			///< GenBank array done?
+	bool location;			///< Next feature value is the location?
+};
+
+/**
+ * Parse the first GenBank record of a buffer into the record model.
+ * Call it again after the returned length for the next record. A record
+ * without LOCUS line, e.g. after a release header at the end, leaves
+ * the record empty.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] record The record. Its memory is reused.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return Bytes consumed, up to and including the // line.
+ */
+size_t gb2record(const char *gb, size_t len, GenBankRecord *record, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+
+	gbstats *stats = opts->stats;
+	PhaseTimer timer(PHASE(stats, parseTime));
+	gbstats counts;
+
+	record->clear();
+
+	size_t pos = 0;
+	if (!scanRecordEnd(gb, len, &pos, true))
+	{
+		pos = len; // Last record without line end
+	}
+
+	ParseContext context(&counts, opts);
+	RecordWriter writer(gb, pos, record);
+	parseBuffer(gb, pos, &writer, &context);
+
+	if (!writer.finish())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2record";
+	}
+
+	if (stats)
+	{
+		counts.bytesIn = pos;
+		stats->add(&counts);
+	}
+
+	return pos;
+}
+
+/**
+ * Write out and clear a JSON buffer.
+ * @param[in] buffer The JSON buffer.
+ * @param[in] output The output sink.
+ */
+static void flushBuffer(rapidjson::StringBuffer *buffer, OutputSink *output)
+{
+	output->write(buffer->GetString(), buffer->GetSize());
+	buffer->Clear();
+}
+
+/**
+ * Streaming GenBank to JSON converter.
+ * @param[in] gb The GenBank input file.
+ * @param[in] json The JSON output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options.
+ */
+template <typename Writer>
+static void gb2jsonStreamWriter(FILE *gb, FILE *json, gberror *err, const gboptions *opts)
+{
+	gbstats *stats = opts->stats;
+
+	std::string window; // Input that has not been converted yet
+	size_t start = 0;   // Start of the current record in the window
+	size_t scanPos = 0; // Scan position in the window
+	bool final = false; // All input read?
+
+	gbstats counts;
+
+	OutputSink output;
+	output.file = json;
+	output.stats = stats;
+	if (!output.compress(opts->compression))
+	{
+		err->flag = true;
+		err->msg = std::string("No ") + compressionName(opts->compression) + " support";
+		err->source = "gb2jsonStream";
+		return;
+	}
+
+	// Compressed input is read on another thread, and with a pipeline
+	// plain input and the output as well
+	ChunkReader reader(gb, opts->pipeline);
+	if (opts->pipeline)
+	{
+		output.startWriter();
+	}
+
+	ParseContext context(&counts, opts);
+	OutputSink sequences;
+	startSequences(&context, &sequences, opts);
+
+	// Initialize the writer
+	rapidjson::StringBuffer buffer;
+	Writer writer(buffer);
+	context.output = &buffer;
+
+	writer.StartArray();
+
+	for (;;)
+	{
+		bool found;
+		{
+			PhaseTimer timer(PHASE(stats, scanTime));
+			found = scanRecordEnd(window.data(), window.size(), &scanPos, final);
+		}
+
+		if (found)
+		{
+			// Convert a complete record
+			{
+				PhaseTimer timer(PHASE(stats, parseTime));
+				parseBuffer(window.data() + start, scanPos - start, &writer, &context);
+			}
+			flushBuffer(&buffer, &output);
+			start = scanPos;
+		}
+		else if (final)
+		{
+			// Convert whatever is left
+			PhaseTimer timer(PHASE(stats, parseTime));
+			parseBuffer(window.data() + start, window.size() - start, &writer, &context);
+			break;
+		}
+		else
+		{
+			// Drop converted input and take the next chunk
+			window.erase(0, start);
+			scanPos -= start;
+			start = 0;
+
+			const char *chunk;
+			size_t len;
+			if (reader.next(&chunk, &len))
+			{
+				window.append(chunk, len);
+				counts.bytesIn += len;
+			}
+			else
+			{
+				final = true;
+			}
+		}
+	}
+
+	// Close the JSON array
+	writer.EndArray();
+	flushBuffer(&buffer, &output);
+	output.close();
+	sequences.close();
+	{
+		PhaseTimer timer(PHASE(stats, writeTime));
+		fflush(json);
+	}
+
+	counts.readTime = reader.close();
+	if (stats)
+	{
+		stats->add(&counts);
+	}
+
+	if (reader.error())
+	{
+		err->flag = true;
+		err->msg = *reader.error();
+		err->source = "gb2jsonStream";
+	}
+	else if (!writer.IsComplete())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2jsonStream";
+	}
+	else if (output.failed || ferror(json))
+	{
+		err->flag = true;
+		err->msg = "Failed writing JSON";
+		err->source = "gb2jsonStream";
+	}
+	else if (sequences.failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing sequences";
+		err->source = "gb2jsonStream";
+	}
+}
+
+/**
+ * Streaming GenBank to JSON converter. The input is converted one record
+ * at a time and the JSON of each record is written out before the next
+ * one is read, so memory use is bounded by the largest record. gzip and
+ * zstd input is decompressed on a separate thread, and the output is
+ * compressed as set in the options.
+ * @param[in] gb The GenBank input file.
+ * @param[in] json The JSON output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2jsonStream(FILE *gb, FILE *json, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+
+	if (opts->ndjson)
+	{
+		gb2jsonStreamWriter<LinesWriter>(gb, json, err, opts);
+	}
+	else if (opts->compact)
+	{
+		gb2jsonStreamWriter<rapidjson::Writer<rapidjson::StringBuffer>>(gb, json, err, opts);
+	}
+	else
+	{
+		gb2jsonStreamWriter<rapidjson::PrettyWriter<rapidjson::StringBuffer>>(gb, json, err, opts);
+	}
+}
+
+/**
+ * Buffers of a Converter.
+ */
+struct ConverterState
+{
+	rapidjson::StringBuffer buffer;								  ///< JSON output.
+	rapidjson::Writer<rapidjson::StringBuffer> writer;			  ///< Compact writer on the buffer.
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> prettyWriter; ///< Pretty writer on the buffer.
+	LinesWriter linesWriter;									  ///< JSON Lines writer on the buffer.
+	std::string text;											  ///< Text buffer of the parse functions.
+	JSONHandler handler;										  ///< JSON to GenBank handler.
+	rapidjson::Reader reader;									  ///< JSON reader.
+	ConverterState() : writer(buffer), prettyWriter(buffer), linesWriter(buffer) {}
+};
+
+/**
+ * GenBank to JSON converter for a character buffer writing to a sink.
+ * Serial conversions write out whenever the JSON buffer is full, so the
+ * output is never held as a whole. The buffers are reset, not freed.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] output The output sink.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options.
+ * @param[in,out] buffer The JSON buffer.
+ * @param[in,out] writer The JSON writer on the buffer.
+ * @param[in,out] text The text buffer of the parse functions.
+ */
+template <typename Writer>
+static void gb2jsonSink(
+	const char *gb,
+	size_t len,
+	OutputSink *output,
+	gberror *err,
+	const gboptions *opts,
+	rapidjson::StringBuffer *buffer,
+	Writer *writer,
+	std::string *text)
+{
+	int threads = conversionThreads(len, opts);
+	if (threads > 1)
+	{
+		std::vector<std::string> fragments;
+		if (convertChunks<Writer>(gb, len, &fragments, err, threads, opts))
+		{
+			joinFragments<Writer>(&fragments, [output](const char *str, size_t n) { output->write(str, n); });
+		}
+		return;
+	}
+
+	gbstats *stats = opts->stats;
+	gbstats counts;
+
+	ParseContext context(&counts, opts);
+	context.buffer.swap(*text);
+	OutputSink sequences;
+	startSequences(&context, &sequences, opts);
+
+	buffer->Clear();
+	writer->Reset(*buffer);
+	context.output = buffer;
+
+	writer->StartArray();
+
+	for (size_t start = 0, pos = 0; start < len; start = pos)
+	{
+		{
+			PhaseTimer timer(PHASE(stats, scanTime));
+			if (!scanRecordEnd(gb, len, &pos, true))
+			{
+				pos = len; // Last record without line end
+			}
+		}
+		{
+			PhaseTimer timer(PHASE(stats, parseTime));
+			parseBuffer(gb + start, pos - start, writer, &context);
+		}
+		if (buffer->GetSize() >= output->flushSize)
+		{
+			flushBuffer(buffer, output);
+		}
+	}
+
+	writer->EndArray();
+	flushBuffer(buffer, output);
+	sequences.close();
+	context.buffer.swap(*text);
+
+	if (stats)
+	{
+		stats->add(&counts);
+	}
+
+	if (!writer->IsComplete())
+	{
+		err->flag = true;
+		err->msg = "Incomplete GenBank";
+		err->source = "gb2json";
+	}
+	else if (sequences.failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing sequences";
+		err->source = "gb2json";
+	}
+}
+
+/**
+ * GenBank to JSON converter for a character buffer writing to a file or
+ * an output callback, whichever is set.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] json The JSON output file, or nullptr.
+ * @param[in] write The output callback, or nullptr.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @param[in,out] state Buffers of a Converter, or nullptr for buffers of this call.
+ */
+static void gb2jsonOutput(const char *gb, size_t len, FILE *json, gbwrite write, void *user, gberror *err, const gboptions *opts, ConverterState *state)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+	std::unique_ptr<ConverterState> local;
+	if (!state)
+	{
+		local.reset(new ConverterState);
+		state = local.get();
+	}
+
+	OutputSink output;
+	output.file = json;
+	output.callback = write;
+	output.user = user;
+	output.stats = opts->stats;
+	if (!output.compress(opts->compression))
+	{
+		err->flag = true;
+		err->msg = std::string("No ") + compressionName(opts->compression) + " support";
+		err->source = "gb2json";
+		return;
+	}
+	if (opts->pipeline)
+	{
+		output.startWriter();
+	}
+
+	if (opts->ndjson)
+	{
+		gb2jsonSink(gb, len, &output, err, opts, &state->buffer, &state->linesWriter, &state->text);
+	}
+	else if (opts->compact)
+	{
+		gb2jsonSink(gb, len, &output, err, opts, &state->buffer, &state->writer, &state->text);
+	}
+	else
+	{
+		gb2jsonSink(gb, len, &output, err, opts, &state->buffer, &state->prettyWriter, &state->text);
+	}
+
+	output.close();
+	if (json)
+	{
+		PhaseTimer timer(PHASE(opts->stats, writeTime));
+		fflush(json);
+	}
+
+	if (!err->flag && (output.failed || (json && ferror(json))))
+	{
+		err->flag = true;
+		err->msg = "Failed writing JSON";
+		err->source = "gb2json";
+	}
+	else if (opts->stats && !err->flag)
+	{
+		opts->stats->bytesIn += len;
+	}
+}
+
+/**
+ * GenBank to JSON converter for a character buffer writing to a file.
+ * The JSON is written from the writer buffers with large writes instead
+ * of being collected in a string first, and compressed as set in the
+ * options.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] json The JSON output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const char *gb, size_t len, FILE *json, gberror *err, const gboptions *opts)
+{
+	gb2jsonOutput(gb, len, json, nullptr, nullptr, err, opts, nullptr);
+}
+
+/**
+ * GenBank to JSON converter for a character buffer writing to an output
+ * callback. The callback receives the JSON in blocks of about 1 MB as
+ * the writer buffers fill, so it is never collected in full.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2json(const char *gb, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts)
+{
+	gb2jsonOutput(gb, len, nullptr, write, user, err, opts, nullptr);
+}
+
+/***************************************************************
+ * Record index
+ * The index maps LOCUS names and accessions to the byte ranges
+ * of records. It is built by a line scan without parsing, and
+ * lets selected records be converted by seeking.
+ ***************************************************************/
+
+static const char indexMagic[4] = {'G', 'B', 'I', 'X'};
+static const uint64_t indexVersion = 2;
+
+/**
+ * Index the records of a GenBank buffer. A record spans its LOCUS line up
+ * to and including its // line. A record without // ends at the next
+ * LOCUS line or at the end of the buffer.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] index The index.
+ */
+void indexRecords(const char *gb, size_t len, gbindex *index)
+{
+	index->size = len;
+	index->entries.clear();
+
+	LineCursor cursor(gb, len);
+	std::string_view line;
+	gbentry entry;
+	bool open = false;
+
+	auto close = [&](const char *end) {
+		entry.length = end - gb - entry.offset;
+		entry.hash = crc32Of(gb + entry.offset, entry.length);
+		index->entries.push_back(std::move(entry));
+		entry = gbentry();
+		open = false;
+	};
+
+	for (cursor.getline(&line); !cursor.eof(); cursor.getline(&line))
+	{
+		if (line.empty())
+		{
+			continue;
+		}
+
+		switch (line[0])
+		{
+		case 'L':
+			if (isLocus(&line))
+			{
+				if (open)
+				{
+					close(line.data());
+				}
+				entry.offset = line.data() - gb;
+				entry.locus = keywordValue(&line);
+				open = true;
+			}
+			break;
+		case 'A':
+			if (open && entry.accession.empty() && isKeywordNamed(&line, "ACCESSION", 9))
+			{
+				entry.accession = keywordValue(&line);
+			}
+			break;
+		case 'V':
+			if (open && entry.version.empty() && isKeywordNamed(&line, "VERSION", 7))
+			{
+				entry.version = keywordValue(&line);
+			}
+			break;
+		case '/':
+			if (open && isEnd(&line))
+			{
+				close(cursor.position());
+			}
+			break;
+		}
+	}
+
+	if (open)
+	{
+		close(gb + len);
+	}
+}
+
+/**
+ * Index the records of a GenBank file. The file is mapped and scanned.
+ * Compressed files cannot be indexed, since records are read by seeking.
+ * @param[in] filename The GenBank file.
+ * @param[out] index The index.
+ * @param[out] err Error object.
+ */
+void indexFile(const std::string *filename, gbindex *index, gberror *err)
+{
+	MappedFile map;
+	fileToMap(filename, &map, err);
+	if (err->flag)
+	{
+		return;
+	}
+
+	if (detectCompression(map.data, map.size) != GB_PLAIN)
+	{
+		err->flag = true;
+		err->msg = "Cannot index compressed file " + *filename;
+		err->source = "indexFile";
+		return;
+	}
+
+	indexRecords(map.data, map.size, index);
+}
+
+static inline void putU64(std::string *out, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		out->push_back(static_cast<char>(value >> (8 * i)));
+	}
+}
+
+static inline void putString(std::string *out, const std::string *str)
+{
+	size_t len = std::min(str->size(), size_t(0xffff));
+	out->push_back(static_cast<char>(len));
+	out->push_back(static_cast<char>(len >> 8));
+	out->append(str->data(), len);
+}
+
+static inline bool getU64(const std::string *in, size_t *pos, uint64_t *value)
+{
+	if (in->size() - *pos < 8)
+	{
+		return false;
+	}
+
+	*value = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		*value |= uint64_t(static_cast<unsigned char>((*in)[*pos + i])) << (8 * i);
+	}
+	*pos += 8;
+	return true;
+}
+
+static inline bool getString(const std::string *in, size_t *pos, std::string *str)
+{
+	if (in->size() - *pos < 2)
+	{
+		return false;
+	}
+
+	size_t len = static_cast<unsigned char>((*in)[*pos]) | static_cast<unsigned char>((*in)[*pos + 1]) << 8;
+	*pos += 2;
+	if (in->size() - *pos < len)
+	{
+		return false;
+	}
+
+	str->assign(in->data() + *pos, len);
+	*pos += len;
+	return true;
+}
+
+/**
+ * Write an index file. The format is little-endian: the magic "GBIX", the
+ * format version, the indexed file size and the number of entries as
+ * 64-bit integers, then per entry the offset, length and hash as 64-bit
+ * integers, and the LOCUS name, accession and version, each prefixed
+ * with its 16-bit length.
+ * @param[in] filename The index file.
+ * @param[in] index The index.
+ * @param[out] err Error object.
+ */
+void writeIndex(const std::string *filename, const gbindex *index, gberror *err)
+{
+	std::string data(indexMagic, sizeof(indexMagic));
+	putU64(&data, indexVersion);
+	putU64(&data, index->size);
+	putU64(&data, index->entries.size());
+
+	for (auto &entry : index->entries)
+	{
+		putU64(&data, entry.offset);
+		putU64(&data, entry.length);
+		putU64(&data, entry.hash);
+		putString(&data, &entry.locus);
+		putString(&data, &entry.accession);
+		putString(&data, &entry.version);
+	}
+
+	// Binary mode, so that no bytes are translated
+	FILE *file = fopen(filename->c_str(), "wb");
+	if (!file)
+	{
+		err->flag = true;
+		err->msg = "Failed writing to ";
+		err->msg.append(filename->c_str());
+		err->source = "writeIndex";
+		return;
+	}
+
+	bool failed = fwrite(data.data(), 1, data.size(), file) != data.size();
+	if (fclose(file) != 0 || failed)
+	{
+		err->flag = true;
+		err->msg = "Failed writing to ";
+		err->msg.append(filename->c_str());
+		err->source = "writeIndex";
+	}
+}
+
+/**
+ * Read an index file written by writeIndex.
+ * @param[in] filename The index file.
+ * @param[out] index The index.
+ * @param[out] err Error object.
+ */
+void readIndex(const std::string *filename, gbindex *index, gberror *err)
+{
+	// Binary mode, so that no bytes are translated
+	FILE *file = fopen(filename->c_str(), "rb");
+	if (!file)
+	{
+		err->flag = true;
+		err->msg = "Failed to open ";
+		err->msg.append(filename->c_str());
+		err->source = "readIndex";
+		return;
+	}
+
+	std::string data;
+	size_t len;
+	fileSize(file, &len);
+	data.resize(len);
+	data.resize(fread(&data[0], 1, len, file));
+	fclose(file);
+
+	size_t pos = sizeof(indexMagic);
+	uint64_t version = 0, count = 0;
+	bool ok = data.compare(0, sizeof(indexMagic), indexMagic, sizeof(indexMagic)) == 0 &&
+			  getU64(&data, &pos, &version);
+
+	if (ok && version != indexVersion)
+	{
+		err->flag = true;
+		err->msg = "Index file " + *filename + " was written by another version. Rebuild it.";
+		err->source = "readIndex";
+		return;
+	}
+	ok = ok && getU64(&data, &pos, &index->size) && getU64(&data, &pos, &count);
+
+	index->entries.clear();
+	for (uint64_t i = 0; ok && i < count; i++)
+	{
+		gbentry entry;
+		uint64_t hash = 0;
+		ok = getU64(&data, &pos, &entry.offset) &&
+			 getU64(&data, &pos, &entry.length) &&
+			 getU64(&data, &pos, &hash) &&
+			 getString(&data, &pos, &entry.locus) &&
+			 getString(&data, &pos, &entry.accession) &&
+			 getString(&data, &pos, &entry.version) &&
+			 entry.offset <= index->size && entry.length <= index->size - entry.offset;
+		entry.hash = static_cast<uint32_t>(hash);
+		index->entries.push_back(std::move(entry));
+	}
+
+	if (!ok || pos != data.size())
+	{
+		index->entries.clear();
+		err->flag = true;
+		err->msg = "Invalid index file " + *filename;
+		err->source = "readIndex";
+	}
+}
+
+/**
+ * Convert selected records of an indexed GenBank file to JSON. Records are
+ * selected by LOCUS name, accession or accession.version. Only the selected
+ * records are read, and they are converted in file order.
+ * @param[in] filename The GenBank file.
+ * @param[in] index The index of the file.
+ * @param[in] keys The record names.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2jsonSelect(const std::string *filename, const gbindex *index, const std::vector<std::string> *keys, std::string *json, gberror *err, const gboptions *opts)
+{
+	auto fail = [err](std::string msg) {
+		err->flag = true;
+		err->msg = std::move(msg);
+		err->source = "gb2jsonSelect";
+	};
+
+	// Look up records by every name they go by
+	std::unordered_multimap<std::string_view, size_t> names;
+	names.reserve(index->entries.size() * 3);
+	for (size_t i = 0; i < index->entries.size(); i++)
+	{
+		const gbentry *entry = &index->entries[i];
+		names.emplace(entry->locus, i);
+		if (!entry->accession.empty() && entry->accession != entry->locus)
+		{
+			names.emplace(entry->accession, i);
+		}
+		if (!entry->version.empty() && entry->version != entry->accession && entry->version != entry->locus)
+		{
+			names.emplace(entry->version, i);
+		}
+	}
+
+	std::vector<size_t> selected;
+	for (auto &key : *keys)
+	{
+		auto range = names.equal_range(key);
+		if (range.first == range.second)
+		{
+			fail("Record not found: " + key);
+			return;
+		}
+
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			selected.push_back(it->second);
+		}
+	}
+
+	std::sort(selected.begin(), selected.end());
+	selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+
+	std::error_code ec;
+	if (std::filesystem::file_size(*filename, ec) != index->size || ec)
+	{
+		fail("Index does not match " + *filename);
+		return;
+	}
+
+	FILE *fp = fopen(filename->c_str(), "rb");
+	if (!fp)
+	{
+		fail("Failed to open " + *filename);
+		return;
+	}
+
+	// Read the records into one buffer
+	gbstats *stats = opts ? opts->stats : nullptr;
+	std::string gb;
+	{
+		PhaseTimer timer(PHASE(stats, readTime));
+
+		size_t total = 0;
+		for (size_t i : selected)
+		{
+			total += index->entries[i].length;
+		}
+		gb.resize(total);
+
+		char *out = &gb[0];
+		for (size_t i : selected)
+		{
+			const gbentry *entry = &index->entries[i];
+			if (seekFile(fp, entry->offset) != 0 || fread(out, 1, entry->length, fp) != entry->length)
+			{
+				fail("Failed reading " + *filename);
+				break;
+			}
+
+			std::string_view line(out, entry->length);
+			if (!isLocus(&line))
+			{
+				fail("Index does not match " + *filename);
+				break;
+			}
+			out += entry->length;
+		}
+	}
+	fclose(fp);
+
+	if (!err->flag)
+	{
+		gb2json(gb.data(), gb.size(), json, err, opts);
+	}
+}
+
+/***************************************************************
+ * JSON to GenBank converter
+ * This feeds a events from a JSON stream into a rapidjson handler
+ * object. The handler builds the GenBank string.
+ ***************************************************************/
+
+/**
+   * Handler constructor.
+   */
+JSONHandler::JSONHandler()
+	: state(START), nwritten(0), skipStateUpdate(false), sequences(nullptr), inReference(false), referenceField(-1), reference{0, 0, 0, 0}, referencePacked(false), skipDepth(0) {}
+
+/**
+ * Return to the initial state for the next conversion. The buffers keep
+ * their memory.
+ */
+void JSONHandler::reset()
+{
+	state = START;
+	skipStateUpdate = false;
+	gb.buffer.clear();
+	gb.failed = false;
+	nwritten = 0;
+	counts = gbstats();
+	sequences = nullptr;
+	inReference = false;
+	referenceField = -1;
+	memset(reference, 0, sizeof(reference));
+	referencePacked = false;
+	skipDepth = 0;
+	error.clear();
+}
+
+// Unused handler functions
+bool JSONHandler::Bool(bool b) { return true; }
+bool JSONHandler::Int(int i) { return true; }
+bool JSONHandler::Int64(int64_t i) { return true; }
+
+// Numbers are only used by sequence references
+bool JSONHandler::Uint(unsigned i) { return Uint64(i); }
+bool JSONHandler::Uint64(uint64_t i)
+{
+	if (inReference && referenceField >= 0)
+	{
+		reference[referenceField] = i;
+	}
+	return true;
+}
+bool JSONHandler::Double(double d) { return true; }
+bool JSONHandler::RawNumber(const char *str, rapidjson::SizeType length, bool copy) { return true; }
+
+/**
+ * Classify a JSON key by its length and first character. Only the keys
+ * that change the handler state or name a reference field have an event
+ * of their own.
+ * @param[in] key The key.
+ * @param[in] length The key length.
+ * @return The key event.
+ */
+static constexpr handlerEvent classifyKey(const char *key, size_t length)
+{
+	std::string_view name(key, length);
+	switch (length)
+	{
+	case 4:
+		return name == "size" ? EVENT_KEY_SIZE : EVENT_KEY;
+	case 5:
+		switch (key[0])
+		{
+		case 'L':
+			return name == "LOCUS" ? EVENT_KEY_LOCUS : EVENT_KEY;
+		case 'c':
+			return name == "crc32" ? EVENT_KEY_CRC32 : EVENT_KEY;
+		}
+		break;
+	case 6:
+		switch (key[0])
+		{
+		case 'O':
+			return name == "ORIGIN" ? EVENT_KEY_ORIGIN : EVENT_KEY;
+		case 'C':
+			return name == "CONTIG" ? EVENT_KEY_CONTIG : EVENT_KEY;
+		case 'o':
+			return name == "offset" ? EVENT_KEY_OFFSET : EVENT_KEY;
+		case 'l':
+			return name == "length" ? EVENT_KEY_LENGTH : EVENT_KEY;
+		}
+		break;
+	case 8:
+		switch (key[0])
+		{
+		case 'S':
+			return name == "SEQUENCE" ? EVENT_KEY_SEQUENCE : EVENT_KEY;
+		case 'F':
+			return name == "FEATURES" ? EVENT_KEY_FEATURES : EVENT_KEY;
+		case 'L':
+			return name == "Location" ? EVENT_KEY_LOCATION : EVENT_KEY;
+		case 'e':
+			return name == "encoding" ? EVENT_KEY_ENCODING : EVENT_KEY;
+		}
+		break;
+	case 14:
+		return name == "ParsedLocation" ? EVENT_KEY_PARSED : EVENT_KEY;
+	}
+	return EVENT_KEY;
+}
+
+static_assert(classifyKey("LOCUS", 5) == EVENT_KEY_LOCUS && classifyKey("LOCAL", 5) == EVENT_KEY, "Key classification");
+
+// Actions taken on a transition
+static const unsigned short setSkip = 1;			// Set skipStateUpdate
+static const unsigned short testSkip = 2;			// Clear skipStateUpdate and stay if it is set
+static const unsigned short nestParsed = 4;			// Open a level inside a parsed location
+static const unsigned short unnestParsed = 8;		// Close a level inside a parsed location and stay, if one is open
+static const unsigned short countRecord = 16;		// Count a record
+static const unsigned short countFeature = 32;		// Count a feature
+static const unsigned short startReference = 64;	// Start reading a sequence reference
+static const unsigned short endReference = 128;		// Write the bases of a sequence reference being read
+static const unsigned short terminateRecord = 256; // Write the record terminator
+
+/**
+ * Transition of the JSON handler on one event.
+ */
+struct gbtransition
+{
+	handlerState next;		///< The next state.
+	unsigned short actions; ///< Actions to take.
+};
+
+/**
+ * Transitions of the JSON handler, indexed by state and event.
+ */
+struct gbtransitions
+{
+	gbtransition table[END + 1][EVENT_COUNT]; ///< The transitions.
+};
+
+/**
+ * Set the transition of a state on an event.
+ * @param[out] transitions The transitions.
+ * @param[in] state The state.
+ * @param[in] event The event.
+ * @param[in] next The next state.
+ * @param[in] actions The actions to take.
+ */
+static constexpr void setTransition(gbtransitions *transitions, handlerState state, handlerEvent event, handlerState next, unsigned short actions = 0)
+{
+	transitions->table[state][event] = {next, actions};
+}
+
+/**
+ * Build the transitions of the JSON handler. Events without a rule keep
+ * the state and take no action.
+ * @return The transitions.
+ */
+static constexpr gbtransitions buildTransitions()
+{
+	gbtransitions t{};
+	for (int state = START; state <= END; state++)
+	{
+		for (int event = 0; event < EVENT_COUNT; event++)
+		{
+			t.table[state][event] = {(handlerState)state, 0};
+		}
+	}
+
+	// Keys, from the least to the most specific rule
+	for (int event = EVENT_KEY; event < EVENT_COUNT; event++)
+	{
+		handlerEvent key = (handlerEvent)event;
+		setTransition(&t, KEYWORD, key, KEYWORD, setSkip);
+		setTransition(&t, SUBKEYWORD, key, SUBKEYWORD, setSkip);
+		setTransition(&t, SUBSUBKEYWORD, key, SUBSUBKEYWORD, setSkip);
+	}
+	for (int state = START; state <= END; state++)
+	{
+		handlerState from = (handlerState)state;
+		setTransition(&t, from, EVENT_KEY_LOCUS, LOCUS, setSkip | countRecord);
+		setTransition(&t, from, EVENT_KEY_ORIGIN, ORIGIN, setSkip);
+		setTransition(&t, from, EVENT_KEY_SEQUENCE, SEQUENCE, setSkip);
+		setTransition(&t, from, EVENT_KEY_CONTIG, CONTIG, setSkip);
+		setTransition(&t, from, EVENT_KEY_FEATURES, FEATURE_HEADER);
+	}
+	for (int event = EVENT_KEY; event < EVENT_COUNT; event++)
+	{
+		setTransition(&t, QUALIFIER_LOCATION, (handlerEvent)event, QUALIFIER);
+		setTransition(&t, QUALIFIER_PARSED, (handlerEvent)event, QUALIFIER_PARSED); // Keys of the parsed location
+	}
+	setTransition(&t, QUALIFIER, EVENT_KEY_LOCATION, QUALIFIER_LOCATION);
+	setTransition(&t, QUALIFIER, EVENT_KEY_PARSED, QUALIFIER_PARSED);
+
+	// Arrays. Dummy arrays are entered unless the array is the value of the key.
+	setTransition(&t, QUALIFIER_PARSED, EVENT_START_ARRAY, QUALIFIER_PARSED, nestParsed);
+	setTransition(&t, KEYWORD, EVENT_START_ARRAY, SUBKEYWORD, testSkip);
+	setTransition(&t, SUBKEYWORD, EVENT_START_ARRAY, SUBSUBKEYWORD, testSkip);
+	setTransition(&t, LOCUS, EVENT_START_ARRAY, LOCUSSUB, testSkip);
+	setTransition(&t, ORIGIN, EVENT_START_ARRAY, ORIGINSUB, testSkip);
+	setTransition(&t, SEQUENCE, EVENT_START_ARRAY, SEQUENCESUB, testSkip);
+	setTransition(&t, CONTIG, EVENT_START_ARRAY, CONTIGSUB, testSkip);
+	setTransition(&t, END, EVENT_START_ARRAY, START);
+
+	setTransition(&t, QUALIFIER_PARSED, EVENT_END_ARRAY, QUALIFIER_PARSED, unnestParsed);
+	setTransition(&t, QUALIFIER, EVENT_END_ARRAY, FEATURE);
+	setTransition(&t, QUALIFIER_LOCATION, EVENT_END_ARRAY, FEATURE);
+	setTransition(&t, FEATURE, EVENT_END_ARRAY, FEATURE_HEADER);
+	setTransition(&t, FEATURE_HEADER, EVENT_END_ARRAY, KEYWORD);
+	setTransition(&t, SUBSUBKEYWORD, EVENT_END_ARRAY, SUBKEYWORD);
+	setTransition(&t, SUBKEYWORD, EVENT_END_ARRAY, KEYWORD);
+	setTransition(&t, LOCUSSUB, EVENT_END_ARRAY, LOCUS);
+	setTransition(&t, LOCUS, EVENT_END_ARRAY, KEYWORD);
+	setTransition(&t, ORIGINSUB, EVENT_END_ARRAY, ORIGIN);
+	setTransition(&t, ORIGIN, EVENT_END_ARRAY, KEYWORD);
+	setTransition(&t, SEQUENCESUB, EVENT_END_ARRAY, SEQUENCE);
+	setTransition(&t, CONTIGSUB, EVENT_END_ARRAY, CONTIG);
+	setTransition(&t, SEQUENCE, EVENT_END_ARRAY, END, terminateRecord);
+	setTransition(&t, CONTIG, EVENT_END_ARRAY, END, terminateRecord);
+
+	// Objects
+	setTransition(&t, QUALIFIER_PARSED, EVENT_START_OBJECT, QUALIFIER_PARSED, nestParsed);
+	setTransition(&t, SEQUENCE, EVENT_START_OBJECT, SEQUENCE, startReference);
+	setTransition(&t, FEATURE_HEADER, EVENT_START_OBJECT, FEATURE, countFeature);
+	setTransition(&t, FEATURE, EVENT_START_OBJECT, QUALIFIER);
+
+	setTransition(&t, QUALIFIER_PARSED, EVENT_END_OBJECT, FEATURE, unnestParsed);
+	setTransition(&t, QUALIFIER, EVENT_END_OBJECT, FEATURE);
+	setTransition(&t, QUALIFIER_LOCATION, EVENT_END_OBJECT, FEATURE);
+	setTransition(&t, SEQUENCE, EVENT_END_OBJECT, SEQUENCE, endReference);
+	return t;
+}
+
+static constexpr gbtransitions transitions = buildTransitions(); // The handler state machine
+
+/**
+ * Move the handler to its next state on an event.
+ * @param[in] event The event.
+ * @return False if the event is a malformed sequence reference.
+ */
+bool JSONHandler::transition(handlerEvent event)
+{
+	const gbtransition *t = &transitions.table[state][event];
+	unsigned short actions = t->actions;
+
+	if (actions)
+	{
+		if ((actions & testSkip) && skipStateUpdate)
+		{
+			skipStateUpdate = false;
+			return true;
+		}
+		if ((actions & unnestParsed) && skipDepth > 0)
+		{
+			skipDepth--;
+			return true;
+		}
+		skipDepth += (actions & nestParsed) != 0;
+		skipStateUpdate |= (actions & setSkip) != 0;
+		counts.records += (actions & countRecord) != 0;
+		counts.features += (actions & countFeature) != 0;
+		if (actions & startReference)
+		{
+			inReference = true;
+			referenceField = -1;
+			reference[0] = reference[1] = reference[2] = reference[3] = 0;
+			referencePacked = false;
+		}
+		if (actions & terminateRecord)
+		{
+			gb.append("//\n", 3);
+			gb.maybeFlush();
+			nwritten = 0;
+		}
+	}
+	state = t->next;
+
+	if ((actions & endReference) && inReference)
+	{
+		inReference = false;
+		return handleReference();
+	}
+	return true;
+}
+
+bool JSONHandler::StartArray() { return transition(EVENT_START_ARRAY); }
+bool JSONHandler::EndArray(rapidjson::SizeType elementCount) { return transition(EVENT_END_ARRAY); }
+bool JSONHandler::StartObject() { return transition(EVENT_START_OBJECT); }
+bool JSONHandler::EndObject(rapidjson::SizeType elementCount) { return transition(EVENT_END_OBJECT); }
+
+/**
+ * Indentation of keys and values in a handler state.
+ */
+struct gblayout
+{
+	int keyIndentation;	  ///< Whitespace before a key.
+	int valueIndentation; ///< Number of characters before a value.
+};
+
+static constexpr gblayout layouts[END + 1] = {
+	{0, 12}, // START
+	{0, 12}, // LOCUS
+	{0, 12}, // LOCUSSUB
+	{0, 12}, // KEYWORD
+	{2, 12}, // SUBKEYWORD
+	{3, 12}, // SUBSUBKEYWORD
+	{0, 12}, // FEATURE_HEADER
+	{5, 21}, // FEATURE
+	{0, 21}, // QUALIFIER_LOCATION
+	{0, 12}, // QUALIFIER_PARSED
+	{0, 21}, // QUALIFIER
+	{0, 12}, // ORIGIN
+	{0, 12}, // ORIGINSUB
+	{0, 12}, // SEQUENCE
+	{0, 12}, // SEQUENCESUB
+	{0, 12}, // CONTIG
+	{0, 12}, // CONTIGSUB
+	{0, 12}, // END
+};
+
+/**
+ * Consume a string value.
+ * @param[in] value The value string.
+ */
+void JSONHandler::handleStringValue(const std::string_view *value)
+{
+	int valueIndentation = layouts[state].valueIndentation;
+
+	// Write equal sign for qualifiers
+	if (state == QUALIFIER)
+	{
+		gb.put('=');
+		nwritten += 1;
+	}
+
+	// Write the value as padded lines
+	blockPad(value, &gb, valueIndentation, 79, nwritten - valueIndentation);
+
+	// Reset the column counter
+	nwritten = 0;
+}
+
+/**
+ * Size of a formatted sequence block with 60 bases per line in
+ * sections of 10, each line led by a 9 column coordinate.
+ * @param[in] len The sequence length.
+ * @return The block size.
+ */
+static size_t sequenceBlockSize(size_t len)
+{
+	size_t nlines = (len + 59) / 60;
+	size_t size = len + 10 * nlines + (len + 9) / 10; // Bases, coordinates, separators and newlines
+
+	// Coordinates wider than 9 columns
+	for (size_t limit = 1000000000; limit <= (size_t)-1 / 10; limit *= 10)
+	{
+		size_t first = (limit + 58) / 60; // First line with a coordinate >= limit
+		if (first >= nlines)
+		{
+			break;
+		}
+		size += nlines - first;
+	}
+
+	return size;
+}
+
+/**
+ * Format a sequence block. The output must hold sequenceBlockSize(len) characters.
+ * @param[in] seq The sequence.
+ * @param[in] len The sequence length.
+ * @param[out] out The output.
+ * @return Number of characters written.
+ */
+static size_t formatSequence(const char *seq, size_t len, char *out)
+{
+	char *o = out;
+	char digits[20];
+
+	for (size_t i = 0; i < len; i += 60)
+	{
+		// Place leading number
+		int ndigits = 0;
+		size_t pos = i + 1;
+		do
+		{
+			digits[ndigits++] = '0' + pos % 10;
+			pos /= 10;
+		} while (pos);
+
+		for (int k = ndigits; k < 9; k++)
+		{
+			*o++ = ' ';
+		}
+		while (ndigits)
+		{
+			*o++ = digits[--ndigits];
+		}
+		*o++ = ' ';
+
+		// Build 10 b sections
+		size_t n = std::min(len - i, (size_t)60);
+		for (size_t j = 0; j < n; j += 10)
+		{
+			if (j)
+			{
+				*o++ = ' ';
+			}
+
+			size_t m = std::min(n - j, (size_t)10);
+			memcpy(o, seq + i + j, m);
+			o += m;
+		}
+
+		*o++ = '\n';
+	}
+
+	return o - out;
+}
+
+/**
+ * Consume the nucleotide sequence.
+ * @param[in] value The string value.
+ */
+void JSONHandler::handleSequence(const std::string_view *value)
+{
+	// The block is formatted in place into output of the exact size
+	formatSequence(value->data(), value->length(), gb.extend(sequenceBlockSize(value->length())));
+	counts.bases += value->length();
+
+	// Reset column counter
+	nwritten = 0;
+}
+
+/**
+ * Read referenced bases back from the sidecar and write them out.
+ * @return False if the bases cannot be read or do not match their checksum.
+ */
+bool JSONHandler::handleReference()
+{
+	if (!sequences)
+	{
+		error = "Sequence reference without a sequence file";
+		return false;
+	}
+
+	uint64_t len = reference[1];
+	std::string *data = referencePacked ? &packed : &bases;
+	uint64_t size = referencePacked ? reference[3] : len;
+
+	data->resize(size);
+	if (seekFile(sequences, reference[0]) != 0 || fread(&(*data)[0], 1, size, sequences) != size)
+	{
+		error = "Failed reading sequence at offset " + std::to_string(reference[0]);
+		return false;
+	}
+
+	if (referencePacked && !unpackSequence(packed.data(), size, len, &bases))
+	{
+		error = "Malformed packed sequence at offset " + std::to_string(reference[0]);
+		return false;
+	}
+
+	if (crc32Of(bases.data(), len) != reference[2])
+	{
+		error = "Checksum mismatch of sequence at offset " + std::to_string(reference[0]);
+		return false;
+	}
+
+	std::string_view value(bases);
+	handleSequence(&value);
+	return true;
+}
+
+bool JSONHandler::String(const char *str, rapidjson::SizeType length, bool copy)
+{
+	std::string_view value(str, length);
+
+	switch (state)
+	{
+	case LOCUS:
+	{
+		// The sequence block of the record has an exact size, and the
+		// other entries are assumed to be no longer than the bases
+		size_t bases = locusLength(&value);
+		if (bases)
+		{
+			gb.buffer.reserve(gb.buffer.size() + length + bases + sequenceBlockSize(bases));
+		}
+		gb.append(str, length);
+		gb.put('\n');
+		break;
+	}
+	case ORIGIN:
+	{
+		gb.append(str, length);
+		gb.put('\n');
+		break;
+	}
+	case QUALIFIER_PARSED:
+	{
+		break; // Not written
+	}
+	case SEQUENCE:
+	{
+		if (!inReference)
+		{
+			handleSequence(&value);
+		}
+		else if (referenceField == -2)
+		{
+			if (value != "2bit")
+			{ // The only encoding
+				error = "Unknown sequence encoding " + std::string(value);
+				return false;
+			}
+			referencePacked = true;
+		}
+		break;
+	}
+	default:
+	{
+		handleStringValue(&value);
+		break;
+	}
+	}
+	return true;
+}
+
+bool JSONHandler::Key(const char *str, rapidjson::SizeType length, bool copy)
+{
+	if (state == QUALIFIER_PARSED)
+	{
+		return true; // Keys of the parsed location
+	}
+	handlerEvent event = classifyKey(str, length);
+	transition(event);
+
+	std::string_view key(str, length);
+	if (state == SEQUENCE)
+	{
+		if (inReference)
+		{
+			referenceField = event == EVENT_KEY_ENCODING ? -2 : event >= EVENT_KEY_OFFSET && event <= EVENT_KEY_SIZE ? event - EVENT_KEY_OFFSET : -1;
+		}
+		return true; // Don't print a key
+	}
+	else if (state == FEATURE_HEADER)
+	{
+		gb.append("FEATURES");
+		gb.fill(21 - 8);
+		gb.append("Location/Qualifiers\n");
+		nwritten = 0;
+		return true;
+	}
+	else if (state == QUALIFIER)
+	{
+		// Special formatting for qualifier key
+		gb.fill(21);
+		gb.put('/');
+		gb.append(key.data(), key.length());
+		nwritten = 22 + key.length();
+		counts.qualifiers++;
+		return true;
+	}
+	else if (state == QUALIFIER_LOCATION || state == QUALIFIER_PARSED)
+	{
+		return true; // Don't print a key
+	}
+
+	int keyIndentation = layouts[state].keyIndentation;
+	int valueIndentation = layouts[state].valueIndentation;
+
+	// Print key plus left/right padding
+	gb.fill(keyIndentation);
+	gb.append(key.data(), key.length());
+	gb.fill(valueIndentation - keyIndentation - (int)key.length());
+
+	// Set column counter
+	nwritten = valueIndentation;
+
+	return true;
+}
+
+bool JSONHandler::Null()
+{
+	if (state == QUALIFIER_PARSED)
+	{
+		return true;
+	}
+	gb.put('\n');
+	return true;
+}
+
+/**
+ * Read-only stream over the chunks of a ChunkReader.
+ */
+struct ChunkReadStream
+{
+	typedef char Ch;
+
+	ChunkReadStream(ChunkReader *reader, double *readTime)
+		: reader(reader), readTime(readTime), begin(nullptr), src(nullptr), end(nullptr), count(0), eof(false)
+	{
+		fill();
+	}
+
+	// Read. src always points to a character, which is '\0' at the end.
+	Ch Peek() const { return *src; }
+	Ch Take()
+	{
+		Ch c = *src;
+		if (++src == end)
+		{
+			fill();
+		}
+		return c;
+	}
+	size_t Tell() const { return count + static_cast<size_t>(src - begin); }
+
+	// Write (not supported)
+	Ch *PutBegin()
+	{
+		RAPIDJSON_ASSERT(false);
+		return 0;
+	}
+	void Put(Ch) { RAPIDJSON_ASSERT(false); }
+	void Flush() { RAPIDJSON_ASSERT(false); }
+	size_t PutEnd(Ch *)
+	{
+		RAPIDJSON_ASSERT(false);
+		return 0;
+	}
+
+	// Move to the next non-empty chunk
+	void fill()
+	{
+		if (eof)
+		{
+			src = begin; // Stay on the terminator
+			return;
+		}
+
+		PhaseTimer timer(readTime);
+		count += static_cast<size_t>(end - begin);
+
+		const char *data;
+		size_t len = 0;
+		while (len == 0 && reader->next(&data, &len))
+		{
+		}
+
+		if (len == 0)
+		{
+			static const char terminator = '\0';
+			eof = true;
+			begin = src = &terminator;
+			end = begin + 1;
+		}
+		else
+		{
+			begin = src = data;
+			end = data + len;
+		}
+	}
+
+	ChunkReader *reader; ///< The chunk source.
+	double *readTime;	///< Time taking chunks, or nullptr.
+	const char *begin;   ///< Start of the current chunk.
+	const char *src;	 ///< Read position.
+	const char *end;	 ///< End of the current chunk.
+	size_t count;		 ///< Bytes in previous chunks.
+	bool eof;			 ///< All chunks read?
+};
+
+/**
+ * Parse every top level value of a stream into a handler. A JSON array
+ * of records is one value, JSON Lines hold one record per line. Empty
+ * JSON Lines are valid and hold no records.
+ * @param[in] reader The JSON reader.
+ * @param[in] stream The JSON stream. Peek returns '\0' at the end.
+ * @param[in,out] handler The handler.
+ * @param[in] commas Skip a comma after each value, as in a chunk of array elements.
+ */
+template <unsigned parseFlags, typename Stream, typename Handler>
+static void parseValues(rapidjson::Reader *reader, Stream *stream, Handler *handler, bool commas = false)
+{
+	rapidjson::SkipWhitespace(*stream);
+	while (stream->Peek() != '\0')
+	{
+		if (reader->Parse<parseFlags | rapidjson::kParseStopWhenDoneFlag>(*stream, *handler).IsError())
+		{
+			break;
+		}
+		rapidjson::SkipWhitespace(*stream);
+		if (commas && stream->Peek() == ',')
+		{
+			stream->Take();
+			rapidjson::SkipWhitespace(*stream);
+		}
+	}
+}
+
+/***************************************************************
+ * Layout validation
+ * The JSON Schema of the gbjson layout. Every keyword, LOCUS,
+ * ORIGIN, SEQUENCE and CONTIG entry is a one-key object whose
+ * value is its text and a dummy array of sub keywords, as
+ * walked by the JSONHandler states. An ORIGIN without sequence
+ * is followed by an empty object.
+ ***************************************************************/
+
+static const char layoutSchemaText[] = R"({
+	"$schema": "http://json-schema.org/draft-04/schema#",
+	"title": "gbjson layout",
+	"definitions": {
+		"keywordValue": {
+			"type": "array",
+			"items": [
+				{"type": ["string", "null"]},
+				{"type": "array", "items": {"$ref": "#/definitions/keyword"}}
+			],
+			"minItems": 2,
+			"additionalItems": false
+		},
+		"keyword": {
+			"type": "object",
+			"minProperties": 1,
+			"maxProperties": 1,
+			"additionalProperties": {"$ref": "#/definitions/keywordValue"}
+		},
+		"locus": {
+			"type": "object",
+			"properties": {"LOCUS": {"$ref": "#/definitions/keywordValue"}},
+			"required": ["LOCUS"],
+			"additionalProperties": false
+		},
+		"sequence": {
+			"type": ["string", "null", "object"],
+			"properties": {
+				"offset": {"type": "integer", "minimum": 0},
+				"size": {"type": "integer", "minimum": 0},
+				"encoding": {"enum": ["2bit"]},
+				"length": {"type": "integer", "minimum": 0},
+				"crc32": {"type": "integer", "minimum": 0}
+			},
+			"required": ["offset", "length", "crc32"],
+			"additionalProperties": false
+		},
+		"location": {
+			"type": "object",
+			"properties": {"Location": {"type": "string"}},
+			"required": ["Location"],
+			"additionalProperties": false
+		},
+		"qualifier": {
+			"type": "object",
+			"minProperties": 1,
+			"maxProperties": 1,
+			"properties": {
+				"ParsedLocation": {
+					"type": "object",
+					"properties": {
+						"strand": {"enum": ["+", "-", "mixed"]},
+						"ranges": {
+							"type": "array",
+							"items": {
+								"type": "object",
+								"properties": {
+									"start": {"type": "integer"},
+									"end": {"type": "integer"},
+									"start_partial": {"type": "boolean"},
+									"end_partial": {"type": "boolean"},
+									"between": {"type": "boolean"}
+								},
+								"required": ["start", "end"],
+								"additionalProperties": false
+							}
+						}
+					}
+				}
+			},
+			"additionalProperties": {"type": ["string", "null"]}
+		},
+		"feature": {
+			"type": "object",
+			"minProperties": 1,
+			"maxProperties": 1,
+			"additionalProperties": {
+				"type": "array",
+				"items": [{"$ref": "#/definitions/location"}],
+				"minItems": 1,
+				"additionalItems": {"$ref": "#/definitions/qualifier"}
+			}
+		},
+		"entry": {
+			"type": "object",
+			"maxProperties": 1,
+			"properties": {
+				"FEATURES": {"type": "array", "items": {"$ref": "#/definitions/feature"}},
+				"SEQUENCE": {
+					"type": "array",
+					"items": [
+						{"$ref": "#/definitions/sequence"},
+						{"type": "array", "maxItems": 0}
+					],
+					"minItems": 2,
+					"additionalItems": false
+				}
+			},
+			"additionalProperties": {"$ref": "#/definitions/keywordValue"}
+		},
+		"recordOrEntry": {
+			"type": ["array", "object"],
+			"items": [{"$ref": "#/definitions/locus"}],
+			"minItems": 1,
+			"additionalItems": {"$ref": "#/definitions/entry"},
+			"maxProperties": 1,
+			"properties": {
+				"FEATURES": {"$ref": "#/definitions/entry/properties/FEATURES"},
+				"SEQUENCE": {"$ref": "#/definitions/entry/properties/SEQUENCE"}
+			},
+			"additionalProperties": {"$ref": "#/definitions/keywordValue"}
+		}
+	},
+	"type": ["array", "object"],
+	"items": {"$ref": "#/definitions/recordOrEntry"},
+	"minProperties": 1,
+	"maxProperties": 1,
+	"additionalProperties": {"$ref": "#/definitions/keywordValue"}
+})";
+
+/**
+ * JSON Schema of the gbjson layout. A top level value is an array of
+ * release headers and records, or a single record or header as in
+ * JSON Lines. The schema has no anyOf, so that a violation fails
+ * validation at once rather than at the end of the array: objects and
+ * arrays are told apart by keywords that apply to one type only.
+ * @return The schema text.
+ */
+const char *layoutSchema()
+{
+	return layoutSchemaText;
+}
+
+/**
+ * The layout schema, compiled on first use.
+ */
+static const rapidjson::SchemaDocument *compiledLayoutSchema()
+{
+	static const rapidjson::SchemaDocument schema = []() {
+		rapidjson::Document document;
+		document.Parse(layoutSchemaText);
+		return rapidjson::SchemaDocument(document);
+	}();
+	return &schema;
+}
+
+/**
+ * Parse every top level value of a stream into a JSON handler. With
+ * validation, the events pass a schema validator on their way to the
+ * handler, so that JSON is checked against the layout in the same pass
+ * as it is converted. The handler sees no event that breaks the layout.
+ * @param[in] reader The JSON reader.
+ * @param[in] stream The JSON stream. Peek returns '\0' at the end.
+ * @param[in,out] handler The handler. Its error is set if the JSON breaks the layout.
+ * @param[in] validate Validate against the layout schema?
+ * @param[in] commas Skip a comma after each value, as in a chunk of array elements.
+ */
+template <unsigned parseFlags, typename Stream>
+static void parseRecords(rapidjson::Reader *reader, Stream *stream, JSONHandler *handler, bool validate, bool commas = false)
+{
+	if (!validate)
+	{
+		parseValues<parseFlags>(reader, stream, handler, commas);
+		return;
+	}
+
+	rapidjson::GenericSchemaValidator<rapidjson::SchemaDocument, JSONHandler> validator(*compiledLayoutSchema(), *handler);
+
+	rapidjson::SkipWhitespace(*stream);
+	while (stream->Peek() != '\0')
+	{
+		validator.Reset(); // Each value is validated on its own
+		if (reader->Parse<parseFlags | rapidjson::kParseStopWhenDoneFlag>(*stream, validator).IsError())
+		{
+			if (!validator.IsValid() && handler->error.empty())
+			{
+				rapidjson::StringBuffer pointer;
+				validator.GetInvalidDocumentPointer().StringifyUriFragment(pointer);
+				handler->error = "JSON at offset " + std::to_string(reader->GetErrorOffset()) + " does not follow the gbjson layout: " +
+								 validator.GetInvalidSchemaKeyword() + " at " + pointer.GetString();
+			}
+			break;
+		}
+		rapidjson::SkipWhitespace(*stream);
+		if (commas && stream->Peek() == ',')
+		{
+			stream->Take();
+			rapidjson::SkipWhitespace(*stream);
+		}
+	}
+}
+
+/**
+ * Streaming JSON to GenBank converter. The JSON is read in chunks and the
+ * GenBank text of each record is written out once it is complete, so
+ * memory use does not grow with the number of records. gzip and zstd
+ * input is decompressed on a separate thread, and the output is
+ * compressed as set in the options.
+ * @param[in] json The JSON input file.
+ * @param[in] gb The GenBank output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gbStream(FILE *json, FILE *gb, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+	gbstats *stats = opts->stats;
+
+	JSONHandler handler;
+	handler.gb.file = gb;
+	handler.gb.stats = stats;
+	handler.sequences = opts->sequences;
+	if (!handler.gb.compress(opts->compression))
+	{
+		err->flag = true;
+		err->msg = std::string("No ") + compressionName(opts->compression) + " support";
+		err->source = "json2gbStream";
+		return;
+	}
+
+	// Compressed input is read on another thread, and with a pipeline
+	// plain input and the output as well
+	ChunkReader input(json, opts->pipeline);
+	if (opts->pipeline)
+	{
+		handler.gb.startWriter();
+	}
+
+	rapidjson::Reader reader;
+	double readWait = 0;
+	ChunkReadStream cstream(&input, stats ? &readWait : nullptr);
+
+	// Writes on this thread are timed by the sink
+	double elapsed = 0, writeTime = stats ? stats->writeTime : 0;
+	{
+		PhaseTimer timer(stats ? &elapsed : nullptr);
+		parseRecords<rapidjson::kParseDefaultFlags>(&reader, &cstream, &handler, opts->validate);
+	}
+	if (stats)
+	{
+		handler.counts.parseTime = elapsed - readWait - (stats->writeTime - writeTime);
+	}
+
+	handler.gb.close();
+	handler.counts.readTime = input.close();
+	{
+		PhaseTimer timer(PHASE(stats, writeTime));
+		fflush(gb);
+	}
+
+	if (stats)
+	{
+		handler.counts.bytesIn = cstream.Tell();
+		stats->add(&handler.counts);
+	}
+
+	if (input.error())
+	{
+		err->flag = true;
+		err->msg = *input.error();
+		err->source = "json2gbStream";
+	}
+	else if (reader.HasParseError())
+	{
+		err->flag = true;
+		err->msg = handler.error.empty() ? "Unable to parse JSON" : handler.error;
+		err->source = "json2gbStream";
+	}
+	else if (handler.gb.failed || ferror(gb))
+	{
+		err->flag = true;
+		err->msg = "Failed writing GenBank";
+		err->source = "json2gbStream";
+	}
+}
+
+/**
+ * Read-write memory stream for in-situ parsing. Unlike
+ * rapidjson::InsituStringStream, the buffer need not be null-terminated.
+ */
+struct InsituMemoryStream
+{
+	typedef char Ch;
+
+	InsituMemoryStream(char *src, size_t len) : src(src), dst(nullptr), head(src), end(src + len) {}
+
+	// Read
+	Ch Peek() const { return src == end ? '\0' : *src; }
+	Ch Take() { return src == end ? '\0' : *src++; }
+	size_t Tell() const { return static_cast<size_t>(src - head); }
+
+	// Write
+	void Put(Ch c) { *dst++ = c; }
+	Ch *PutBegin() { return dst = src; }
+	size_t PutEnd(Ch *begin) { return static_cast<size_t>(dst - begin); }
+	void Flush() {}
+
+	Ch *Push(size_t count)
+	{
+		Ch *begin = dst;
+		dst += count;
+		return begin;
+	}
+	void Pop(size_t count) { dst -= count; }
+
+	char *src;		 ///< Read position.
+	char *dst;		 ///< Write position.
+	char *head;		 ///< Start of the buffer.
+	const char *end; ///< End of the buffer.
+};
+
+/**
+ * JSON to GenBank converter.
+ * @param[in] json The JSON string.
+ * @param[out] gb The GenBank string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gb(const std::string *json, std::string *gb, gberror *err, const gboptions *opts)
+{
+	json2gb(json->data(), json->size(), gb, err, opts);
+}
+
+/**
+ * Add the counts of a finished in-memory conversion to optional statistics.
+ * @param[in] handler The handler.
+ * @param[in] len The JSON length.
+ * @param[in] opts Conversion options, or nullptr.
+ */
+static void addStats(JSONHandler *handler, size_t len, const gboptions *opts)
+{
+	if (opts && opts->stats)
+	{
+		handler->counts.bytesIn = len;
+		handler->counts.bytesOut = handler->gb.buffer.size();
+		opts->stats->add(&handler->counts);
+	}
+}
+
+/**
+ * Parse in-memory JSON into a handler.
+ * @param[in] reader The JSON reader.
+ * @param[in] stream The JSON stream.
+ * @param[in,out] handler The handler, in its initial state.
+ * @param[in] len The JSON length.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options, or nullptr.
+ * @param[in] source Name of the converter for errors.
+ * @return True if the GenBank output is complete.
+ */
+template <unsigned parseFlags, typename Stream>
+static bool parseJSON(
+	rapidjson::Reader *reader,
+	Stream *stream,
+	JSONHandler *handler,
+	size_t len,
+	gberror *err,
+	const gboptions *opts,
+	const char *source)
+{
+	handler->sequences = opts ? opts->sequences : nullptr;
+	{
+		PhaseTimer timer(opts ? PHASE(opts->stats, parseTime) : nullptr);
+		parseRecords<parseFlags>(reader, stream, handler, opts && opts->validate);
+	}
+
+	if (reader->HasParseError())
+	{
+		err->flag = true;
+		err->msg = handler->error.empty() ? "Unable to parse JSON" : handler->error;
+		err->source = source;
+		return false;
+	}
+
+	addStats(handler, len, opts);
+	return true;
+}
+
+// JSON whitespace
+static inline bool isJSONSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+/**
+ * Skip JSON whitespace.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] pos The start position.
+ * @return The position of the next other character, or len.
+ */
+static size_t skipJSONSpace(const char *json, size_t len, size_t pos)
+{
+	while (pos < len && isJSONSpace(json[pos]))
+	{
+		pos++;
+	}
+	return pos;
+}
+
+/**
+ * Find the end of an object or array by its bracket depth, skipping
+ * brackets in strings.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] pos Position of the opening bracket.
+ * @return The position after the closing bracket, or std::string::npos if there is none.
+ */
+static size_t skipJSONValue(const char *json, size_t len, size_t pos)
+{
+	int depth = 0;
+
+	for (; pos < len; pos++)
+	{
+		char c = json[pos];
+		if (c == '"')
+		{
+			// Jump to the closing quote, which has an even number of backslashes before it
+			for (;;)
+			{
+				const char *quote = static_cast<const char *>(memchr(json + pos + 1, '"', len - pos - 1));
+				if (!quote)
+				{
+					return std::string::npos;
+				}
+				size_t close = quote - json;
+				size_t escape = close;
+				while (escape > pos + 1 && json[escape - 1] == '\\')
+				{
+					escape--;
+				}
+				pos = close;
+				if ((close - escape) % 2 == 0)
+				{
+					break;
+				}
+			}
 		}
-		else
+		else if (c == '[' || c == '{')
 		{
-			writer->String(buffer.c_str(), buffer.length(), true);
+			depth++;
+		}
+		else if ((c == ']' || c == '}') && --depth == 0)
+		{
+			return pos + 1;
 		}
-		writer->StartArray(); // Dummy array for sub keywords
-		writer->EndArray();   // Dummy array for sub keywords
-		writer->EndArray();
 	}
-	else if (isSequence(line))
+
+	return std::string::npos;
+}
+
+/**
+ * Split JSON into chunks of whole records for a parallel conversion. A
+ * structural pre-scan finds the elements of the top level array, or the
+ * values of JSON Lines. Chunks only start at records, so each chunk
+ * converts on a new handler as it would in sequence, and release headers
+ * stay with the records before them.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] target Minimum chunk size, except for the last chunk.
+ * @param[out] chunks The chunks.
+ * @param[out] commas Are the values in the chunks separated by commas?
+ * @return False if the JSON is neither an array nor lines of arrays and objects.
+ */
+static bool splitValues(const char *json, size_t len, size_t target, std::vector<std::string_view> *chunks, bool *commas)
+{
+	size_t pos = skipJSONSpace(json, len, 0);
+	if (pos == len || (json[pos] != '[' && json[pos] != '{'))
 	{
-		// Consume the sequence lines
-		while (isSequence(line))
+		return false;
+	}
+
+	// An array starting with an object is a record in JSON Lines if the
+	// object is followed by another one, i.e. the next keyword
+	bool lines = json[pos] == '{';
+	if (!lines)
+	{
+		size_t first = skipJSONSpace(json, len, pos + 1);
+		if (first < len && json[first] == '{')
 		{
-			splitSequenceLine(line, &front, &back);
-			buffer.append(back);
-			safeGetline(*gbstream, *line);
+			size_t next = skipJSONValue(json, len, first);
+			next = skipJSONSpace(json, len, next == std::string::npos ? len : next);
+			if (next < len && json[next] == ',')
+			{
+				next = skipJSONSpace(json, len, next + 1);
+			}
+			lines = next < len && json[next] == '{';
 		}
+	}
 
-		// Write the data
-		writer->Key("SEQUENCE");
-		writer->StartArray();
-		if (buffer.empty())
+	if (!lines)
+	{
+		pos++; // Into the top level array
+	}
+	*commas = !lines;
+
+	size_t start = pos; // Start of the current chunk
+	size_t end = len;	// End of the values
+	for (;;)
+	{
+		pos = skipJSONSpace(json, len, pos);
+		if (pos == len)
 		{
-			writer->Null();
+			if (!lines)
+			{
+				return false; // Unclosed array
+			}
+			break;
 		}
-		else
+
+		char c = json[pos];
+		if (!lines && c == ']' && pos == start)
 		{
-			writer->String(buffer.c_str(), buffer.length(), true);
+			// Empty array
+			end = pos;
+			if (skipJSONSpace(json, len, pos + 1) != len)
+			{
+				return false;
+			}
+			break;
 		}
-		writer->StartArray(); // Dummy array for sub keywords
-		writer->EndArray();   // Dummy array for sub keywords
-		writer->EndArray();
+		if (c != '[' && c != '{')
+		{
+			return false;
+		}
+
+		if (c == '[' && pos - start >= target)
+		{
+			chunks->emplace_back(json + start, pos - start);
+			start = pos;
+		}
+
+		pos = skipJSONValue(json, len, pos);
+		if (pos == std::string::npos)
+		{
+			return false;
+		}
+
+		if (!lines)
+		{
+			// Elements are followed by a comma and another element or the end
+			pos = skipJSONSpace(json, len, pos);
+			if (pos < len && json[pos] == ']')
+			{
+				end = pos;
+				if (skipJSONSpace(json, len, pos + 1) != len)
+				{
+					return false;
+				}
+				break;
+			}
+			if (pos == len || json[pos] != ',')
+			{
+				return false;
+			}
+			pos = skipJSONSpace(json, len, pos + 1);
+			if (pos < len && json[pos] == ']')
+			{
+				return false; // Trailing comma
+			}
+		}
+	}
+
+	chunks->emplace_back(json + start, end - start);
+	return true;
+}
+
+/**
+ * Record-parallel JSON to GenBank converter. Chunks of records are
+ * converted on handlers of their own, and their GenBank text is kept in
+ * order to be joined by the caller.
+ * @param[in] json The JSON buffer. It is overwritten when parsing in situ.
+ * @param[in] len The buffer length.
+ * @param[out] fragments The GenBank text of the chunks.
+ * @param[out] err Error object.
+ * @param[in] threads Number of threads.
+ * @param[in] opts Conversion options.
+ * @param[in] source Name of the converter for errors.
+ * @return False if the JSON cannot be split. It is then not converted.
+ */
+template <unsigned parseFlags, typename Stream, typename Char>
+static bool json2gbParallel(Char *json, size_t len, std::vector<std::string> *fragments, gberror *err, int threads, const gboptions *opts, const char *source)
+{
+	gbstats *stats = opts->stats;
+
+	// Several chunks per thread balance the load
+	size_t target = std::max(len / (threads * 8), parallelChunk);
+
+	std::vector<std::string_view> chunks;
+	bool commas;
+	{
+		PhaseTimer timer(PHASE(stats, scanTime));
+		if (!splitValues(json, len, target, &chunks, &commas) || chunks.size() < 2)
+		{
+			return false;
+		}
+	}
+
+	PhaseTimer timer(PHASE(stats, parseTime));
+
+	fragments->assign(chunks.size(), std::string());
+	std::vector<std::string> errors(chunks.size());
+	std::vector<char> failed(chunks.size());
+	std::vector<gbstats> counts(chunks.size());
+
+	parallelFor(chunks.size(), threads, [&](size_t i) {
+		JSONHandler handler;
+		rapidjson::Reader reader;
+
+		Stream stream(json + (chunks[i].data() - json), chunks[i].size());
+		parseRecords<parseFlags>(&reader, &stream, &handler, opts->validate, commas);
+		if (reader.HasParseError())
+		{
+			failed[i] = true;
+			errors[i] = handler.error.empty() ? "Unable to parse JSON" : handler.error;
+			return;
+		}
+		(*fragments)[i] = std::move(handler.gb.buffer);
+		counts[i] = handler.counts;
+	});
+
+	auto first = std::find(failed.begin(), failed.end(), true);
+	if (first != failed.end())
+	{
+		err->flag = true;
+		err->msg = errors[first - failed.begin()];
+		err->source = source;
+		fragments->clear();
+		return true;
+	}
+
+	if (stats)
+	{
+		for (auto &c : counts)
+		{
+			stats->add(&c);
+		}
+		stats->bytesIn += len;
+	}
+	return true;
+}
+
+/**
+ * Join the GenBank text of a parallel conversion.
+ * @param[in] fragments The GenBank text of the chunks.
+ * @param[out] gb The GenBank string.
+ * @param[in] opts Conversion options.
+ */
+static void joinGenBank(const std::vector<std::string> *fragments, std::string *gb, const gboptions *opts)
+{
+	size_t outLen = 0;
+	for (auto &f : *fragments)
+	{
+		outLen += f.size();
+	}
+
+	gb->clear();
+	gb->reserve(outLen);
+	for (auto &f : *fragments)
+	{
+		gb->append(f);
+	}
+
+	if (opts->stats)
+	{
+		opts->stats->bytesOut += gb->size();
+	}
+}
+
+/**
+ * JSON to GenBank converter for a character buffer, e.g. a mapped file.
+ * Large inputs are converted on the threads of the options.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[out] gb The GenBank string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gb(const char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts)
+{
+	int threads = opts ? conversionThreads(len, opts) : 1;
+	std::vector<std::string> fragments;
+	if (threads > 1 && json2gbParallel<rapidjson::kParseDefaultFlags, rapidjson::MemoryStream>(json, len, &fragments, err, threads, opts, "json2gb"))
+	{
+		if (!err->flag)
+		{
+			joinGenBank(&fragments, gb, opts);
+		}
+		return;
+	}
+
+	JSONHandler handler;
+	rapidjson::Reader reader;
+
+	rapidjson::MemoryStream mstream(json, len);
+	if (parseJSON<rapidjson::kParseDefaultFlags>(&reader, &mstream, &handler, len, err, opts, "json2gb"))
+	{
+		*gb = std::move(handler.gb.buffer);
+	}
+}
+
+/**
+ * In-situ JSON to GenBank converter. JSON strings are decoded inside the
+ * input buffer and handed to the handler without copying, so the buffer
+ * is overwritten. Large inputs are converted on the threads of the options.
+ * @param[in,out] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[out] gb The GenBank string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gbInsitu(char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts)
+{
+	int threads = opts ? conversionThreads(len, opts) : 1;
+	std::vector<std::string> fragments;
+	if (threads > 1 && json2gbParallel<rapidjson::kParseInsituFlag, InsituMemoryStream>(json, len, &fragments, err, threads, opts, "json2gbInsitu"))
+	{
+		if (!err->flag)
+		{
+			joinGenBank(&fragments, gb, opts);
+		}
+		return;
+	}
+
+	JSONHandler handler;
+	rapidjson::Reader reader;
+
+	InsituMemoryStream istream(json, len);
+	if (parseJSON<rapidjson::kParseInsituFlag>(&reader, &istream, &handler, len, err, opts, "json2gbInsitu"))
+	{
+		*gb = std::move(handler.gb.buffer);
+	}
+}
+
+/**
+ * In-situ JSON to GenBank converter for a string. The string is overwritten.
+ * @param[in,out] json The JSON string.
+ * @param[out] gb The GenBank string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gbInsitu(std::string *json, std::string *gb, gberror *err, const gboptions *opts)
+{
+	json2gbInsitu(&(*json)[0], json->size(), gb, err, opts);
+}
+
+/**
+ * JSON to GenBank converter writing to a file or an output callback,
+ * whichever is set. The GenBank text is written out record by record,
+ * and compressed as set in the options.
+ * @param[in,out] json The JSON buffer. It is overwritten when parsing in situ.
+ * @param[in] len The buffer length.
+ * @param[in] gb The GenBank output file, or nullptr.
+ * @param[in] write The output callback, or nullptr.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @param[in] source Name of the converter for errors.
+ * @param[in,out] state Buffers of a Converter, or nullptr for buffers of this call.
+ */
+template <unsigned parseFlags, typename Stream, typename Char>
+static void json2gbFile(Char *json, size_t len, FILE *gb, gbwrite write, void *user, gberror *err, const gboptions *opts, const char *source, ConverterState *state)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+	gbstats *stats = opts->stats;
+	std::unique_ptr<ConverterState> local;
+	if (!state)
+	{
+		local.reset(new ConverterState);
+		state = local.get();
+	}
+
+	JSONHandler &handler = state->handler;
+	handler.reset();
+	if (!handler.gb.compress(opts->compression))
+	{
+		err->flag = true;
+		err->msg = std::string("No ") + compressionName(opts->compression) + " support";
+		err->source = source;
+		return;
+	}
+	handler.gb.file = gb;
+	handler.gb.callback = write;
+	handler.gb.user = user;
+	handler.gb.stats = stats;
+	handler.sequences = opts->sequences;
+	if (opts->pipeline)
+	{
+		handler.gb.startWriter();
+	}
+
+	int threads = conversionThreads(len, opts);
+	std::vector<std::string> fragments;
+	if (threads > 1 && json2gbParallel<parseFlags, Stream>(json, len, &fragments, err, threads, opts, source))
+	{
+		for (auto &f : fragments)
+		{
+			handler.gb.write(f.data(), f.size());
+		}
+	}
+	else
+	{
+		rapidjson::Reader &reader = state->reader;
+		Stream stream(json, len);
+
+		// Writes on this thread are timed by the sink
+		double elapsed = 0, writeTime = stats ? stats->writeTime : 0;
+		{
+			PhaseTimer timer(stats ? &elapsed : nullptr);
+			parseRecords<parseFlags>(&reader, &stream, &handler, opts->validate);
+		}
+
+		if (reader.HasParseError())
+		{
+			err->flag = true;
+			err->msg = handler.error.empty() ? "Unable to parse JSON" : handler.error;
+			err->source = source;
+		}
+		else if (stats)
+		{
+			handler.counts.parseTime = elapsed - (stats->writeTime - writeTime);
+			handler.counts.bytesIn = len;
+			stats->add(&handler.counts);
+		}
+	}
+
+	handler.gb.close();
+	if (gb)
+	{
+		PhaseTimer timer(PHASE(stats, writeTime));
+		fflush(gb);
+	}
+
+	if (!err->flag && (handler.gb.failed || (gb && ferror(gb))))
+	{
+		err->flag = true;
+		err->msg = "Failed writing GenBank";
+		err->source = source;
 	}
+
+	// Detach the output from a handler kept for later calls
+	handler.gb.file = nullptr;
+	handler.gb.callback = nullptr;
+	handler.gb.user = nullptr;
+	handler.gb.stats = nullptr;
+}
+
+/**
+ * JSON to GenBank converter for a character buffer writing to a file.
+ * Large inputs are converted on the threads of the options.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] gb The GenBank output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gb(const char *json, size_t len, FILE *gb, gberror *err, const gboptions *opts)
+{
+	json2gbFile<rapidjson::kParseDefaultFlags, rapidjson::MemoryStream>(json, len, gb, nullptr, nullptr, err, opts, "json2gb", nullptr);
+}
+
+/**
+ * In-situ JSON to GenBank converter writing to a file. The buffer is overwritten.
+ * @param[in,out] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] gb The GenBank output file.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gbInsitu(char *json, size_t len, FILE *gb, gberror *err, const gboptions *opts)
+{
+	json2gbFile<rapidjson::kParseInsituFlag, InsituMemoryStream>(json, len, gb, nullptr, nullptr, err, opts, "json2gbInsitu", nullptr);
+}
+
+/**
+ * JSON to GenBank converter for a character buffer writing to an output
+ * callback. Large inputs are converted on the threads of the options.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void json2gb(const char *json, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts)
+{
+	json2gbFile<rapidjson::kParseDefaultFlags, rapidjson::MemoryStream>(json, len, nullptr, write, user, err, opts, "json2gb", nullptr);
+}
+
+/**
+ * JSON to GenBank converter returning the GenBank string.
+ * @param[in] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The GenBank string, empty on error.
+ */
+std::string json2gb(const std::string *json, gberror *err, const gboptions *opts)
+{
+	std::string gb;
+	json2gb(json->data(), json->size(), &gb, err, opts);
+	return gb;
 }
 
 /**
- * Delegator function for parsing GenBank items.
- * @param[in] gbstream The input string stream.
- * @param[out] line The line buffer.
- * @param[in] writer The JSON writer object.
+ * JSON to GenBank converter taking over the JSON string, which is
+ * parsed in situ.
+ * @param[in] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The GenBank string, empty on error.
  */
-static void parseItem(
-	std::stringstream *gbstream,
-	std::string *line,
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> *writer)
+std::string json2gb(std::string &&json, gberror *err, const gboptions *opts)
 {
+	std::string input(std::move(json));
+	std::string gb;
+	json2gbInsitu(&input, &gb, err, opts);
+	return gb;
+}
 
-	if (isLocus(line))
-	{
-		writer->StartArray(); // Start the GenBank array
+/***************************************************************
+ * Reusable converter
+ ***************************************************************/
 
-		writer->StartObject();
-		parseLocus(gbstream, line, writer);
-		writer->EndObject();
-	}
-	else if (isEnd(line))
+/**
+ * Constructor.
+ */
+Converter::Converter() : state(new ConverterState) {}
+
+/**
+ * Destructor.
+ */
+Converter::~Converter()
+{
+	delete state;
+}
+
+/**
+ * GenBank to JSON converter. Small inputs are converted serially with the
+ * kept buffers, large ones as by the free function gb2json.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] json The JSON string. Its memory is reused.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void Converter::gb2json(const char *gb, size_t len, std::string *json, gberror *err, const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
 	{
-		writer->EndArray(); // Start the GenBank array
-		safeGetline(*gbstream, *line);
+		opts = &defaults;
 	}
-	else if (isOrigin(line))
-	{
-		writer->StartObject();
-		parseOrigin(gbstream, line, writer);
-		writer->EndObject();
 
-		writer->StartObject();
-		parseSequence(gbstream, line, writer);
-		writer->EndObject();
+	if (conversionThreads(len, opts) > 1)
+	{
+		::gb2json(gb, len, json, err, opts);
+		return;
 	}
-	else if (isKeyword(line) && !isFeatureHeader(line))
+
+	if (opts->ndjson)
 	{
-		writer->StartObject();
-		parseKeyword(gbstream, line, writer, 0);
-		writer->EndObject();
+		gb2jsonSerial(gb, len, json, err, opts, &state->buffer, &state->linesWriter, &state->text);
 	}
-	else if (isFeatureHeader(line))
+	else if (opts->compact)
 	{
-		writer->StartObject();
-		parseFeatures(gbstream, line, writer);
-		writer->EndObject();
+		gb2jsonSerial(gb, len, json, err, opts, &state->buffer, &state->writer, &state->text);
 	}
 	else
 	{
-		safeGetline(*gbstream, *line);
+		gb2jsonSerial(gb, len, json, err, opts, &state->buffer, &state->prettyWriter, &state->text);
+	}
+
+	if (opts->stats && !err->flag)
+	{
+		opts->stats->bytesIn += len;
+		opts->stats->bytesOut += json->size();
 	}
 }
 
-/***************************************************************
-* GenBank to JSON converter
-***************************************************************/
+/**
+ * GenBank to JSON converter writing to an output callback, as the free
+ * function, on the buffers of the converter.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void Converter::gb2json(const char *gb, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts)
+{
+	gb2jsonOutput(gb, len, nullptr, write, user, err, opts, state);
+}
 
 /**
- * GenBank to JSON converter.
+ * GenBank to JSON converter returning the JSON string.
  * @param[in] gb The GenBank string.
- * @param[out] json The JSON string.
  * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The JSON string, empty on error.
  */
-void gb2json(const std::string *gb, std::string *json, gberror *err)
+std::string Converter::gb2json(const std::string *gb, gberror *err, const gboptions *opts)
 {
-	// Initialize stream object
-	std::stringstream gbstream(*gb);
-	std::string line;
+	std::string json;
+	gb2json(gb->data(), gb->size(), &json, err, opts);
+	return json;
+}
 
-	// Initialize the writer
-	rapidjson::StringBuffer buffer;
-	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+/**
+ * JSON to GenBank converter. Small inputs are converted serially with the
+ * kept handler, large ones as by the free function json2gb.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[out] gb The GenBank string. Its memory is reused.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void Converter::json2gb(const char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts)
+{
+	if (opts && conversionThreads(len, opts) > 1)
+	{
+		::json2gb(json, len, gb, err, opts);
+		return;
+	}
 
-	// Start the parsing
-	safeGetline(gbstream, line);
-	writer.StartArray();
+	state->handler.reset();
 
-	while (!gbstream.eof())
+	rapidjson::MemoryStream mstream(json, len);
+	if (parseJSON<rapidjson::kParseDefaultFlags>(&state->reader, &mstream, &state->handler, len, err, opts, "json2gb"))
 	{
-		parseItem(&gbstream, &line, &writer);
+		gb->assign(state->handler.gb.buffer);
 	}
+}
 
-	// Close the JSON array and write to string
-	writer.EndArray();
-
-	if (!writer.IsComplete())
+/**
+ * In-situ JSON to GenBank converter. The buffer is overwritten. Large
+ * inputs are converted as by the free function json2gbInsitu.
+ * @param[in,out] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[out] gb The GenBank string. Its memory is reused.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void Converter::json2gbInsitu(char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts)
+{
+	if (opts && conversionThreads(len, opts) > 1)
 	{
-		err->flag = true;
-		err->msg = "Incomplete GenBank";
-		err->source = "gb2json";
+		::json2gbInsitu(json, len, gb, err, opts);
+		return;
 	}
-	else
+
+	state->handler.reset();
+
+	InsituMemoryStream istream(json, len);
+	if (parseJSON<rapidjson::kParseInsituFlag>(&state->reader, &istream, &state->handler, len, err, opts, "json2gbInsitu"))
 	{
-		*json = buffer.GetString();
+		gb->assign(state->handler.gb.buffer);
 	}
 }
 
-/***************************************************************
- * JSON to GenBank converter
- * This feeds a events from a JSON stream into a rapidjson handler
- * object. The handler builds the GenBank string.
- ***************************************************************/
-
 /**
-   * Handler constructor.
-   */
-JSONHandler::JSONHandler() : state(START), nwritten(0), skipStateUpdate(false) {}
+ * JSON to GenBank converter returning the GenBank string.
+ * @param[in] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The GenBank string, empty on error.
+ */
+std::string Converter::json2gb(const std::string *json, gberror *err, const gboptions *opts)
+{
+	std::string gb;
+	json2gb(json->data(), json->size(), &gb, err, opts);
+	return gb;
+}
 
-// Unused handler functions
-bool JSONHandler::Bool(bool b) { return true; }
-bool JSONHandler::Int(int i) { return true; }
-bool JSONHandler::Uint(unsigned i) { return true; }
-bool JSONHandler::Int64(int64_t i) { return true; }
-bool JSONHandler::Uint64(uint64_t i) { return true; }
-bool JSONHandler::Double(double d) { return true; }
-bool JSONHandler::RawNumber(const char *str, rapidjson::SizeType length, bool copy) { return true; }
+/**
+ * JSON to GenBank converter taking over the JSON string, which is
+ * parsed in situ.
+ * @param[in] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The GenBank string, empty on error.
+ */
+std::string Converter::json2gb(std::string &&json, gberror *err, const gboptions *opts)
+{
+	std::string input(std::move(json));
+	std::string gb;
+	json2gbInsitu(&input[0], input.size(), &gb, err, opts);
+	return gb;
+}
 
 /**
- * Update handler state based on a JSON key.
- * @param[in] key The key.
+ * JSON to GenBank converter writing to an output callback, as the free
+ * function, on the JSON handler and reader of the converter.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
  */
-void JSONHandler::updateState(const std::string key)
+void Converter::json2gb(const char *json, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts)
 {
-	if (state == QUALIFIER && key == "Location")
-	{
-		state = QUALIFIER_LOCATION;
-	}
-	else if (state == QUALIFIER_LOCATION)
-	{
-		state = QUALIFIER;
-	}
-	else if (key == "LOCUS")
-	{
-		state = LOCUS;
-		skipStateUpdate = true;
-	}
-	else if (key == "ORIGIN")
-	{
-		state = ORIGIN;
-		skipStateUpdate = true;
-	}
-	else if (key == "SEQUENCE")
-	{
-		state = SEQUENCE;
-		skipStateUpdate = true;
-	}
-	else if (key == "CONTIG")
-	{
-		state = CONTIG;
-		skipStateUpdate = true;
-	}
-	else if (key == "FEATURES")
-	{
-		state = FEATURE_HEADER;
-	}
-	else if (!skipStateUpdate && (state == KEYWORD || state == SUBKEYWORD || state == SUBSUBKEYWORD))
-	{
-		skipStateUpdate = true;
-	}
-	return;
+	json2gbFile<rapidjson::kParseDefaultFlags, rapidjson::MemoryStream>(json, len, nullptr, write, user, err, opts, "json2gb", state);
 }
 
-bool JSONHandler::StartArray()
+/***************************************************************
+ * Incremental conversion
+ * A new release is converted against the JSON of the previous
+ * one. Records that are unchanged, by accession.version, length
+ * and hash, are copied from the previous JSON, and only the
+ * others are parsed.
+ ***************************************************************/
+
+/**
+ * Find the fragments of the records in JSON written by gb2json. A
+ * fragment is what a writer emits for the record inside the top level
+ * array: the whitespace after the preceding comma and the record, or for
+ * JSON Lines the record and its line ending. Other values, e.g. the
+ * release header, are skipped.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] lines Is the JSON in JSON Lines?
+ * @param[out] records The record fragments.
+ * @return False if the JSON is not an array, or lines, of values.
+ */
+static bool recordFragments(const char *json, size_t len, bool lines, std::vector<std::string_view> *records)
 {
-	switch (state)
+	size_t pos = skipJSONSpace(json, len, 0);
+	if (!lines)
 	{
-	case KEYWORD:
+		if (pos == len || json[pos] != '[')
+		{
+			return false;
+		}
+		pos++;
+	}
+
+	for (bool first = true;; first = false)
 	{
-		if (skipStateUpdate)
+		size_t start = pos; // After the preceding comma
+		pos = skipJSONSpace(json, len, pos);
+		if (pos == len)
 		{
-			skipStateUpdate = false;
+			return lines;
 		}
-		else
+		if (!lines && json[pos] == ']' && first)
 		{
-			state = SUBKEYWORD;
+			return skipJSONSpace(json, len, pos + 1) == len; // Empty array
 		}
-		break;
-	}
-	case SUBKEYWORD:
-	{
-		if (skipStateUpdate)
+		if (lines)
 		{
-			skipStateUpdate = false;
+			start = pos;
 		}
-		else
+
+		char c = json[pos];
+		size_t end = skipJSONValue(json, len, pos);
+		if ((c != '[' && c != '{') || end == std::string::npos)
 		{
-			state = SUBSUBKEYWORD;
+			return false;
 		}
-		break;
-	}
-	case LOCUS:
-	{
-		if (skipStateUpdate)
+		pos = end;
+
+		if (lines)
 		{
-			skipStateUpdate = false;
+			// Values end their lines
+			if (pos == len || json[pos] != '\n')
+			{
+				return false;
+			}
+			pos++;
 		}
-		else
+		if (c == '[')
 		{
-			state = LOCUSSUB;
+			records->emplace_back(json + start, pos - start);
+		}
+
+		if (!lines)
+		{
+			pos = skipJSONSpace(json, len, pos);
+			if (pos < len && json[pos] == ']')
+			{
+				return skipJSONSpace(json, len, pos + 1) == len;
+			}
+			if (pos == len || json[pos] != ',')
+			{
+				return false;
+			}
+			pos++;
 		}
-		break;
 	}
-	case ORIGIN:
+}
+
+/**
+ * Test whether a record fragment has a LOCUS line with the given name.
+ * @param[in] fragment The record fragment.
+ * @param[in] locus The LOCUS name.
+ * @return True if the LOCUS line starts with the name.
+ */
+static bool fragmentNamed(std::string_view fragment, const std::string *locus)
+{
+	size_t key = fragment.find("\"LOCUS\"");
+	size_t quote = key == std::string_view::npos ? key : fragment.find('"', key + 7);
+	size_t end = quote + 1 + locus->size(); // After the name
+	return quote != std::string_view::npos && end < fragment.size() &&
+		   fragment.compare(quote + 1, locus->size(), *locus) == 0 && (fragment[end] == ' ' || fragment[end] == '"');
+}
+
+// Name a record is matched by between releases
+static inline const std::string *releaseKey(const gbentry *entry)
+{
+	return !entry->version.empty() ? &entry->version : !entry->accession.empty() ? &entry->accession : &entry->locus;
+}
+
+/**
+ * Incremental GenBank to JSON converter for a writer type.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] index The index of the buffer.
+ * @param[in] previous The JSON of the previous release.
+ * @param[in] previousLen Its length.
+ * @param[in] previousIndex The index of the previous release.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options.
+ * @return The number of records converted.
+ */
+template <typename Writer>
+static size_t gb2jsonIncremental(
+	const char *gb,
+	size_t len,
+	const gbindex *index,
+	const char *previous,
+	size_t previousLen,
+	const gbindex *previousIndex,
+	std::string *json,
+	gberror *err,
+	const gboptions *opts)
+{
+	auto fail = [err](std::string msg) {
+		err->flag = true;
+		err->msg = std::move(msg);
+		err->source = "gb2jsonIncremental";
+		return 0;
+	};
+
+	if (index->size != len)
 	{
-		if (skipStateUpdate)
+		return fail("Index does not match the GenBank input");
+	}
+
+	gbstats *stats = opts->stats;
+	std::vector<std::string_view> previousRecords;
+	std::unordered_map<std::string_view, size_t> previousKeys;
+	{
+		PhaseTimer timer(PHASE(stats, scanTime));
+		if (!recordFragments(previous, previousLen, opts->ndjson, &previousRecords) ||
+			previousRecords.size() != previousIndex->entries.size())
 		{
-			skipStateUpdate = false;
+			return fail("Previous JSON does not match its index");
 		}
-		else
+
+		previousKeys.reserve(previousIndex->entries.size());
+		for (size_t i = 0; i < previousIndex->entries.size(); i++)
 		{
-			state = ORIGINSUB;
+			previousKeys.emplace(*releaseKey(&previousIndex->entries[i]), i);
 		}
-		break;
 	}
-	case SEQUENCE:
+
+	// Pieces of the output: text between unchanged records is converted
+	std::vector<std::string_view> pieces;
+	std::vector<std::string_view> chunks;
+	std::vector<size_t> chunkPieces;
+	size_t converted = 0;
+	size_t start = 0;
+
+	auto convert = [&](size_t end) {
+		std::vector<std::string_view> split;
+		splitRecords(gb + start, end - start, parallelChunk, &split);
+		for (auto &chunk : split)
+		{
+			chunkPieces.push_back(pieces.size());
+			chunks.push_back(chunk);
+			pieces.emplace_back();
+		}
+	};
+
+	for (auto &entry : index->entries)
 	{
-		if (skipStateUpdate)
+		auto match = previousKeys.find(*releaseKey(&entry));
+		const gbentry *old = match == previousKeys.end() ? nullptr : &previousIndex->entries[match->second];
+		if (!old || old->length != entry.length || old->hash != entry.hash)
 		{
-			skipStateUpdate = false;
+			converted++;
+			continue;
 		}
-		else
+
+		std::string_view fragment = previousRecords[match->second];
+		if (!fragmentNamed(fragment, &old->locus))
 		{
-			state = SEQUENCESUB;
+			return fail("Previous JSON does not match its index");
 		}
-		break;
+
+		convert(entry.offset);
+		pieces.push_back(fragment);
+		start = entry.offset + entry.length;
 	}
-	case CONTIG:
+	convert(len);
+
+	// Convert the new and changed records
+	std::vector<std::string> fragments(chunks.size());
 	{
-		if (skipStateUpdate)
+		PhaseTimer timer(PHASE(stats, parseTime));
+
+		std::vector<char> complete(chunks.size());
+		std::vector<gbstats> counts(chunks.size());
+		int threads = opts->threads > 0 ? opts->threads : std::max(1u, std::thread::hardware_concurrency());
+		std::vector<ChunkBuffers<Writer>> buffers(std::min((size_t)threads, chunks.size()));
+
+		parallelForWorkers(chunks.size(), threads, [&](int worker, size_t i) {
+			complete[i] = convertChunk<Writer>(chunks[i], &fragments[i], &counts[i], opts, &buffers[worker]);
+		});
+
+		if (stats)
 		{
-			skipStateUpdate = false;
+			for (auto &c : counts)
+			{
+				stats->add(&c);
+			}
 		}
-		else
+		if (std::find(complete.begin(), complete.end(), false) != complete.end())
 		{
-			state = CONTIGSUB;
+			return fail("Incomplete GenBank");
 		}
-		break;
-	}
-	case END:
-	{
-		state = START;
-		break;
-	}
-	default:
-		break;
 	}
-	return true;
-}
 
-bool JSONHandler::EndArray(rapidjson::SizeType elementCount)
-{
-	if (state == QUALIFIER || state == QUALIFIER_LOCATION)
+	size_t outLen = 4;
+	for (size_t i = 0; i < chunks.size(); i++)
 	{
-		state = FEATURE;
+		pieces[chunkPieces[i]] = fragments[i];
 	}
-	else if (state == FEATURE)
+	for (auto &piece : pieces)
 	{
-		state = FEATURE_HEADER;
+		outLen += piece.length() + 1;
 	}
-	else if (state == FEATURE_HEADER)
+
+	json->clear();
+	json->reserve(outLen);
+	joinFragments<Writer>(&pieces, [json](const char *str, size_t n) { json->append(str, n); });
+
+	if (stats)
 	{
-		state = KEYWORD;
+		stats->bytesIn += len;
+		stats->bytesOut += json->size();
 	}
-	else if (state == SUBSUBKEYWORD)
+	return converted;
+}
+
+/**
+ * Convert a GenBank release to JSON by reusing the JSON of the previous
+ * release. Records are matched by accession.version, or by accession or
+ * LOCUS name if they have none. A record with the length and hash of its
+ * match is copied from the previous JSON verbatim, and only new and
+ * changed records are converted. The previous JSON must have been
+ * written by gb2json from the release of previousIndex, with the same
+ * options.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] index The index of the buffer.
+ * @param[in] previous The JSON of the previous release.
+ * @param[in] previousLen Its length.
+ * @param[in] previousIndex The index of the previous release.
+ * @param[out] json The JSON string.
+ * @param[out] err Error object.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The number of records converted.
+ */
+size_t gb2jsonIncremental(
+	const char *gb,
+	size_t len,
+	const gbindex *index,
+	const char *previous,
+	size_t previousLen,
+	const gbindex *previousIndex,
+	std::string *json,
+	gberror *err,
+	const gboptions *opts)
+{
+	gboptions defaults;
+	if (!opts)
 	{
-		state = SUBKEYWORD;
+		opts = &defaults;
 	}
-	else if (state == SUBKEYWORD)
+
+	if (opts->sequences)
 	{
-		state = KEYWORD;
+		err->flag = true;
+		err->msg = "Sequence files cannot be used incrementally";
+		err->source = "gb2jsonIncremental";
+		return 0;
 	}
-	else if (state == LOCUSSUB)
+
+	if (opts->ndjson)
 	{
-		state = LOCUS;
+		return gb2jsonIncremental<LinesWriter>(gb, len, index, previous, previousLen, previousIndex, json, err, opts);
 	}
-	else if (state == LOCUS)
+	if (opts->compact)
 	{
-		state = KEYWORD;
+		return gb2jsonIncremental<rapidjson::Writer<rapidjson::StringBuffer>>(gb, len, index, previous, previousLen, previousIndex, json, err, opts);
 	}
-	else if (state == ORIGINSUB)
+	return gb2jsonIncremental<rapidjson::PrettyWriter<rapidjson::StringBuffer>>(gb, len, index, previous, previousLen, previousIndex, json, err, opts);
+}
+
+/***************************************************************
+ * Round trip verification
+ * Records are converted to JSON and back in memory, and the
+ * regenerated text is compared line by line with the original.
+ ***************************************************************/
+
+/**
+ * Reader of the normalized lines of a GenBank record. Line endings,
+ * trailing whitespace, blank lines and the widths of the gaps inside a
+ * line are not compared, and a feature location wrapped over several
+ * lines is read as one line, since json2gb wraps it anew.
+ */
+class NormalizedLines
+{
+public:
+	NormalizedLines(const char *data, size_t len) : cursor(data, len), number(0), features(false) { advance(); }
+
+	/**
+	 * Read the next line.
+	 * @param[out] line The normalized line.
+	 * @param[out] lineNumber Line number of its first line in the text, counted from 1.
+	 * @return False at the end of the text.
+	 */
+	bool next(std::string *line, size_t *lineNumber)
 	{
-		state = ORIGIN;
+		if (cursor.eof())
+		{
+			return false;
+		}
+
+		line->clear();
+		*lineNumber = number;
+		size_t indentation = append(line, true);
+		if (indentation == 0)
+		{
+			features = isFeatureHeader(&raw);
+		}
+		bool location = features && indentation == 5;
+
+		for (advance(); location && !cursor.eof() && isLocationContinuation(); advance())
+		{
+			append(line, false);
+		}
+		return true;
 	}
-	else if (state == ORIGIN)
+
+private:
+	LineCursor cursor;	 ///< Position in the text.
+	std::string_view raw; ///< The next non-blank line without trailing whitespace.
+	size_t number;		 ///< Line number of raw.
+	bool features;		 ///< In the feature table?
+
+	// Read the next non-blank line
+	void advance()
 	{
-		state = KEYWORD;
+		for (cursor.getline(&raw), number++; !cursor.eof(); cursor.getline(&raw), number++)
+		{
+			stringTrimRight(&raw);
+			if (!raw.empty())
+			{
+				break;
+			}
+		}
 	}
-	else if (state == SEQUENCESUB)
+
+	// Location lines continue at column 21 until the first qualifier
+	bool isLocationContinuation() const
 	{
-		state = SEQUENCE;
+		return raw.size() > 21 && raw.find_first_not_of(' ') == 21 && raw[21] != '/';
 	}
-	else if (state == CONTIGSUB)
+
+	// Append raw with each gap inside it as one space. Continued locations are joined without indentation.
+	size_t append(std::string *line, bool indent) const
 	{
-		state = CONTIG;
+		size_t indentation = raw.find_first_not_of(' ');
+		if (indent)
+		{
+			line->append(raw.data(), indentation);
+		}
+		bool gap = false;
+		for (size_t i = indentation; i < raw.size(); i++)
+		{
+			char c = raw[i];
+			if (c == ' ' || c == '\t')
+			{
+				gap = true;
+				continue;
+			}
+			if (gap)
+			{
+				line->push_back(' ');
+				gap = false;
+			}
+			line->push_back(c);
+		}
+		return indentation;
 	}
-	else if (state == SEQUENCE || state == CONTIG)
+};
+
+/**
+ * Compare a regenerated record with its original.
+ * @param[in] original The original record.
+ * @param[in] regenerated The regenerated record.
+ * @param[out] mismatch The first differing line, if any. Lines past the end are empty.
+ * @return True if the records match.
+ */
+static bool compareRecord(const std::string_view *original, const std::string_view *regenerated, gbmismatch *mismatch)
+{
+	NormalizedLines expected(original->data(), original->size());
+	NormalizedLines actual(regenerated->data(), regenerated->size());
+	size_t number = 0, actualNumber = 0;
+
+	for (;;)
 	{
-		gb << "//\n";
-		nwritten = 0;
-		state = END;
+		bool more = expected.next(&mismatch->expected, &number);
+		bool moreActual = actual.next(&mismatch->actual, &actualNumber);
+		if (!more || !moreActual || mismatch->expected != mismatch->actual)
+		{
+			if (more == moreActual && !more)
+			{
+				return true;
+			}
+			if (!more)
+			{
+				mismatch->expected.clear();
+				number++;
+			}
+			if (!moreActual)
+			{
+				mismatch->actual.clear();
+			}
+			mismatch->line = number;
+			return false;
+		}
 	}
-	return true;
 }
 
-bool JSONHandler::StartObject()
+/**
+ * Convert records to JSON and back in memory and compare the regenerated
+ * GenBank with the original. Line endings, trailing whitespace, blank
+ * lines, the gaps inside lines and the wrapping of feature locations are
+ * normalized; everything else must match. Text before the first LOCUS
+ * line is not compared. Records are verified on opts->threads threads,
+ * and projection and sidecar options are not used.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] mismatches The records that differ, in file order.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @return The number of records verified.
+ */
+size_t verifyRoundtrip(const char *gb, size_t len, std::vector<gbmismatch> *mismatches, const gboptions *opts)
 {
-	switch (state)
-	{
-	case FEATURE_HEADER:
+	gboptions defaults;
+	if (!opts)
 	{
-		state = FEATURE;
-		break;
+		opts = &defaults;
 	}
-	case FEATURE:
+	PhaseTimer timer(PHASE(opts->stats, parseTime));
+
+	gbindex index;
+	indexRecords(gb, len, &index);
+
+	// Batches of whole records for the threads
+	std::vector<size_t> batches;
+	for (size_t i = 0, size = parallelChunk; i < index.entries.size(); i++)
 	{
-		state = QUALIFIER;
-		break;
+		if (size >= parallelChunk)
+		{
+			batches.push_back(i);
+			size = 0;
+		}
+		size += index.entries[i].length;
 	}
-	default:
-		break;
+	batches.push_back(index.entries.size());
+
+	gboptions recordOpts;
+	recordOpts.compact = true;
+
+	int threads = opts->threads > 0 ? opts->threads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::vector<gbmismatch>> found(batches.size() - 1);
+
+	parallelFor(found.size(), threads, [&](size_t b) {
+		Converter converter;
+		std::string json, regenerated;
+		gbmismatch mismatch;
+
+		for (size_t i = batches[b]; i < batches[b + 1]; i++)
+		{
+			const gbentry *entry = &index.entries[i];
+			std::string_view record(gb + entry->offset, entry->length);
+			gberror err;
+
+			converter.gb2json(record.data(), record.size(), &json, &err, &recordOpts);
+			if (!err.flag)
+			{
+				converter.json2gb(json.data(), json.size(), &regenerated, &err, &recordOpts);
+			}
+
+			std::string_view text(regenerated);
+			if (err.flag)
+			{
+				mismatch.line = 0;
+				mismatch.expected.clear();
+				mismatch.actual = err.msg;
+			}
+			else if (compareRecord(&record, &text, &mismatch))
+			{
+				continue;
+			}
+
+			mismatch.name = entry->locus;
+			mismatch.offset = entry->offset;
+			found[b].push_back(mismatch);
+		}
+	});
+
+	for (auto &batch : found)
+	{
+		for (auto &mismatch : batch)
+		{
+			mismatches->push_back(std::move(mismatch));
+		}
 	}
-	return true;
-}
 
-bool JSONHandler::EndObject(rapidjson::SizeType elementCount)
-{
-	if (state == QUALIFIER || state == QUALIFIER_LOCATION)
+	if (opts->stats)
 	{
-		state = FEATURE;
+		opts->stats->records += index.entries.size();
+		opts->stats->bytesIn += len;
 	}
-	return true;
+	return index.entries.size();
 }
 
+/***************************************************************
+ * Conversion server
+ * Requests and responses are framed by a header line. A request
+ * is "gb2json LENGTH [compact] [ndjson] [locations]" or
+ * "json2gb LENGTH" followed by LENGTH bytes of input. The
+ * response is "ok LENGTH" and the result, or
+ * "error LENGTH CODE" and the error message. CODE is header,
+ * length or truncated for protocol errors, and gb2json or
+ * json2gb for failed conversions.
+ ***************************************************************/
+
+static const uint64_t maxRequestLength = uint64_t(1) << 30; // Longest request payload
+static const size_t maxHeaderLength = 256;					// Longest header line
+
 /**
- * Consume a string value.
- * @param[in] value The value string.
+ * Parse a request header line. The length is taken from the second
+ * word even if the rest is malformed, so the payload can be skipped.
+ * @param[in] header The header without its line ending.
+ * @param[out] toJSON Is the request for gb2json?
+ * @param[out] length The payload length, 0 if there is none.
+ * @param[out] opts The conversion options of the request.
+ * @return False if the header is malformed.
  */
-void JSONHandler::handleStringValue(const std::string *value)
+static bool parseRequestHeader(std::string_view header, bool *toJSON, uint64_t *length, gboptions *opts)
 {
-	// Set value indentation
-	int valueIndentation = 12;
-
-	switch (state)
-	{
-	case QUALIFIER:
-	{
-		valueIndentation = 21;
-		break;
-	}
-	case QUALIFIER_LOCATION:
+	std::vector<std::string_view> words;
+	while (!header.empty())
 	{
-		valueIndentation = 21;
-		break;
+		size_t space = std::min(header.find(' '), header.size());
+		if (space > 0)
+		{
+			words.push_back(header.substr(0, space));
+		}
+		header.remove_prefix(std::min(space + 1, header.size()));
 	}
-	case FEATURE:
+
+	*length = 0;
+	if (words.size() < 2 || !isInteger(&words[1]) || words[1].size() > 19)
 	{
-		valueIndentation = 21;
-		break;
+		return false;
 	}
-	case KEYWORD:
+	*length = std::stoull(std::string(words[1]));
+	if (words[0] != "gb2json" && words[0] != "json2gb")
 	{
-		valueIndentation = 12;
-		break;
+		return false;
 	}
-	case SUBKEYWORD:
+	*toJSON = words[0] == "gb2json";
+
+	for (size_t i = 2; i < words.size(); i++)
 	{
-		valueIndentation = 12;
-		break;
+		if (*toJSON && words[i] == "compact")
+		{
+			opts->compact = true;
+		}
+		else if (*toJSON && words[i] == "ndjson")
+		{
+			opts->ndjson = true;
+		}
+		else if (*toJSON && words[i] == "locations")
+		{
+			opts->parseLocations = true;
+		}
+		else
+		{
+			return false;
+		}
 	}
-	case SUBSUBKEYWORD:
+	return true;
+}
+
+/**
+ * Write a response.
+ * @param[out] out The output.
+ * @param[in] code The error code, or null for a result.
+ * @param[in] payload The result, or the error message.
+ * @return False if the response cannot be written.
+ */
+static bool writeResponse(FILE *out, const char *code, const std::string *payload)
+{
+	if (code)
 	{
-		valueIndentation = 12;
-		break;
-	}
-	default:
-		break;
+		fprintf(out, "error %zu %s\n", payload->size(), code);
 	}
-
-	// Write equal sign for qualifiers
-	if (state == QUALIFIER)
+	else
 	{
-		gb << "=";
-		nwritten += 1;
+		fprintf(out, "ok %zu\n", payload->size());
 	}
-
-	// Split the value into padded lines
-	std::string block;
-	blockPad(value, &block, valueIndentation, 79, nwritten - valueIndentation);
-
-	// Write the value
-	gb << block;
-
-	// Reset the column counter
-	nwritten = 0;
+	return fwrite(payload->data(), 1, payload->size(), out) == payload->size() && fflush(out) == 0;
 }
 
 /**
- * Consume the nucleotide sequence.
- * @param[in] value The string value.
+ * Serve framed conversion requests until the input ends. Each request is
+ * answered before the next one is read, and the converter keeps its
+ * buffers between requests. A malformed header is answered with an
+ * error and skipped together with its payload, if it has a length, and
+ * serving goes on with the next frame. Serving stops when no next frame
+ * can be found: after a payload beyond the length limit or a truncated
+ * payload.
+ * @param[in] in The request stream.
+ * @param[out] out The response stream.
+ * @param[in,out] converter The converter.
+ * @param[out] err Error object for framing and I/O errors.
  */
-void JSONHandler::handleSequence(const std::string *value)
+void serveRequests(FILE *in, FILE *out, Converter *converter, gberror *err)
 {
-	std::string line;
-
-	int nlines = std::ceil(((double)value->length()) / 60); // Number of lines
-	int nsections;											// Number of 10 b sections for a given line
-	std::string pos;										// Coordinate at start of line
-
-	for (int i = 0; i < nlines; i++)
-	{ // Loop through lines
-		// Place leading number
-		pos = std::to_string(i * 60 + 1);
-		gb << makeSpaces(9 - pos.length()) << pos << " ";
+	auto fail = [err, out](const char *code, std::string msg) {
+		err->flag = true;
+		err->msg = std::move(msg);
+		err->source = "serveRequests";
+		if (code)
+		{
+			writeResponse(out, code, &err->msg);
+		}
+	};
 
-		line = value->substr(i * 60, 60);
-		nsections = std::ceil(((double)line.length() / 10));
+	const std::string malformed("Malformed request header");
+	char header[maxHeaderLength];
+	std::string request, result;
 
-		for (int j = 0; j < nsections; j++)
-		{ // Build 10 b sections
-			gb << line.substr(j * 10, 10);
+	while (fgets(header, sizeof(header), in))
+	{
+		size_t headerLen = strlen(header);
+		bool ended = headerLen > 0 && header[headerLen - 1] == '\n';
+		std::string_view line(header, headerLen - ended);
+		stringTrimRight(&line);
 
-			if (j < nsections - 1)
+		if (!ended)
+		{
+			int c;
+			while ((c = fgetc(in)) != EOF && c != '\n')
+			{
+				// Skip the rest of the line
+			}
+			if (!writeResponse(out, "header", &malformed))
 			{
-				gb << " ";
+				fail(nullptr, "Failed writing response");
+				return;
 			}
+			continue;
 		}
 
-		gb << "\n";
-	}
+		bool toJSON = false;
+		uint64_t length = 0;
+		gboptions opts;
+		bool valid = parseRequestHeader(line, &toJSON, &length, &opts);
+		if (length > maxRequestLength)
+		{
+			fail("length", "Request too long");
+			return;
+		}
 
-	// Reset column counter
-	nwritten = 0;
-}
+		request.resize(length);
+		if (fread(&request[0], 1, length, in) != length)
+		{
+			fail("truncated", "Truncated request");
+			return;
+		}
 
-bool JSONHandler::String(const char *str, rapidjson::SizeType length, bool copy)
-{
-	std::string value(str);
+		gberror requestErr;
+		if (!valid)
+		{
+			requestErr.flag = true;
+			requestErr.msg = malformed;
+		}
+		else if (toJSON)
+		{
+			converter->gb2json(request.data(), request.size(), &result, &requestErr, &opts);
+		}
+		else
+		{
+			converter->json2gbInsitu(&request[0], request.size(), &result, &requestErr, &opts);
+		}
 
-	switch (state)
-	{
-	case LOCUS:
-	{
-		gb << str << "\n";
-		break;
+		const char *code = !requestErr.flag ? nullptr : !valid ? "header" : toJSON ? "gb2json" : "json2gb";
+		if (!writeResponse(out, code, requestErr.flag ? &requestErr.msg : &result))
+		{
+			fail(nullptr, "Failed writing response");
+			return;
+		}
 	}
-	case ORIGIN:
+
+	if (ferror(in))
 	{
-		gb << str << "\n";
-		break;
+		fail(nullptr, "Failed reading requests");
 	}
-	case SEQUENCE:
+}
+
+/***************************************************************
+ * Batch conversion
+ * Files are converted on a pool of threads, one file per thread
+ * at a time. Errors are kept per file, so a bad file does not
+ * stop the batch.
+ ***************************************************************/
+
+/**
+ * Read a list of filenames, one per line. Empty lines are skipped.
+ * @param[in] filename The list file.
+ * @param[out] names The filenames.
+ * @param[out] err Error object.
+ */
+void fileList(const std::string *filename, std::vector<std::string> *names, gberror *err)
+{
+	std::string list;
+	fileToString(filename, &list, err);
+	if (err->flag)
 	{
-		handleSequence(&value);
-		break;
+		return;
 	}
-	default:
+
+	LineCursor cursor(list.data(), list.size());
+	std::string_view line;
+
+	for (cursor.getline(&line); !cursor.eof(); cursor.getline(&line))
 	{
-		handleStringValue(&value);
-		break;
-	}
+		stringTrim(&line);
+		if (!line.empty())
+		{
+			names->emplace_back(line);
+		}
 	}
-	return true;
 }
 
-bool JSONHandler::Key(const char *str, rapidjson::SizeType length, bool copy)
+/**
+ * Set up batch jobs. Directories are expanded to the regular files in
+ * them. Each output is named after its input, with the extension
+ * replaced, in the output directory.
+ * @param[in] inputs Input files and directories.
+ * @param[in] outdir The output directory. It is created if needed.
+ * @param[in] extension The output extension, e.g. ".json".
+ * @param[out] jobs The jobs.
+ * @param[out] err Error object.
+ */
+void batchJobs(const std::vector<std::string> *inputs, const std::string *outdir, const char *extension, std::vector<gbjob> *jobs, gberror *err)
 {
-	std::string key(str);
-	updateState(key);
+	namespace fs = std::filesystem;
+	std::error_code ec;
 
-	int keyIndentation = 0;	// Whitespace before key
-	int valueIndentation = 12; // Number of chars before value
-
-	if (state == SEQUENCE)
-	{
-		return true; // Don't print a key
-	}
-	else if (state == FEATURE_HEADER)
-	{
-		gb << "FEATURES" << makeSpaces(21 - 8) << "Location/Qualifiers\n";
-		nwritten = 0;
-		return true;
-	}
-	else if (state == QUALIFIER)
-	{
-		// Special formatting for qualifier key
-		gb << makeSpaces(21) << "/" << key;
-		nwritten = 22 + key.length();
-		return true;
-	}
-	else if (state == QUALIFIER_LOCATION)
+	fs::create_directories(*outdir, ec);
+	if (!fs::is_directory(*outdir, ec))
 	{
-		return true; // Don't print a key
+		err->flag = true;
+		err->msg = "Failed to create " + *outdir;
+		err->source = "batchJobs";
+		return;
 	}
-	else
-	{ // Set indentation
-		switch (state)
+
+	std::set<std::string> outputs;
+
+	auto add = [&](const fs::path &input) {
+		gbjob job;
+		job.input = input.string();
+		job.output = (fs::path(*outdir) / input.filename()).replace_extension(extension).string();
+
+		if (!outputs.insert(job.output).second)
 		{
-		case KEYWORD:
+			job.err.flag = true;
+			job.err.msg = "Duplicate output " + job.output;
+			job.err.source = "batchJobs";
+		}
+		jobs->push_back(std::move(job));
+	};
+
+	for (auto &input : *inputs)
+	{
+		if (!fs::is_directory(input, ec))
 		{
-			keyIndentation = 0;
-			valueIndentation = 12;
-			break;
+			add(input);
+			continue;
 		}
-		case SUBKEYWORD:
+
+		// Directory entries are sorted for a reproducible order
+		std::vector<fs::path> files;
+		for (auto &entry : fs::directory_iterator(input, ec))
 		{
-			keyIndentation = 2;
-			valueIndentation = 12;
-			break;
+			if (entry.is_regular_file(ec))
+			{
+				files.push_back(entry.path());
+			}
 		}
-		case SUBSUBKEYWORD:
+		std::sort(files.begin(), files.end());
+
+		for (auto &file : files)
 		{
-			keyIndentation = 3;
-			valueIndentation = 12;
-			break;
+			add(file);
 		}
-		case FEATURE:
+	}
+}
+
+/**
+ * Convert a batch of files.
+ * @param[in,out] jobs The jobs. Errors are set per job.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ * @param[in] convert The converter, called with the input buffer, its
+ *                    length, the output string, the error and the options.
+ */
+template <typename Function>
+static void convertFiles(std::vector<gbjob> *jobs, const gboptions *opts, Function convert)
+{
+	gboptions defaults;
+	if (!opts)
+	{
+		opts = &defaults;
+	}
+
+	int threads = opts->threads > 0 ? opts->threads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<gbstats> stats(opts->stats ? jobs->size() : 0);
+
+	parallelFor(jobs->size(), threads, [&](size_t i) {
+		gbjob *job = &(*jobs)[i];
+		if (job->err.flag)
 		{
-			keyIndentation = 5;
-			valueIndentation = 21;
-			break;
+			return; // Failed setting up
 		}
-		default:
+
+		// Files are the unit of parallelism
+		gboptions fileOpts = *opts;
+		fileOpts.threads = 1;
+		fileOpts.stats = opts->stats ? &stats[i] : nullptr;
+
+		std::string buffer, output;
+		MappedFile map;
+		const char *input;
+		size_t inputLen;
+
+		// Map the input file. Fall back to reading it if it cannot be mapped.
 		{
-			break;
+			PhaseTimer timer(PHASE(fileOpts.stats, readTime));
+			fileToMap(&job->input, &map, &job->err);
+			input = map.data;
+			inputLen = map.size;
+
+			// Compressed files are decompressed while reading
+			if (job->err.flag || detectCompression(input, inputLen) != GB_PLAIN)
+			{
+				job->err = gberror();
+				map.unmap();
+				fileToString(&job->input, &buffer, &job->err);
+				input = buffer.data();
+				inputLen = buffer.size();
+			}
 		}
+
+		if (job->err.flag)
+		{
+			return;
 		}
-	}
 
-	// Print key plus left/right padding
-	gb << makeSpaces(keyIndentation);
-	gb << key;
-	gb << makeSpaces(valueIndentation - keyIndentation - key.length());
+		convert(input, inputLen, &output, &job->err, &fileOpts);
 
-	// Set column counter
-	nwritten = valueIndentation;
+		if (!job->err.flag)
+		{
+			PhaseTimer timer(PHASE(fileOpts.stats, writeTime));
+			stringToFile(&job->output, &output, &job->err, compressionFromName(&job->output));
+		}
+	});
 
-	return true;
+	for (auto &s : stats)
+	{
+		opts->stats->add(&s);
+	}
 }
 
-bool JSONHandler::Null()
+/**
+ * Convert a batch of GenBank files to JSON. opts->threads files are
+ * converted at a time.
+ * @param[in,out] jobs The input and output filenames. Errors are set per job.
+ * @param[in] opts Conversion options. Defaults are used if null.
+ */
+void gb2jsonBatch(std::vector<gbjob> *jobs, const gboptions *opts)
 {
-	gb << "\n";
-	return true;
+	convertFiles(jobs, opts, [](const char *gb, size_t len, std::string *json, gberror *err, const gboptions *fileOpts) {
+		gb2json(gb, len, json, err, fileOpts);
+	});
 }
 
 /**
- * JSON to GenBank converter.
- * @param[in] json The JSON string.
- * @param[out] gb The GenBank string.
- * @param[out] err Error object.
+ * Convert a batch of JSON files to GenBank. opts->threads files are
+ * converted at a time.
+ * @param[in,out] jobs The input and output filenames. Errors are set per job.
+ * @param[in] opts Conversion options. Defaults are used if null.
  */
-void json2gb(const std::string *json, std::string *gb, gberror *err)
+void json2gbBatch(std::vector<gbjob> *jobs, const gboptions *opts)
 {
-	JSONHandler handler;
-	rapidjson::Reader reader;
-
-	rapidjson::StringStream sstream(json->c_str());
-	reader.Parse(sstream, handler);
-
-	if (reader.HasParseError())
-	{
-		err->flag = true;
-		err->msg = "Unable to parse JSON";
-		err->source = "json2gb";
-	}
-	else
-	{
-		*gb = handler.gb.str();
-	}
+	convertFiles(jobs, opts, [](const char *json, size_t len, std::string *gb, gberror *err, const gboptions *fileOpts) {
+		json2gb(json, len, gb, err, fileOpts);
+	});
 }
@@ -0,0 +1,204 @@
+/*
+ * gbjson_c.cpp: C interface of the conversion library
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <cstring> // memcpy
+#include <exception>
+#include <new> // nothrow
+#include "gbjson.h"
+#include "gbjson_c.h"
+
+/**
+ * Conversion context of the C interface.
+ */
+struct gbjson_context
+{
+	Converter converter; ///< Buffers kept between conversions.
+	gboptions opts;		 ///< Options of the conversions.
+	std::string output;	 ///< Output of the last buffer conversion that did not fit.
+	gberror err;		 ///< Error of the last conversion.
+};
+
+/**
+ * Run a conversion on a context. Exceptions, e.g. when out of memory,
+ * must not unwind into the C caller and fail the conversion instead.
+ * @param[in,out] ctx The context.
+ * @param[in] convert The conversion, writing to ctx->err.
+ * @return GBJSON_OK or GBJSON_ERROR.
+ */
+template <typename Convert>
+static int run(gbjson_context *ctx, Convert convert)
+{
+	ctx->err = gberror();
+	try
+	{
+		convert();
+	}
+	catch (const std::exception &e)
+	{
+		ctx->err.flag = true;
+		ctx->err.msg = e.what();
+	}
+	return ctx->err.flag ? GBJSON_ERROR : GBJSON_OK;
+}
+
+/**
+ * Output of a buffer conversion. It goes straight into the caller's
+ * buffer and moves into the context once it no longer fits.
+ */
+struct BufferSink
+{
+	char *out;			 ///< The caller's buffer, or NULL.
+	size_t capacity;	 ///< Size of the caller's buffer.
+	size_t size;		 ///< Length of the output.
+	std::string *output; ///< Output that does not fit.
+};
+
+/**
+ * Output callback of a buffer conversion.
+ * @param[in] data The output.
+ * @param[in] len Length of the output.
+ * @param[in,out] user The BufferSink.
+ * @return len.
+ */
+static size_t writeBuffer(const char *data, size_t len, void *user)
+{
+	BufferSink *sink = static_cast<BufferSink *>(user);
+	if (sink->out && sink->size + len <= sink->capacity)
+	{
+		memcpy(sink->out + sink->size, data, len);
+	}
+	else
+	{
+		if (sink->output->empty() && sink->size > 0)
+		{
+			sink->output->assign(sink->out, sink->size); // First overflow
+		}
+		sink->output->append(data, len);
+	}
+	sink->size += len;
+	return len;
+}
+
+/**
+ * Run a buffer conversion. Output that does not fit is kept in the
+ * context, and the output of a failed conversion is dropped.
+ * @param[in,out] ctx The context.
+ * @param[in] convert The conversion, taking the output callback and its argument.
+ * @param[out] out The output buffer, or NULL.
+ * @param[in] capacity The output buffer size.
+ * @param[out] size Length of the output.
+ * @return GBJSON_OK, GBJSON_ERROR or GBJSON_BUFFER_TOO_SMALL.
+ */
+template <typename Convert>
+static int runBuffer(gbjson_context *ctx, Convert convert, char *out, size_t capacity, size_t *size)
+{
+	BufferSink sink = {out, capacity, 0, &ctx->output};
+	ctx->output.clear();
+	int status = run(ctx, [&]() { convert(writeBuffer, static_cast<void *>(&sink)); });
+	if (status != GBJSON_OK)
+	{
+		ctx->output.clear();
+		*size = 0;
+		return status;
+	}
+
+	*size = sink.size;
+	if (sink.size > capacity || (!out && sink.size > 0))
+	{
+		return GBJSON_BUFFER_TOO_SMALL;
+	}
+	return GBJSON_OK;
+}
+
+gbjson_context *gbjson_context_new(void)
+{
+	return new (std::nothrow) gbjson_context();
+}
+
+void gbjson_context_free(gbjson_context *ctx)
+{
+	delete ctx;
+}
+
+int gbjson_set_option(gbjson_context *ctx, int option, int value)
+{
+	if (option == GBJSON_OPTION_THREADS)
+	{
+		if (value < 0)
+		{
+			return GBJSON_ERROR;
+		}
+		ctx->opts.threads = value;
+		return GBJSON_OK;
+	}
+
+	if (value != 0 && value != 1)
+	{
+		return GBJSON_ERROR;
+	}
+	switch (option)
+	{
+	case GBJSON_OPTION_COMPACT:
+		ctx->opts.compact = value;
+		break;
+	case GBJSON_OPTION_NDJSON:
+		ctx->opts.ndjson = value;
+		break;
+	case GBJSON_OPTION_LOCATIONS:
+		ctx->opts.parseLocations = value;
+		break;
+	case GBJSON_OPTION_SPLIT_FEATURES:
+		ctx->opts.splitFeatures = value;
+		break;
+	case GBJSON_OPTION_VALIDATE:
+		ctx->opts.validate = value;
+		break;
+	default:
+		return GBJSON_ERROR;
+	}
+	return GBJSON_OK;
+}
+
+int gbjson_gb2json(gbjson_context *ctx, const char *gb, size_t len, char *out, size_t capacity, size_t *size)
+{
+	auto convert = [&](gbwrite write, void *user) { ctx->converter.gb2json(gb, len, write, user, &ctx->err, &ctx->opts); };
+	return runBuffer(ctx, convert, out, capacity, size);
+}
+
+int gbjson_json2gb(gbjson_context *ctx, const char *json, size_t len, char *out, size_t capacity, size_t *size)
+{
+	auto convert = [&](gbwrite write, void *user) { ctx->converter.json2gb(json, len, write, user, &ctx->err, &ctx->opts); };
+	return runBuffer(ctx, convert, out, capacity, size);
+}
+
+int gbjson_gb2json_write(gbjson_context *ctx, const char *gb, size_t len, gbjson_write_fn write, void *user)
+{
+	return run(ctx, [&]() { ctx->converter.gb2json(gb, len, write, user, &ctx->err, &ctx->opts); });
+}
+
+int gbjson_json2gb_write(gbjson_context *ctx, const char *json, size_t len, gbjson_write_fn write, void *user)
+{
+	return run(ctx, [&]() { ctx->converter.json2gb(json, len, write, user, &ctx->err, &ctx->opts); });
+}
+
+void gbjson_output(const gbjson_context *ctx, const char **data, size_t *size)
+{
+	*data = ctx->output.data();
+	*size = ctx->output.size();
+}
+
+const char *gbjson_error(const gbjson_context *ctx)
+{
+	return ctx->err.msg.c_str();
+}
+
+const char *gbjson_layout_schema(void)
+{
+	return layoutSchema();
+}
@@ -7,8 +7,13 @@
 
 #pragma once
 
+#include <stdio.h> // FILE
+#include <cstdint> // uint64_t
+#include <memory>  // unique_ptr
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 #include "rapidjson/reader.h"
 
 #define VERSION_MAJOR "@PROJECT_VERSION_MAJOR@"
@@ -26,9 +31,388 @@ struct gberror
 	gberror();
 };
 
+/**
+ * Conversion statistics. Conversions add their phase times in seconds
+ * and their counts, so one object can collect several conversions.
+ */
+struct gbstats
+{
+	double readTime;   ///< Reading input.
+	double scanTime;   ///< Scanning for record boundaries.
+	double parseTime;  ///< Parsing and emitting.
+	double writeTime;  ///< Writing output.
+	size_t records;	   ///< GenBank records.
+	size_t features;   ///< Features.
+	size_t qualifiers; ///< Feature qualifiers.
+	size_t bases;	   ///< Sequence bases.
+	size_t bytesIn;	   ///< Input bytes.
+	size_t bytesOut;   ///< Output bytes.
+	gbstats();
+	void add(const gbstats *other);
+};
+
+/**
+ * Compression formats.
+ */
+enum gbcompression
+{
+	GB_PLAIN,
+	GB_GZIP,
+	GB_ZSTD
+};
+
+/**
+ * Name filter. A name is kept if it is included, or if no names are
+ * included, and if it is not excluded.
+ */
+struct gbfilter
+{
+	std::vector<std::string> include; ///< Names to keep. Empty keeps all.
+	std::vector<std::string> exclude; ///< Names to drop.
+	bool keep(const std::string_view *name) const;
+};
+
+/**
+ * Sections of GenBank records to convert. Dropped sections are skipped
+ * without parsing them.
+ */
+struct gbprojection
+{
+	gbfilter keywords;	 ///< Top level keywords, e.g. FEATURES or ORIGIN. LOCUS is always kept.
+	gbfilter features;	 ///< Feature keys, e.g. CDS.
+	gbfilter qualifiers; ///< Qualifier names, e.g. translation.
+};
+
+/**
+ * Selection of whole records. It is evaluated on the LOCUS line, and a
+ * record that is not selected is skipped up to its // line unparsed.
+ */
+struct gbselection
+{
+	gbfilter divisions;					   ///< Divisions, e.g. BCT or PLN.
+	gbfilter molecules;					   ///< Molecule types, e.g. DNA or mRNA.
+	size_t minLength;					   ///< Shortest sequence length selected.
+	size_t maxLength;					   ///< Longest sequence length selected. 0 selects any length.
+	std::unordered_set<std::string> names; ///< LOCUS names, accessions or accession.versions. Empty selects all.
+	gbselection();
+};
+
+/**
+ * Conversion options.
+ */
+struct gboptions
+{
+	int threads;			   ///< Number of worker threads. 0 uses all hardware threads.
+	bool compact;			   ///< Write JSON without indentation.
+	gbstats *stats;			   ///< Statistics to update, or nullptr.
+	gbcompression compression; ///< Compression of output written to files.
+	bool pipeline;			   ///< Read and write on separate threads when streaming.
+	const gbprojection *projection; ///< Sections to convert, or nullptr for all.
+	const gbselection *selection;	///< Records to convert, or nullptr for all.
+	FILE *sequences;				///< Sequence sidecar. gb2json moves bases to it, json2gb reads them back. nullptr embeds them.
+	bool packSequences;				///< 2-bit pack the bases in the sequence sidecar.
+	bool parseLocations;			///< Add a ParsedLocation with strand, partial markers and ranges to features.
+	bool ndjson;					///< Write JSON Lines, one compact record per line, instead of an array.
+	bool splitFeatures;				///< Parse the feature tables of large records on several threads.
+	bool validate;					///< Validate JSON against the gbjson layout schema while converting it.
+	gboptions();
+};
+
+/**
+ * Batch conversion job.
+ */
+struct gbjob
+{
+	std::string input;  ///< Input filename.
+	std::string output; ///< Output filename.
+	gberror err;		///< Error converting this file.
+};
+
+/**
+ * Record index entry. Records are located by byte range in their file.
+ */
+struct gbentry
+{
+	std::string locus;	   ///< LOCUS name.
+	std::string accession; ///< Primary accession.
+	std::string version;   ///< Accession.version, or empty.
+	uint64_t offset;	   ///< Offset of the LOCUS line.
+	uint64_t length;	   ///< Length up to and including the // line.
+	uint32_t hash;		   ///< CRC-32 of the record text.
+};
+
+/**
+ * Record index of a GenBank file.
+ */
+struct gbindex
+{
+	uint64_t size;				  ///< Size of the indexed file.
+	std::vector<gbentry> entries; ///< Records in file order.
+};
+
+/**
+ * Record that differs after a round trip through JSON.
+ */
+struct gbmismatch
+{
+	std::string name;	  ///< LOCUS name.
+	uint64_t offset;	  ///< Offset of the LOCUS line.
+	uint64_t line;		  ///< First differing line of the record, counted from 1. 0 if the conversion failed.
+	std::string expected; ///< The normalized original line.
+	std::string actual;	  ///< The normalized regenerated line, or the conversion error.
+};
+
+/**
+ * Read-only memory-mapped file.
+ */
+struct MappedFile
+{
+	const char *data; ///< Start of the mapping. nullptr for empty files.
+	size_t size;	  ///< Mapping size.
+	bool writable;	  ///< Copy-on-write mapping?
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	void unmap();
+	char *writableData();
+};
+
+/**
+ * Output file written under a temporary name next to its target and
+ * renamed over the target by commit(). Unless committed, the temporary
+ * file is removed, so a failed conversion leaves no output behind, and
+ * a file can be converted onto itself while it is being read.
+ */
+struct OutputFile
+{
+	FILE *file;			   ///< The temporary file, or nullptr.
+	std::string name;	   ///< Target filename.
+	std::string temporary; ///< Temporary filename.
+	OutputFile();
+	~OutputFile();
+	OutputFile(const OutputFile &) = delete;
+	OutputFile &operator=(const OutputFile &) = delete;
+	bool open(const std::string *filename, bool binary, gberror *err);
+	bool commit(gberror *err);
+	void discard();
+};
+
+/**
+ * Block allocator for strings. Copies stay in place until clear(), which
+ * keeps the blocks for reuse.
+ */
+struct Arena
+{
+	size_t blockSize; ///< Size of new blocks.
+	Arena(size_t blockSize = 65536);
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+	std::string_view copy(const char *str, size_t len);
+	void clear();
+	size_t capacity() const;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+	std::vector<Block> blocks; ///< Allocated blocks.
+	size_t current;			   ///< Block being filled.
+	size_t used;			   ///< Bytes used in the current block.
+};
+
+/**
+ * GenBank keyword. Keywords are stored in document order, and the
+ * subkeywords of keywords[i] are keywords[i + 1] up to keywords[end].
+ */
+struct gbkeyword
+{
+	std::string_view name;	///< Keyword name, e.g. SOURCE.
+	std::string_view value; ///< Value, with continuation lines joined by newlines.
+	bool hasValue;			///< False for keywords without value, e.g. ORIGIN.
+	size_t level;			///< 0 for keywords, 1 for subkeywords, 2 for subsubkeywords.
+	size_t end;				///< Index after the last subkeyword.
+};
+
+/**
+ * Feature qualifier.
+ */
+struct gbqualifier
+{
+	std::string_view name;	///< Qualifier name without /.
+	std::string_view value; ///< Value as in the GenBank text, including quotes.
+	bool hasValue;			///< False for flags, e.g. /pseudo.
+};
+
+/**
+ * GenBank feature. Its qualifiers are record.qualifiers[qualifier] up to
+ * record.qualifiers[qualifier + qualifiers].
+ */
+struct gbfeature
+{
+	std::string_view key;	   ///< Feature key, e.g. CDS.
+	std::string_view location; ///< Location string.
+	size_t qualifier;		   ///< Index of the first qualifier.
+	size_t qualifiers;		   ///< Number of qualifiers.
+};
+
+/**
+ * Parsed GenBank record. The text is viewed in the input buffer, or in
+ * the record arena where the parser had to join or clean it, so the input
+ * must outlive the record. Reusing a record for the next one keeps its
+ * memory.
+ */
+struct GenBankRecord
+{
+	std::string_view locus;				///< LOCUS line after the keyword.
+	std::vector<gbkeyword> keywords;	///< Keyword tree, without LOCUS and FEATURES.
+	std::vector<gbfeature> features;	///< Features in order.
+	std::vector<gbqualifier> qualifiers; ///< Qualifiers of all features.
+	std::string_view sequence;			///< Bases without spaces and numbers.
+	Arena arena;						///< Storage for text not in the input.
+	void clear();
+};
+
+/**
+ * Receiver of the JSON events of a GenBank conversion. The functions are
+ * those of a rapidjson SAX handler, so a rapidjson handler or Document
+ * can receive the events through a HandlerAdapter. Returning false stops
+ * the events.
+ */
+struct gbhandler
+{
+	virtual ~gbhandler() {}
+	virtual bool Null() = 0;
+	virtual bool Bool(bool b) = 0;
+	virtual bool Uint(unsigned u) = 0;
+	virtual bool Uint64(uint64_t u) = 0;
+	virtual bool String(const char *str, rapidjson::SizeType length, bool copy) = 0;
+	virtual bool StartObject() = 0;
+	virtual bool Key(const char *str, rapidjson::SizeType length, bool copy) = 0;
+	virtual bool EndObject(rapidjson::SizeType memberCount) = 0;
+	virtual bool StartArray() = 0;
+	virtual bool EndArray(rapidjson::SizeType elementCount) = 0;
+};
+
+/**
+ * Forwards conversion events to a rapidjson-compatible handler.
+ */
+template <typename Handler>
+struct HandlerAdapter : public gbhandler
+{
+	Handler *handler; ///< The receiving handler.
+	HandlerAdapter(Handler *handler) : handler(handler) {}
+	bool Null() override { return handler->Null(); }
+	bool Bool(bool b) override { return handler->Bool(b); }
+	bool Uint(unsigned u) override { return handler->Uint(u); }
+	bool Uint64(uint64_t u) override { return handler->Uint64(u); }
+	bool String(const char *str, rapidjson::SizeType length, bool copy) override { return handler->String(str, length, copy); }
+	bool StartObject() override { return handler->StartObject(); }
+	bool Key(const char *str, rapidjson::SizeType length, bool copy) override { return handler->Key(str, length, copy); }
+	bool EndObject(rapidjson::SizeType memberCount) override { return handler->EndObject(memberCount); }
+	bool StartArray() override { return handler->StartArray(); }
+	bool EndArray(rapidjson::SizeType elementCount) override { return handler->EndArray(elementCount); }
+};
+
+class Compressor;
+class AsyncWriter;
+
+/**
+ * Output callback. Takes len bytes of output and returns the number of
+ * bytes taken; fewer than len is a write error.
+ */
+typedef size_t (*gbwrite)(const char *data, size_t len, void *user);
+
+/**
+ * Output sink. Text is appended to a growable buffer, which is either
+ * moved out when done or flushed to an attached file, file descriptor
+ * or output callback. Flushed output can be compressed and written on
+ * a writer thread.
+ */
+struct OutputSink
+{
+	std::string buffer;		///< Buffered output.
+	FILE *file;				///< Output file, or nullptr.
+	int fd;					///< Output file descriptor, or -1.
+	gbwrite callback;		///< Output callback, or nullptr.
+	void *user;				///< Argument of the output callback.
+	size_t flushSize;		///< Buffer size from which maybeFlush() writes out.
+	bool failed;			///< Write error?
+	gbstats *stats;			///< Statistics for timing writes, or nullptr.
+	Compressor *compressor; ///< Compressor of flushed output, or nullptr.
+	AsyncWriter *writer;	///< Writer thread, or nullptr.
+	OutputSink();
+	~OutputSink();
+	OutputSink(const OutputSink &) = delete;
+	OutputSink &operator=(const OutputSink &) = delete;
+	void append(const char *str, size_t len) { buffer.append(str, len); }
+	void append(const char *str) { buffer.append(str); }
+	void put(char c) { buffer.push_back(c); }
+	void fill(int n, char c = ' ')
+	{
+		if (n > 0)
+			buffer.append(n, c);
+	}
+	char *extend(size_t len) ///< Append len characters to be written by the caller.
+	{
+		size_t n = buffer.size();
+		buffer.resize(n + len);
+		return &buffer[n];
+	}
+	bool attached() const { return file || fd >= 0 || callback; } ///< Is output flushed?
+	void maybeFlush()
+	{
+		if (attached() && buffer.size() >= flushSize)
+			flush();
+	}
+	void flush();
+	void close();
+	bool compress(gbcompression format);
+	void startWriter();
+	void write(const char *data, size_t len);
+	void writeRaw(const char *data, size_t len);
+};
+
+gbcompression detectCompression(const char *data, size_t len);
+gbcompression compressionFromName(const std::string *filename);
 void fileToString(const std::string *filename, std::string *output, gberror *err);
-void gb2json(const std::string *gb, std::string *json, gberror *err);
-void json2gb(const std::string *json, std::string *gb, gberror *err);
+void stringToFile(const std::string *filename, const std::string *data, gberror *err, gbcompression compression = GB_PLAIN);
+bool sameFile(const std::string *a, const std::string *b);
+void fileToMap(const std::string *filename, MappedFile *output, gberror *err, bool writable = false);
+void gb2json(const std::string *gb, std::string *json, gberror *err, const gboptions *opts = nullptr);
+void gb2json(const char *gb, size_t len, std::string *json, gberror *err, const gboptions *opts = nullptr);
+std::string gb2json(const std::string *gb, gberror *err, const gboptions *opts = nullptr);
+void gb2json(const std::string *gb, gbhandler *handler, gberror *err, const gboptions *opts = nullptr);
+void gb2json(const char *gb, size_t len, gbhandler *handler, gberror *err, const gboptions *opts = nullptr);
+void gb2json(const char *gb, size_t len, FILE *json, gberror *err, const gboptions *opts = nullptr);
+void gb2json(const char *gb, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts = nullptr);
+void gb2jsonStream(FILE *gb, FILE *json, gberror *err, const gboptions *opts = nullptr);
+void json2gb(const std::string *json, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gb(const char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gbInsitu(char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gb(const char *json, size_t len, FILE *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gbInsitu(char *json, size_t len, FILE *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gb(const char *json, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts = nullptr);
+void json2gbStream(FILE *json, FILE *gb, gberror *err, const gboptions *opts = nullptr);
+void json2gbInsitu(std::string *json, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+std::string json2gb(const std::string *json, gberror *err, const gboptions *opts = nullptr);
+std::string json2gb(std::string &&json, gberror *err, const gboptions *opts = nullptr);
+const char *layoutSchema();
+void fileList(const std::string *filename, std::vector<std::string> *names, gberror *err);
+void batchJobs(const std::vector<std::string> *inputs, const std::string *outdir, const char *extension, std::vector<gbjob> *jobs, gberror *err);
+void gb2jsonBatch(std::vector<gbjob> *jobs, const gboptions *opts = nullptr);
+void json2gbBatch(std::vector<gbjob> *jobs, const gboptions *opts = nullptr);
+void indexRecords(const char *gb, size_t len, gbindex *index);
+void indexFile(const std::string *filename, gbindex *index, gberror *err);
+void writeIndex(const std::string *filename, const gbindex *index, gberror *err);
+void readIndex(const std::string *filename, gbindex *index, gberror *err);
+void gb2jsonSelect(const std::string *filename, const gbindex *index, const std::vector<std::string> *keys, std::string *json, gberror *err, const gboptions *opts = nullptr);
+size_t gb2jsonIncremental(const char *gb, size_t len, const gbindex *index, const char *previous, size_t previousLen, const gbindex *previousIndex, std::string *json, gberror *err, const gboptions *opts = nullptr);
+size_t gb2record(const char *gb, size_t len, GenBankRecord *record, gberror *err, const gboptions *opts = nullptr);
+size_t verifyRoundtrip(const char *gb, size_t len, std::vector<gbmismatch> *mismatches, const gboptions *opts = nullptr);
+void printStats(const gbstats *stats, FILE *out, bool json = false);
 
 /*
  * JSON handler state.
@@ -46,6 +430,7 @@ enum handlerState
 	FEATURE_HEADER,
 	FEATURE,
 	QUALIFIER_LOCATION,
+	QUALIFIER_PARSED, // Parsed location, which is not written
 	QUALIFIER,
 	ORIGIN,
 	ORIGINSUB, // Dummy array
@@ -56,6 +441,32 @@ enum handlerState
 	END
 };
 
+/*
+ * JSON handler event. The state changes on array and object bounds and
+ * on the few keys given an event of their own; all other keys are EVENT_KEY.
+ */
+enum handlerEvent
+{
+	EVENT_START_ARRAY,
+	EVENT_END_ARRAY,
+	EVENT_START_OBJECT,
+	EVENT_END_OBJECT,
+	EVENT_KEY,
+	EVENT_KEY_LOCUS,
+	EVENT_KEY_ORIGIN,
+	EVENT_KEY_SEQUENCE,
+	EVENT_KEY_CONTIG,
+	EVENT_KEY_FEATURES,
+	EVENT_KEY_LOCATION,
+	EVENT_KEY_PARSED, // ParsedLocation
+	EVENT_KEY_OFFSET, // Sequence reference fields, in the order of JSONHandler::reference
+	EVENT_KEY_LENGTH,
+	EVENT_KEY_CRC32,
+	EVENT_KEY_SIZE,
+	EVENT_KEY_ENCODING,
+	EVENT_COUNT
+};
+
 /**
  * Handler for rapidjson events. This calls the appropriate member functions
  * on JSON elements. 
@@ -64,12 +475,24 @@ struct JSONHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, JSON
 {
 	handlerState state;   ///< The handler is a finite state machine. Its behavior depends on its state.
 	bool skipStateUpdate; ///< Flag for skipping state update
-	std::stringstream gb; ///< The GenBank string.
+	OutputSink gb;		  ///< The GenBank output.
 	int nwritten;		  ///< Number of characters that have been written to line.
+	gbstats counts;		  ///< Records, features, qualifiers and bases written.
+	FILE *sequences;	  ///< Sidecar of referenced sequences, or nullptr.
+	std::string bases;	  ///< Bases read back from the sidecar.
+	bool inReference;	  ///< Reading a sequence reference?
+	std::string packed;	  ///< Packed bases read from the sidecar.
+	int referenceField;	  ///< Field being read: 0 offset, 1 length, 2 crc32, 3 size, -2 encoding, -1 other.
+	uint64_t reference[4]; ///< Offset, length, CRC-32 and packed size of the referenced bases.
+	bool referencePacked; ///< Are the referenced bases 2-bit packed?
+	int skipDepth;		  ///< Open objects and arrays inside a parsed location.
+	std::string error;	  ///< Why the handler stopped the parse, if it did.
 	JSONHandler();
-	void updateState(const std::string key);
-	void handleStringValue(const std::string *value);
-	void handleSequence(const std::string *value);
+	void reset();
+	bool transition(handlerEvent event);
+	void handleStringValue(const std::string_view *value);
+	void handleSequence(const std::string_view *value);
+	bool handleReference();
 	bool Null();
 	bool Bool(bool b);
 	bool Int(int i);
@@ -85,3 +508,33 @@ struct JSONHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, JSON
 	bool StartArray();
 	bool EndArray(rapidjson::SizeType elementCount);
 };
+
+struct ConverterState;
+
+/**
+ * Reusable converter. It keeps its JSON buffer and writers, parse buffer
+ * and JSON handler across calls and resets them without freeing, so
+ * converting many small records does not grow them from empty each time.
+ * A converter is used by one thread at a time.
+ */
+class Converter
+{
+public:
+	Converter();
+	~Converter();
+	Converter(const Converter &) = delete;
+	Converter &operator=(const Converter &) = delete;
+	void gb2json(const char *gb, size_t len, std::string *json, gberror *err, const gboptions *opts = nullptr);
+	std::string gb2json(const std::string *gb, gberror *err, const gboptions *opts = nullptr);
+	void json2gb(const char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+	void json2gbInsitu(char *json, size_t len, std::string *gb, gberror *err, const gboptions *opts = nullptr);
+	std::string json2gb(const std::string *json, gberror *err, const gboptions *opts = nullptr);
+	std::string json2gb(std::string &&json, gberror *err, const gboptions *opts = nullptr);
+	void gb2json(const char *gb, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts = nullptr);
+	void json2gb(const char *json, size_t len, gbwrite write, void *user, gberror *err, const gboptions *opts = nullptr);
+
+private:
+	ConverterState *state; ///< Buffers kept between calls.
+};
+
+void serveRequests(FILE *in, FILE *out, Converter *converter, gberror *err);
@@ -0,0 +1,162 @@
+/*
+ * gbjson_c.h: C interface of the conversion library
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * The interface is for bindings from other languages. Input is a
+ * character buffer with its length, e.g. a memory-mapped file, and is
+ * never copied. Output goes either straight into a caller-supplied buffer,
+ * with a size query if it does not fit, or through a write callback. Conversions
+ * run on an opaque context that keeps its buffers between calls. A
+ * context must not be used by two threads at once.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Version of this interface. It changes only with incompatible changes.
+ */
+#define GBJSON_C_API 1
+
+/**
+ * Status codes.
+ */
+#define GBJSON_OK 0				  /* Success */
+#define GBJSON_ERROR 1			  /* Conversion failed, see gbjson_error() */
+#define GBJSON_BUFFER_TOO_SMALL 2 /* Output does not fit, it is kept in the context */
+
+/**
+ * Options for gbjson_set_option(). Flags take 0 or 1.
+ */
+#define GBJSON_OPTION_COMPACT 1		   /* Write JSON without indentation */
+#define GBJSON_OPTION_NDJSON 2		   /* Write JSON Lines */
+#define GBJSON_OPTION_LOCATIONS 3	   /* Add parsed feature locations */
+#define GBJSON_OPTION_THREADS 4		   /* Number of threads, 0 for all hardware threads */
+#define GBJSON_OPTION_SPLIT_FEATURES 5 /* Parse large feature tables on several threads */
+#define GBJSON_OPTION_VALIDATE 6	   /* Validate JSON against the gbjson layout */
+
+/**
+ * Conversion context. Holds the options, buffers, retained output and
+ * last error.
+ */
+typedef struct gbjson_context gbjson_context;
+
+/**
+ * Output callback. Takes len bytes of output and returns the number of
+ * bytes taken; fewer than len fails the conversion.
+ */
+typedef size_t (*gbjson_write_fn)(const char *data, size_t len, void *user);
+
+/**
+ * Create a context with default options.
+ * @return The context, or NULL if out of memory.
+ */
+gbjson_context *gbjson_context_new(void);
+
+/**
+ * Free a context. NULL is ignored.
+ * @param[in] ctx The context.
+ */
+void gbjson_context_free(gbjson_context *ctx);
+
+/**
+ * Set an option of later conversions.
+ * @param[in,out] ctx The context.
+ * @param[in] option One of the GBJSON_OPTION_ values.
+ * @param[in] value The value.
+ * @return GBJSON_OK, or GBJSON_ERROR for an unknown option or bad value.
+ */
+int gbjson_set_option(gbjson_context *ctx, int option, int value);
+
+/**
+ * Convert GenBank to JSON into a caller-supplied buffer. The output is
+ * written into the buffer as it is produced and is not NUL-terminated.
+ * If it is longer than capacity, the buffer contents are undefined,
+ * *size is set to its length and the output is kept in the context, so
+ * it can be taken with gbjson_output() without converting again. Pass a
+ * NULL buffer and 0 to query the size.
+ * @param[in,out] ctx The context.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[out] out The output buffer, or NULL.
+ * @param[in] capacity The output buffer size.
+ * @param[out] size Length of the output.
+ * @return GBJSON_OK, GBJSON_ERROR or GBJSON_BUFFER_TOO_SMALL.
+ */
+int gbjson_gb2json(gbjson_context *ctx, const char *gb, size_t len, char *out, size_t capacity, size_t *size);
+
+/**
+ * Convert JSON to GenBank into a caller-supplied buffer, as gbjson_gb2json().
+ * @param[in,out] ctx The context.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[out] out The output buffer, or NULL.
+ * @param[in] capacity The output buffer size.
+ * @param[out] size Length of the output.
+ * @return GBJSON_OK, GBJSON_ERROR or GBJSON_BUFFER_TOO_SMALL.
+ */
+int gbjson_json2gb(gbjson_context *ctx, const char *json, size_t len, char *out, size_t capacity, size_t *size);
+
+/**
+ * Convert GenBank to JSON through a write callback. The callback receives
+ * the output in blocks of about 1 MB as it is produced, so large outputs
+ * are never held in full.
+ * @param[in,out] ctx The context.
+ * @param[in] gb The GenBank buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @return GBJSON_OK or GBJSON_ERROR.
+ */
+int gbjson_gb2json_write(gbjson_context *ctx, const char *gb, size_t len, gbjson_write_fn write, void *user);
+
+/**
+ * Convert JSON to GenBank through a write callback, as gbjson_gb2json_write().
+ * @param[in,out] ctx The context.
+ * @param[in] json The JSON buffer.
+ * @param[in] len The buffer length.
+ * @param[in] write The output callback.
+ * @param[in] user The argument of the output callback.
+ * @return GBJSON_OK or GBJSON_ERROR.
+ */
+int gbjson_json2gb_write(gbjson_context *ctx, const char *json, size_t len, gbjson_write_fn write, void *user);
+
+/**
+ * Borrow the output of the last buffer conversion that returned
+ * GBJSON_BUFFER_TOO_SMALL. It is empty after any other result. The data
+ * stays valid until the next conversion on the context or until it is
+ * freed.
+ * @param[in] ctx The context.
+ * @param[out] data The output. Not NUL-terminated.
+ * @param[out] size Length of the output.
+ */
+void gbjson_output(const gbjson_context *ctx, const char **data, size_t *size);
+
+/**
+ * Message of the last failed conversion.
+ * @param[in] ctx The context.
+ * @return The NUL-terminated message, empty if the last conversion succeeded.
+ */
+const char *gbjson_error(const gbjson_context *ctx);
+
+/**
+ * JSON Schema of the gbjson layout.
+ * @return The NUL-terminated schema.
+ */
+const char *gbjson_layout_schema(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,9 +8,12 @@
  */
 
 #include <iostream>
-#include <fstream> // ofstream
 #include <string>
 #include <memory> // make_unique
+#include <cstring> // strcmp
+#include <chrono>
+#include <vector>
+#include <cstdlib> // strtol
 #include "gbjson.h"
 #include "optionparser/optionparser.h"
 
@@ -19,18 +22,81 @@ enum optionIndex
 	UNKNOWN,
 	HELP,
 	FORCE,
+	INSITU,
+	STREAM,
+	PIPELINE,
+	STATS,
+	THREADS,
+	OUTDIR,
+	LIST,
+	SEQUENCES,
+	VALIDATE,
+	SCHEMA,
 	VERSION
 };
 
+struct Arg : public option::Arg
+{
+	static option::ArgStatus Numeric(const option::Option &option, bool msg)
+	{
+		char *endptr = 0;
+		if (option.arg != 0 && strtol(option.arg, &endptr, 10) >= 0 && endptr != option.arg && *endptr == 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a non-negative number" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+
+	static option::ArgStatus Required(const option::Option &option, bool msg)
+	{
+		if (option.arg != 0 && *option.arg != 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires an argument" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+};
+
+// Seconds since a time point
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 const option::Descriptor usage[] =
 	{
 		{UNKNOWN, 0, "", "", option::Arg::None, "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
 												"~~ JSON to GenBank converter\n\n"
 												"USAGE: json2gb [options] in.json out.gb\n"
-												"       json2gb [options] in.json\n\n"
+												"       json2gb [options] in.json\n"
+												"       json2gb [options] --outdir=DIR in.json|dir ...\n\n"
 												"Options:"},
 		{HELP, 0, "h", "help", option::Arg::None, "  -h  --help      Print help."},
 		{FORCE, 0, "f", "force", option::Arg::None, "  -f  --force     Input and output filenames can be the same."},
+		{INSITU, 0, "i", "insitu", option::Arg::None, "  -i  --insitu    Decode JSON strings in place."},
+		{STREAM, 0, "s", "stream", option::Arg::None, "  -s  --stream    Convert record by record with bounded memory."},
+		{PIPELINE, 0, "p", "pipeline", option::Arg::None, "  -p  --pipeline  Stream with reading and writing on separate threads."},
+		{STATS, 0, "", "stats", option::Arg::Optional, "      --stats     Print phase times and counts to stderr.\n"
+													   "      --stats=json  Print them as JSON."},
+		{THREADS, 0, "t", "threads", Arg::Numeric, "  -t  --threads=N Convert records on N threads, or files with --outdir.\n"
+													 "                  0 uses all cores."},
+		{OUTDIR, 0, "o", "outdir", Arg::Required, "  -o  --outdir=DIR Convert all inputs into DIR. Directories are expanded\n"
+												  "                  to their files. Files are converted on --threads threads."},
+		{LIST, 0, "l", "list", Arg::Required, "  -l  --list=FILE  Read more inputs from FILE, one per line. Needs --outdir."},
+		{SEQUENCES, 0, "", "sequences", Arg::Required, "      --sequences=FILE  Read referenced sequences from FILE."},
+		{VALIDATE, 0, "", "validate", option::Arg::None, "      --validate  Check the JSON against the gbjson layout schema while\n"
+														 "                  converting it, and stop at the first violation."},
+		{SCHEMA, 0, "", "schema", option::Arg::None, "      --schema    Print the JSON Schema of the gbjson layout."},
 		{VERSION, 0, "v", "version", option::Arg::None, "  -v  --version   Print program version.\n"},
 		{0, 0, 0, 0, 0, 0}};
 
@@ -63,6 +129,86 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	if (options[SCHEMA])
+	{
+		std::cout << layoutSchema() << std::endl;
+		return 0;
+	}
+
+	gberror err;
+	gbstats phaseStats;
+	bool statsJson = options[STATS] && options[STATS].arg && strcmp(options[STATS].arg, "json") == 0;
+
+	// Set conversion options
+	gboptions opts;
+	opts.validate = options[VALIDATE];
+	if (options[STATS])
+	{
+		opts.stats = &phaseStats;
+	}
+	if (options[THREADS])
+	{
+		opts.threads = atoi(options[THREADS].arg);
+	}
+
+	// Convert a batch of files into an output directory
+	if (options[OUTDIR])
+	{
+		if (options[SEQUENCES])
+		{
+			std::cout << "--sequences cannot be used with --outdir." << std::endl;
+			return 1;
+		}
+
+		std::vector<std::string> inputs(parse.nonOptions(), parse.nonOptions() + parse.nonOptionsCount());
+		if (options[LIST])
+		{
+			std::string list(options[LIST].arg);
+			fileList(&list, &inputs, &err);
+		}
+
+		std::vector<gbjob> jobs;
+		std::string outdir(options[OUTDIR].arg);
+		if (!err.flag)
+		{
+			batchJobs(&inputs, &outdir, ".gb", &jobs, &err);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		// Convert on all cores unless told otherwise
+		if (!options[THREADS])
+		{
+			opts.threads = 0;
+		}
+
+		json2gbBatch(&jobs, &opts);
+
+		int failed = 0;
+		for (auto &job : jobs)
+		{
+			if (job.err.flag)
+			{
+				std::cout << job.input << ": " << job.err.msg << std::endl;
+				failed++;
+			}
+			else
+			{
+				std::cout << job.output << std::endl;
+			}
+		}
+
+		if (options[STATS])
+		{
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return failed ? 1 : 0;
+	}
+
 	// Check number of file arguments
 	int nFiles = parse.nonOptionsCount();
 	if (nFiles == 0 || nFiles > 2)
@@ -80,50 +226,140 @@ int main(int argc, char *argv[])
 		outfile = parse.nonOptions()[1];
 	}
 
-	if (infile == outfile && !options[FORCE])
+	if (nFiles == 2 && sameFile(&infile, &outfile) && !options[FORCE])
 	{
 		std::cout << "Input and output filenames must be different." << std::endl;
 		return 1;
 	}
 
-	std::string gb, json;
-	gberror err;
+	// Open the sequence sidecar
+	std::unique_ptr<FILE, int (*)(FILE *)> sequences(nullptr, &fclose);
+	if (options[SEQUENCES])
+	{
+		sequences.reset(fopen(options[SEQUENCES].arg, "rb"));
+		if (!sequences)
+		{
+			std::cout << "Failed to open " << options[SEQUENCES].arg << std::endl;
+			return 1;
+		}
+		opts.sequences = sequences.get();
+	}
 
-	// Read the input file
-	fileToString(&infile, &json, &err);
-	if (err.flag)
+	// Stream the conversion
+	if (options[STREAM] || options[PIPELINE])
+	{
+		opts.pipeline = options[PIPELINE];
+
+		FILE *input = fopen(infile.c_str(), "rb");
+		if (!input)
+		{
+			std::cout << "Failed to open " << infile << std::endl;
+			return 1;
+		}
+
+		// Compress the output as named. A file replaces the target only
+		// when done, as it may be the input.
+		opts.compression = compressionFromName(&outfile);
+		OutputFile file;
+		if (nFiles == 2 && !file.open(&outfile, opts.compression != GB_PLAIN, &err))
+		{
+			std::cout << err.msg << std::endl;
+			fclose(input);
+			return 1;
+		}
+
+		json2gbStream(input, nFiles == 2 ? file.file : stdout, &err, &opts);
+		fclose(input);
+
+		if (nFiles == 2 && !err.flag)
+		{
+			file.commit(&err);
+		}
+
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+
+		if (nFiles == 2)
+		{
+			std::cout << outfile << std::endl;
+		}
+		if (options[STATS])
+		{
+			printStats(&phaseStats, stderr, statsJson);
+		}
+		return 0;
+	}
+
+	std::string json;
+
+	// Map the input file. Fall back to reading it if it cannot be mapped.
+	auto start = std::chrono::steady_clock::now();
+	MappedFile map;
+	fileToMap(&infile, &map, &err, options[INSITU]);
+
+	const char *input = map.data;
+	char *mutableInput = map.writableData();
+	size_t inputLen = map.size;
+
+	// Compressed files are decompressed while reading
+	if (err.flag || detectCompression(map.data, map.size) != GB_PLAIN)
+	{
+		err = gberror();
+		map.unmap();
+		fileToString(&infile, &json, &err);
+		if (err.flag)
+		{
+			std::cout << err.msg << std::endl;
+			return 1;
+		}
+		input = json.data();
+		mutableInput = &json[0];
+		inputLen = json.size();
+	}
+	phaseStats.readTime += secondsSince(start);
+
+	// Convert the JSON string to GenBank written straight to the output.
+	// A file is written under a temporary name and replaces the target
+	// when done, so a failed conversion leaves no output and the input
+	// stays intact if it is the output as well.
+	opts.compression = compressionFromName(&outfile);
+	OutputFile file;
+	if (nFiles == 2 && !file.open(&outfile, opts.compression != GB_PLAIN, &err))
 	{
 		std::cout << err.msg << std::endl;
 		return 1;
 	}
+	FILE *output = nFiles == 2 ? file.file : stdout;
 
-	// Convert the JSON string to GenBank
-	json2gb(&json, &gb, &err);
+	if (options[INSITU])
+	{
+		json2gbInsitu(mutableInput, inputLen, output, &err, &opts);
+	}
+	else
+	{
+		json2gb(input, inputLen, output, &err, &opts);
+	}
+
+	if (nFiles == 2 && !err.flag)
+	{
+		file.commit(&err);
+	}
 
-	// Write output
 	if (err.flag)
 	{
 		std::cout << err.msg << std::endl;
 		return 1;
 	}
-	else
+
+	if (nFiles == 2)
 	{
-		if (nFiles == 1)
-		{
-			std::cout << gb;
-		}
-		else
-		{
-			std::ofstream output(outfile);
-			output << gb;
-			if (output.fail())
-			{
-				std::cout << "Failed writing to " << outfile << std::endl;
-				output.close();
-				return 1;
-			}
-			output.close();
-			std::cout << outfile << std::endl;
-		}
+		std::cout << outfile << std::endl;
+	}
+	if (options[STATS])
+	{
+		printStats(&phaseStats, stderr, statsJson);
 	}
 }
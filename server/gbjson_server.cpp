@@ -0,0 +1,303 @@
+/*
+ * gbjson_server.cpp: Conversion server
+ *
+ * Copyright (c) 2019 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * gbjson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <iostream>
+#include <string>
+#include <memory> // make_unique
+#include <cstdlib> // strtol
+#include <algorithm> // max
+#include <stdio.h> // fdopen
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include "gbjson.h"
+#include "optionparser/optionparser.h"
+
+#ifdef _WIN32
+#include <io.h>	   // _setmode
+#include <fcntl.h> // _O_BINARY
+#else
+#include <signal.h>		// signal
+#include <unistd.h>		// close, dup, unlink
+#include <sys/socket.h> // socket, bind, listen, accept
+#include <sys/stat.h>	// stat
+#include <sys/un.h>		// sockaddr_un
+#include <cerrno>
+#include <cstring> // strerror
+#endif
+
+enum optionIndex
+{
+	UNKNOWN,
+	HELP,
+	SOCKET,
+	THREADS,
+	VERSION
+};
+
+struct Arg : public option::Arg
+{
+	static option::ArgStatus Numeric(const option::Option &option, bool msg)
+	{
+		char *endptr = 0;
+		if (option.arg != 0 && strtol(option.arg, &endptr, 10) >= 0 && endptr != option.arg && *endptr == 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a non-negative number" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+
+	static option::ArgStatus Required(const option::Option &option, bool msg)
+	{
+		if (option.arg != 0 && *option.arg != 0)
+		{
+			return option::ARG_OK;
+		}
+
+		if (msg)
+		{
+			std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires an argument" << std::endl;
+		}
+		return option::ARG_ILLEGAL;
+	}
+};
+
+const option::Descriptor usage[] =
+	{
+		{UNKNOWN, 0, "", "", option::Arg::None, "\n~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+												"~~ gbjson conversion server\n\n"
+												"USAGE: gbjson_server [options]\n"
+												"       gbjson_server [options] --socket=PATH\n\n"
+												"Requests are read from stdin and answered on stdout, or served\n"
+												"on a Unix domain socket. A request is the line\n"
+												"  gb2json LENGTH [compact] [ndjson] [locations]\n"
+												"or\n"
+												"  json2gb LENGTH\n"
+												"followed by LENGTH bytes of input. It is answered by the line\n"
+												"  ok LENGTH\n"
+												"and the result, or by the line\n"
+												"  error LENGTH CODE\n"
+												"and the error message. CODE is gb2json or json2gb for a\n"
+												"failed conversion, header for a malformed header, which is\n"
+												"skipped with its payload, and length or truncated for a\n"
+												"request that ends the connection.\n\n"
+												"Options:"},
+		{HELP, 0, "h", "help", option::Arg::None, "  -h  --help      Print help."},
+		{SOCKET, 0, "s", "socket", Arg::Required, "  -s  --socket=PATH  Listen on a Unix domain socket."},
+		{THREADS, 0, "t", "threads", Arg::Numeric, "  -t  --threads=N Serve N socket connections at a time. 0, the default,\n"
+												   "                  uses all cores."},
+		{VERSION, 0, "v", "version", option::Arg::None, "  -v  --version   Print program version.\n"},
+		{0, 0, 0, 0, 0, 0}};
+
+#ifndef _WIN32
+/**
+ * Queue of accepted connections for the worker threads.
+ */
+struct ConnectionQueue
+{
+	std::mutex mutex;			///< Guards the queue.
+	std::condition_variable ready; ///< Signals a queued connection.
+	std::deque<int> sockets;	///< Accepted sockets.
+
+	void push(int fd)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sockets.push_back(fd);
+		}
+		ready.notify_one();
+	}
+
+	int pop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this] { return !sockets.empty(); });
+		int fd = sockets.front();
+		sockets.pop_front();
+		return fd;
+	}
+};
+
+/**
+ * Serve the connections of a queue. Each worker keeps its converter
+ * warm across requests and connections.
+ * @param[in,out] queue The connection queue.
+ */
+static void serveConnections(ConnectionQueue *queue)
+{
+	Converter converter;
+
+	for (;;)
+	{
+		int fd = queue->pop();
+		int outFd = dup(fd);
+		FILE *in = fdopen(fd, "rb");
+		FILE *out = outFd >= 0 ? fdopen(outFd, "wb") : nullptr;
+
+		gberror err;
+		if (in && out)
+		{
+			serveRequests(in, out, &converter, &err);
+		}
+		else
+		{
+			err.flag = true;
+			err.msg = "Failed opening the connection";
+		}
+
+		if (err.flag)
+		{
+			std::cerr << err.msg << std::endl;
+		}
+
+		if (in)
+		{
+			fclose(in);
+		}
+		else
+		{
+			close(fd);
+		}
+		if (out)
+		{
+			fclose(out);
+		}
+		else if (outFd >= 0)
+		{
+			close(outFd);
+		}
+	}
+}
+
+/**
+ * Listen on a Unix domain socket and serve connections on a pool of
+ * threads. A stale socket file is replaced.
+ * @param[in] path The socket path.
+ * @param[in] threads Number of connections served at a time.
+ * @return Exit status.
+ */
+static int serveSocket(const std::string *path, int threads)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path->size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path too long: " << *path << std::endl;
+		return 1;
+	}
+	path->copy(address.sun_path, path->size());
+
+	struct stat st;
+	if (stat(path->c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path->c_str());
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		std::cout << "Failed listening on " << *path << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	// Closed connections are reported by write errors
+	signal(SIGPIPE, SIG_IGN);
+
+	ConnectionQueue queue;
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++)
+	{
+		pool.emplace_back(serveConnections, &queue);
+	}
+
+	for (;;)
+	{
+		int fd = accept(listener, nullptr, nullptr);
+		if (fd >= 0)
+		{
+			queue.push(fd);
+		}
+		else if (errno != EINTR && errno != ECONNABORTED)
+		{
+			std::cout << "Failed accepting connections: " << strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	// Parse command line options
+	argc -= (argc > 0);
+	argv += (argc > 0); // skip program name argv[0]
+	option::Stats stats(usage, argc, argv);
+	auto options = std::make_unique<option::Option[]>(stats.options_max);
+	auto buffer = std::make_unique<option::Option[]>(stats.buffer_max);
+	option::Parser parse(usage, argc, argv, options.get(), buffer.get());
+
+	if (parse.error() || parse.nonOptionsCount() > 0)
+	{
+		option::printUsage(std::cout, usage);
+		return 1;
+	}
+
+	if (options[HELP])
+	{
+		option::printUsage(std::cout, usage);
+		return 0;
+	}
+
+	if (options[VERSION])
+	{
+		std::cout << "gbjson_server "
+				  << "v" << VERSION_MAJOR << "." << VERSION_MINOR << "." << VERSION_PATCH << std::endl;
+		return 0;
+	}
+
+	if (options[SOCKET])
+	{
+#ifdef _WIN32
+		std::cout << "--socket is not supported on Windows." << std::endl;
+		return 1;
+#else
+		int threads = options[THREADS] ? atoi(options[THREADS].arg) : 0;
+		if (threads == 0)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		std::string path(options[SOCKET].arg);
+		return serveSocket(&path, threads);
+#endif
+	}
+
+	// Serve stdin/stdout. Diagnostics go to stderr, since stdout carries the responses.
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	Converter converter;
+	gberror err;
+	serveRequests(stdin, stdout, &converter, &err);
+
+	if (err.flag)
+	{
+		std::cerr << err.msg << std::endl;
+		return 1;
+	}
+	return 0;
+}